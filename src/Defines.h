@@ -2,14 +2,6 @@
 // #define PYVK
 // #define _DEBUG
 
-/**
- * Planed extensions:
- * ==================
- * TODO:Vk_GpuTargetOp => define target operation for each Vk_DataBuffer and remove VK_SHARING_MODE_CONCURRENT
- *    - needs additional queue isolation in Vk_LogicalDeviceQueue => isolate Compute and Graphics queue families to Compute and Graphics Vk_GpuOp
- *    - 
- */
-
 // some generic way to distinguish operating systems
 #if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__NT__)
    //define something for Windows (32-bit and 64-bit, this part is common)
@@ -168,7 +160,19 @@ namespace VK5 {
         Graphics = static_cast<int>(Vk_GpuOp::Graphics),
         Compute = static_cast<int>(Vk_GpuOp::Compute),
         Transfer = static_cast<int>(Vk_GpuOp::Transfer),
-        Auto /* Default so far => TODO: at some point make this one work selectively */
+        Auto /* shared by all queue families (VK_SHARING_MODE_CONCURRENT) */
+    };
+
+    /**
+     * Priority lanes of the gpu task system. Vk_Queue submits the lanes in this order.
+     *  - FrameCritical: a frame waits for it (for example uniform updates)
+     *  - Interactive: should be there within a few frames (default)
+     *  - Background: bulk data streaming, resize copies. Throttled and split into chunks
+     */
+    enum class Vk_GpuTaskPriority {
+        FrameCritical,
+        Interactive,
+        Background
     };
 
     static std::string Vk_GpuOp2String(const Vk_GpuOp& type){
@@ -45,12 +45,12 @@ namespace VK5 {
 
         struct VkCommandPoolCreateInfo_W {
             VkCommandPoolCreateInfo data;
-            VkCommandPoolCreateInfo_W(uint32_t familyIndex)
+            VkCommandPoolCreateInfo_W(uint32_t familyIndex, VkCommandPoolCreateFlags flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT)
             :
             data({
                 .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
                 .pNext = nullptr,
-                .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+                .flags = flags,
                 .queueFamilyIndex = familyIndex
             })
             {}
@@ -130,7 +130,8 @@ namespace VK5 {
         };
 
         /**
-         * TODO:Vk_GpuTargetOp - remove implicit switch to CONCURRENT
+         * One queue family => EXCLUSIVE to that family, several => CONCURRENT (Vk_GpuTargetOp::Auto,
+         * see Vk_PhysicalDevice::createAndAllocBuffer)
          */
         struct VkBufferCreateInfo_W {
             std::vector<uint32_t> vkQueueFamilyIndices;
@@ -151,6 +152,21 @@ namespace VK5 {
             {}
         };
 
+        struct VkQueryPoolCreateInfo_W {
+            VkQueryPoolCreateInfo data;
+            VkQueryPoolCreateInfo_W(VkQueryType queryType, uint32_t queryCount)
+            :
+            data({
+                .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+                .pNext = nullptr,
+                .flags = 0,
+                .queryType = queryType,
+                .queryCount = queryCount,
+                .pipelineStatistics = 0
+            })
+            {}
+        };
+
         struct VkMemoryAllocateInfo_W {
             VkMemoryAllocateInfo data;
             VkMemoryAllocateInfo_W(VkDeviceSize allocationSize, uint32_t memoryTypeIndex)
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+#include <cstdint>
+
+#include "../Defines.h"
+#include "Vk_DeviceMemoryAllocator.hpp"
+
+namespace VK5 {
+    // bytes Vk_Defragmenter::step moves at most by default
+    constexpr std::uint64_t GLOBAL_DEFRAGMENT_STEP_SIZE = 8ull*1024ull*1024ull;
+    // steps without progress (busy buffers) before the defragmenter gives up on a block
+    constexpr size_t GLOBAL_DEFRAGMENT_MAX_STALLED_STEPS = 64;
+
+    /**
+     * Owner of sub-allocated buffers that can recreate one of them somewhere else (see Vk_DataBuffer).
+     */
+    class Vk_RelocatableClient {
+    public:
+        virtual ~Vk_RelocatableClient() {}
+        /**
+         * Start moving buffer into a new allocation. Returns the amount of bytes that are moved, 0 if buffer
+         * doesn't belong to the client or the client is busy. The GPU copy may still run when this returns.
+         * Must not block.
+         */
+        virtual std::uint64_t relocate(VkBuffer buffer) = 0;
+        // destroy the buffers relocate replaced that no frame draws from anymore. Must not block
+        virtual void releaseRetired() = 0;
+    };
+
+    /**
+     * Incremental defragmentation of Vk_DeviceMemoryAllocator for long sessions: growing and shrinking buffers leave
+     * half empty blocks behind. Every step moves a few buffers out of one such block (Vk_DeviceMemoryAllocator::evacuationCandidates)
+     * until the block is empty and freed. Call step in frames with time to spare:
+     *    if(frameTime < budget) physicalDevice->defragmenter().step();
+     * The copies are background Vk_GpuTasks, the owners swap to the new buffers once they are done
+     * (Vk_DataBuffer flips _bufferIndex), so rendering never waits for a move.
+     */
+    class Vk_Defragmenter {
+        Vk_DeviceMemoryAllocator* _allocator;
+        std::mutex _mutex;
+        std::vector<Vk_RelocatableClient*> _clients;
+        size_t _stalledSteps;
+
+    public:
+        Vk_Defragmenter(Vk_DeviceMemoryAllocator* allocator)
+        : _allocator(allocator), _clients({}), _stalledSteps(0)
+        {}
+
+        Vk_Defragmenter(const Vk_Defragmenter& other) = delete;
+        Vk_Defragmenter(Vk_Defragmenter&& other) = delete;
+        Vk_Defragmenter& operator=(const Vk_Defragmenter& other) = delete;
+        Vk_Defragmenter& operator=(Vk_Defragmenter&& other) = delete;
+
+        // clients must unregister before they are destroyed, removeClient waits for a running step
+        void addClient(Vk_RelocatableClient* client) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _clients.push_back(client);
+        }
+
+        void removeClient(Vk_RelocatableClient* client) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            std::erase(_clients, client);
+        }
+
+        /**
+         * Any thread. Releases what earlier steps replaced and starts moving at most maxBytes (at least one buffer)
+         * out of the block that is being emptied. Returns the amount of bytes that started moving.
+         */
+        std::uint64_t step(std::uint64_t maxBytes = GLOBAL_DEFRAGMENT_STEP_SIZE) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            for(Vk_RelocatableClient* c : _clients) c->releaseRetired();
+
+            std::vector<VkBuffer> buffers = _allocator->evacuationCandidates();
+            if(buffers.empty()) return 0;
+
+            std::uint64_t moved = 0;
+            for(VkBuffer buffer : buffers){
+                if(moved >= maxBytes) break;
+                for(Vk_RelocatableClient* c : _clients){
+                    std::uint64_t m = c->relocate(buffer);
+                    if(m == 0) continue;
+                    moved += m;
+                    break;
+                }
+            }
+
+            if(moved > 0) _stalledSteps = 0;
+            else if(++_stalledSteps >= GLOBAL_DEFRAGMENT_MAX_STALLED_STEPS){
+                // the rest belongs to buffers that are always busy or have no owner that can move them
+                _allocator->cancelEvacuation();
+                _stalledSteps = 0;
+            }
+            return moved;
+        }
+    };
+}
@@ -81,7 +81,7 @@ namespace VK5 {
 				for(const auto& queueOpFamilies : queuesOpMap){
 					tabulate::Table tt;
 					tt.format().hide_border();
-					tt.add_row({"FI", "QI"});
+					tt.add_row({"FI", "QI", "D"});
 					int index = 0;
 					auto& op = queueOpFamilies.first;
 					for(const TQueueFamilyIndex& queueFamilyIndex : queueOpFamilies.second){
@@ -89,7 +89,7 @@ namespace VK5 {
 						for(const auto& q : queue){
 							auto qstr = q->toString();
 							int ind = qstr.find('|');
-							tt.add_row({qstr.substr(0, ind), qstr.substr(ind+1, qstr.size() - ind-1) });
+							tt.add_row({qstr.substr(0, ind), qstr.substr(ind+1, qstr.size() - ind-1), std::to_string(q->depth()) });
 							index++;
 						}
 					}
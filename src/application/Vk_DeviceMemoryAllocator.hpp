@@ -0,0 +1,278 @@
+#pragma once
+
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+
+#include "../Defines.h"
+#include "../utils/Ut_RangeAllocator.hpp"
+#include "Vk_LogicalDeviceLib.hpp"
+#include "Vk_MemoryBudget.hpp"
+
+namespace VK5 {
+    // size of one device memory block that buffers are sub-allocated from (see Vk_DeviceMemoryAllocator)
+    constexpr VkDeviceSize GLOBAL_MEMORY_BLOCK_SIZE = 64ull*1024ull*1024ull;
+    // blocks that are at most this full are emptied by the defragmenter (see Vk_DeviceMemoryAllocator::evacuationCandidates)
+    constexpr double GLOBAL_DEFRAGMENT_MAX_BLOCK_USE = 0.5;
+
+    // where a buffer lives: memory at offset. block == nullptr means the buffer has its own allocation
+    struct Vk_MemoryAllocation {
+        VkDeviceMemory memory;
+        VkDeviceSize offset;
+        VkDeviceSize size;
+        TMemoryTypeIndex memoryTypeIndex;
+        THeapIndex heapIndex;
+        UT::Ut_RangeAllocator* block;
+    };
+
+    /**
+     * Sub-allocates buffers from large device memory blocks (one list of blocks per memory type) instead of one
+     * vkAllocateMemory per buffer, so thousands of small buffers stay far away from maxMemoryAllocationCount.
+     * Buffers are bound at the offset of their region, VkMemoryRequirements size and alignment are honored.
+     * Requests larger than half a block get their own allocation. Empty blocks are freed, except for the last one
+     * of each memory type.
+     * The memory type is picked from VkMemoryRequirements::memoryTypeBits, the required and the preferred flags
+     * (see Vk_PhysicalDeviceMemoryLib::rankMemoryTypes). If the best type is out of memory, the next one is used.
+     * NOTE: only memory types without VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT are sub-allocated. Host visible memory gets
+     *       mapped through its VkDeviceMemory by the callers (vkMapMemory at offset 0, one map at a time), which
+     *       doesn't work for shared blocks.
+     * Every vkAllocateMemory (blocks and own allocations) is counted by the Vk_MemoryBudget first. An allocation
+     * the budget refuses is treated like VK_ERROR_OUT_OF_DEVICE_MEMORY.
+     */
+    class Vk_DeviceMemoryAllocator {
+        struct Block {
+            VkDeviceMemory memory;
+            THeapIndex heapIndex;
+            UT::Ut_RangeAllocator ranges;
+            // being emptied by the defragmenter: no new allocations, freed once empty
+            bool evacuating;
+        };
+
+        VkDevice _vkDevice;
+        VkDeviceSize _blockSize;
+        Vk_MemoryBudget _budget;
+        std::mutex _mutex;
+        // memory type index => blocks
+        std::unordered_map<TMemoryTypeIndex, std::vector<std::unique_ptr<Block>>> _blocks;
+        std::unordered_map<VkBuffer, Vk_MemoryAllocation> _allocations;
+
+    public:
+        Vk_DeviceMemoryAllocator(VkDevice vkDevice, VkDeviceSize blockSize = GLOBAL_MEMORY_BLOCK_SIZE)
+        : _vkDevice(vkDevice), _blockSize(blockSize), _budget()
+        {}
+
+        Vk_DeviceMemoryAllocator(const Vk_DeviceMemoryAllocator& other) = delete;
+        Vk_DeviceMemoryAllocator(Vk_DeviceMemoryAllocator&& other) = delete;
+        Vk_DeviceMemoryAllocator& operator=(const Vk_DeviceMemoryAllocator& other) = delete;
+        Vk_DeviceMemoryAllocator& operator=(Vk_DeviceMemoryAllocator&& other) = delete;
+
+        ~Vk_DeviceMemoryAllocator(){
+            // NOTE: all buffers must be destroyed at this point
+            for(auto& t : _blocks){
+                for(auto& b : t.second){
+                    vkFreeMemory(_vkDevice, b->memory, nullptr);
+                    _budget.release(b->heapIndex, _blockSize);
+                }
+            }
+        }
+
+        Vk_MemoryBudget& budget() { return _budget; }
+
+        // flags of the memory type
+        static bool suballocates(VkMemoryPropertyFlags memoryPropertyFlags) {
+            return (memoryPropertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) == 0;
+        }
+
+        /**
+         * Any thread. memory is the block the buffer lives in, it must not be freed by the caller
+         * (use destroyBuffer). Returns the flags of the memory type that was used.
+         */
+        VkMemoryPropertyFlags createAndAllocBuffer(
+            VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags requiredFlags, VkMemoryPropertyFlags preferredFlags,
+            VkBuffer& buffer, VkDeviceMemory& memory, VkDeviceSize size,
+            const std::vector<TQueueFamilyIndex>& queueFamilies, const TMemoryTypes& memoryTypes
+        ) {
+            buffer = Vk_LogicalDeviceLib::createBuffer(_vkDevice, usageFlags, size, queueFamilies);
+            VkMemoryRequirements memReqs;
+            TMemoryTypes candidates = Vk_LogicalDeviceLib::rankMemoryTypes(_vkDevice, buffer, memoryTypes, requiredFlags, preferredFlags, memReqs);
+
+            for(const auto& t : candidates){
+                Vk_MemoryAllocation allocation;
+                try {
+                    allocation = _allocate(memReqs, t);
+                }
+                catch(const OutOfDeviceMemoryException&) {
+                    continue;
+                }
+                Vk_CheckVkResult(typeid(this), vkBindBufferMemory(_vkDevice, buffer, allocation.memory, allocation.offset), "Unable to bind buffer memory to device");
+
+                std::lock_guard<std::mutex> lock(_mutex);
+                _allocations.insert({buffer, allocation});
+                memory = allocation.memory;
+                return t.flags;
+            }
+            vkDestroyBuffer(_vkDevice, buffer, nullptr);
+            buffer = VK_NULL_HANDLE;
+            throw OutOfDeviceMemoryException();
+        }
+
+        /**
+         * Any thread. False if buffer was not created by this allocator. Otherwise the buffer is destroyed and
+         * its region is free again.
+         */
+        bool destroyBuffer(VkBuffer buffer) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto iter = _allocations.find(buffer);
+            if(iter == _allocations.end()) return false;
+            Vk_MemoryAllocation allocation = iter->second;
+            _allocations.erase(iter);
+
+            vkDestroyBuffer(_vkDevice, buffer, nullptr);
+            if(allocation.block == nullptr){
+                vkFreeMemory(_vkDevice, allocation.memory, nullptr);
+                _budget.release(allocation.heapIndex, allocation.size);
+                return true;
+            }
+            allocation.block->free(allocation.offset, allocation.size);
+            _freeEmptyBlocks(allocation.memoryTypeIndex);
+            return true;
+        }
+
+        // any thread: amount of vkAllocateMemory calls that are currently alive
+        size_t deviceAllocationCount() {
+            std::lock_guard<std::mutex> lock(_mutex);
+            size_t count = 0;
+            for(const auto& t : _blocks) count += t.second.size();
+            for(const auto& a : _allocations) if(a.second.block == nullptr) ++count;
+            return count;
+        }
+
+        size_t bufferCount() {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _allocations.size();
+        }
+
+        /**
+         * Any thread. The buffers that still live in the block that is being emptied. If there is none, a block
+         * is picked: the least used one of a memory type that is at most GLOBAL_DEFRAGMENT_MAX_BLOCK_USE full and
+         * whose data fits into the free space of the other blocks of that type. From then on the block takes
+         * no new allocations, so buffers that are recreated (see Vk_Defragmenter) end up in the other blocks.
+         * Once it's empty, it's freed. Empty if no block is worth emptying.
+         */
+        std::vector<VkBuffer> evacuationCandidates() {
+            std::lock_guard<std::mutex> lock(_mutex);
+            Block* block = _evacuatingBlock();
+            if(block == nullptr) block = _pickEvacuationBlock();
+            if(block == nullptr) return {};
+            block->evacuating = true;
+
+            std::vector<VkBuffer> buffers;
+            for(const auto& a : _allocations){
+                if(a.second.block == &block->ranges) buffers.push_back(a.first);
+            }
+            return buffers;
+        }
+
+        // any thread: the block that is being emptied takes allocations again
+        void cancelEvacuation() {
+            std::lock_guard<std::mutex> lock(_mutex);
+            Block* block = _evacuatingBlock();
+            if(block != nullptr) block->evacuating = false;
+        }
+
+    private:
+        Vk_MemoryAllocation _allocate(const VkMemoryRequirements& memReqs, const Vk_MemoryType& memoryType) {
+            TMemoryTypeIndex memoryTypeIndex = memoryType.memoryTypeIndex;
+            THeapIndex heapIndex = memoryType.heapIndex;
+            if(!suballocates(memoryType.flags) || memReqs.size > _blockSize / 2){
+                VkDeviceMemory memory = _allocMemory(memReqs.size, memoryType);
+                return Vk_MemoryAllocation { .memory = memory, .offset = 0, .size = memReqs.size, .memoryTypeIndex = memoryTypeIndex, .heapIndex = heapIndex, .block = nullptr };
+            }
+
+            Vk_MemoryAllocation allocation;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if(_allocateFromBlocks(memReqs, memoryType, allocation)) return allocation;
+            }
+
+            // NOTE: without _mutex: the budget may demote other buffers, which frees their regions
+            VkDeviceMemory memory = _allocMemory(_blockSize, memoryType);
+            std::lock_guard<std::mutex> lock(_mutex);
+            // other threads may have freed regions or added a block in the meantime => the new block may not be needed
+            if(_allocateFromBlocks(memReqs, memoryType, allocation)){
+                vkFreeMemory(_vkDevice, memory, nullptr);
+                _budget.release(heapIndex, _blockSize);
+                return allocation;
+            }
+            auto& blocks = _blocks[memoryTypeIndex];
+            blocks.push_back(std::unique_ptr<Block>(new Block { .memory = memory, .heapIndex = heapIndex, .ranges = UT::Ut_RangeAllocator(_blockSize), .evacuating = false }));
+            Block& block = *blocks.back();
+            VkDeviceSize offset = block.ranges.allocate(memReqs.size, memReqs.alignment);
+            return Vk_MemoryAllocation { .memory = block.memory, .offset = offset, .size = memReqs.size, .memoryTypeIndex = memoryTypeIndex, .heapIndex = heapIndex, .block = &block.ranges };
+        }
+
+        // _mutex must be locked. False if none of the blocks of memoryType has room
+        bool _allocateFromBlocks(const VkMemoryRequirements& memReqs, const Vk_MemoryType& memoryType, Vk_MemoryAllocation& allocation) {
+            for(auto& b : _blocks[memoryType.memoryTypeIndex]){
+                if(b->evacuating) continue;
+                VkDeviceSize offset = b->ranges.allocate(memReqs.size, memReqs.alignment);
+                if(offset == UT::Ut_RangeAllocator::InvalidOffset) continue;
+                allocation = Vk_MemoryAllocation { .memory = b->memory, .offset = offset, .size = memReqs.size, .memoryTypeIndex = memoryType.memoryTypeIndex, .heapIndex = memoryType.heapIndex, .block = &b->ranges };
+                return true;
+            }
+            return false;
+        }
+
+        // throws OutOfDeviceMemoryException if the budget or the driver refuse
+        VkDeviceMemory _allocMemory(VkDeviceSize size, const Vk_MemoryType& memoryType) {
+            bool deviceLocal = (memoryType.flags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) != 0;
+            if(!_budget.reserve(memoryType.heapIndex, size, deviceLocal)) throw OutOfDeviceMemoryException();
+            try {
+                return Vk_LogicalDeviceLib::allocBuffer(_vkDevice, size, memoryType.memoryTypeIndex);
+            }
+            catch(const OutOfDeviceMemoryException&) {
+                _budget.release(memoryType.heapIndex, size);
+                throw;
+            }
+        }
+
+        // _mutex must be locked
+        Block* _evacuatingBlock() {
+            for(auto& t : _blocks){
+                for(auto& b : t.second) if(b->evacuating) return b.get();
+            }
+            return nullptr;
+        }
+
+        // _mutex must be locked
+        Block* _pickEvacuationBlock() {
+            Block* best = nullptr;
+            VkDeviceSize maxUse = static_cast<VkDeviceSize>(static_cast<double>(_blockSize) * GLOBAL_DEFRAGMENT_MAX_BLOCK_USE);
+            for(auto& t : _blocks){
+                VkDeviceSize free = 0;
+                for(const auto& b : t.second) free += _blockSize - b->ranges.used();
+                for(auto& b : t.second){
+                    VkDeviceSize used = b->ranges.used();
+                    // NOTE: the free space of the other blocks may be fragmented too, a move that doesn't fit gets a new block
+                    if(used == 0 || used > maxUse || used > free - (_blockSize - used)) continue;
+                    if(best == nullptr || used < best->ranges.used()) best = b.get();
+                }
+            }
+            return best;
+        }
+
+        // _mutex must be locked
+        void _freeEmptyBlocks(TMemoryTypeIndex memoryTypeIndex) {
+            // keep one empty block around so that a buffer that is recreated right away doesn't allocate again
+            bool keptOne = false;
+            std::erase_if(_blocks.at(memoryTypeIndex), [&](const std::unique_ptr<Block>& b){
+                if(!b->ranges.empty()) return false;
+                if(!b->evacuating && !keptOne){ keptOne = true; return false; }
+                vkFreeMemory(_vkDevice, b->memory, nullptr);
+                _budget.release(b->heapIndex, _blockSize);
+                return true;
+            });
+        }
+    };
+}
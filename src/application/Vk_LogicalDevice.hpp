@@ -2,22 +2,26 @@
 
 #include "../Defines.h"
 #include "Vk_LogicalDeviceLib.hpp"
+#include "Vk_DeviceMemoryAllocator.hpp"
 #include "Vk_PhysicalDeviceQueue.hpp"
 
 namespace VK5{
     class Vk_LogicalDevice{
     private:
         VkDevice _vkDevice;
+        std::unique_ptr<Vk_DeviceMemoryAllocator> _allocator;
     public:
         Vk_LogicalDevice(VkPhysicalDevice physicalDevice, const Vk_PhysicalDeviceLib::PhysicalDevicePR& pr, const Vk_PhysicalDeviceQueue& physicalDeviceQueues)
         :
-        _vkDevice(_createLogicalDevice(physicalDevice, pr, physicalDeviceQueues))
+        _vkDevice(_createLogicalDevice(physicalDevice, pr, physicalDeviceQueues)),
+        _allocator(std::make_unique<Vk_DeviceMemoryAllocator>(_vkDevice))
         {}
 
         Vk_LogicalDevice(Vk_LogicalDevice& other) = delete;
         Vk_LogicalDevice(Vk_LogicalDevice&& other) noexcept
         :
-        _vkDevice(other._vkDevice)
+        _vkDevice(other._vkDevice),
+        _allocator(std::move(other._allocator))
         {
             other._vkDevice = nullptr;
         }
@@ -26,34 +30,42 @@ namespace VK5{
         Vk_LogicalDevice& operator=(Vk_LogicalDevice&& other) noexcept {
             if(this == &other) return *this;
             _vkDevice = other._vkDevice;
+            _allocator = std::move(other._allocator);
             other._vkDevice = nullptr;
             return *this;
         }
 
         ~Vk_LogicalDevice(){
+            // NOTE: the memory blocks go before the device
+            _allocator.reset();
             if(_vkDevice != nullptr) vkDestroyDevice(_vkDevice, nullptr);
         }
 
         VkDevice vk_device() const { return _vkDevice; }
+        Vk_DeviceMemoryAllocator& allocator() const { return *_allocator; }
 
         template<class TStructureType>
         void copyCpuToGpu (const TStructureType* offsetCpuMemoryPtr, VkDeviceMemory gpuMemoryPtr, std::uint64_t copyByteSize, std::uint64_t srcByteOffset, std::uint64_t dstByteOffset){
             Vk_LogicalDeviceLib::copyCpuToGpu(_vkDevice, offsetCpuMemoryPtr, gpuMemoryPtr, copyByteSize, srcByteOffset, dstByteOffset);
         }
 
-        void createAndAllocBuffer (
-            VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags memoryPropertyFlags,
+        // returns the flags of the memory type that was used (see Vk_DeviceMemoryAllocator)
+        VkMemoryPropertyFlags createAndAllocBuffer (
+            VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags requiredFlags, VkMemoryPropertyFlags preferredFlags,
 			VkBuffer& buffer, VkDeviceMemory& memory, VkDeviceSize size,
-            const std::vector<TQueueFamilyIndex>& queueFamilies, THeapIndex heapIndex
+            const std::vector<TQueueFamilyIndex>& queueFamilies, const TMemoryTypes& memoryTypes
 		) {
-            Vk_LogicalDeviceLib::createAndAllocBuffer(_vkDevice, usageFlags, memoryPropertyFlags, buffer, memory, size, queueFamilies, heapIndex);
+            return _allocator->createAndAllocBuffer(usageFlags, requiredFlags, preferredFlags, buffer, memory, size, queueFamilies, memoryTypes);
 		}
 
         void destroyBuffers(/*out*/std::vector<VkBuffer>&& buffers, /*out*/std::vector<VkDeviceMemory>&& memories) const{
-            Vk_LogicalDeviceLib::destroyBuffers(_vkDevice, std::move(buffers), std::move(memories));
+            for(int i=0; i<buffers.size(); ++i) destroyBuffer(buffers.at(i), memories.at(i));
+			buffers.clear(); memories.clear();
         }
 
         void destroyBuffer(/*out*/VkBuffer& buffers, /*out*/VkDeviceMemory& memories) const{
+            // the allocator frees or returns the memory, buffers that were not created through it are freed directly
+            if(buffers != nullptr && _allocator->destroyBuffer(buffers)) return;
             Vk_LogicalDeviceLib::destroyBuffer(_vkDevice, buffers, memories);
         }
 
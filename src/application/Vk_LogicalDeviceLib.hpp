@@ -3,6 +3,7 @@
 #include "../Defines.h"
 #include "../Vk_CI.hpp"
 #include "Vk_PhysicalDeviceLib.hpp"
+#include "Vk_PhysicalDeviceMemoryLib.hpp"
 
 namespace VK5{
     class Vk_LogicalDeviceLib{
@@ -69,10 +70,10 @@ namespace VK5{
 			if(memory != nullptr) vkFreeMemory(vkDevice, memory, nullptr);
         }
 
-        static VkDeviceMemory allocBuffer(VkDevice vkDevice, VkDeviceSize size, THeapIndex heapIndex){
+        static VkDeviceMemory allocBuffer(VkDevice vkDevice, VkDeviceSize size, TMemoryTypeIndex memoryTypeIndex){
             VkDeviceMemory memory;
             // Create the memory backing up the buffer handle
-			auto memAllocInfo = Vk_CI::VkMemoryAllocateInfo_W(size, heapIndex).data;
+			auto memAllocInfo = Vk_CI::VkMemoryAllocateInfo_W(size, memoryTypeIndex).data;
 			VkResult res = vkAllocateMemory(vkDevice, &memAllocInfo, nullptr, &memory);
 			if (res != VK_SUCCESS) {
 				if (res == VK_ERROR_OUT_OF_DEVICE_MEMORY) throw OutOfDeviceMemoryException();
@@ -81,20 +82,21 @@ namespace VK5{
             return memory;
         }
 
-        static void createAndAllocBuffer(
-            VkDevice vkDevice,
-            VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags memoryPropertyFlags,
-			VkBuffer& buffer, VkDeviceMemory& memory, VkDeviceSize size,
-            const std::vector<TQueueFamilyIndex>& queueFamilies, THeapIndex heapIndex
-		) {
-            buffer = createBuffer(vkDevice, usageFlags, size, queueFamilies);
-            memory = allocBuffer(vkDevice, size, heapIndex);
-            /**
-             * TODO: check what this one does => it's probably only a mechanism to decouple buffer creation and allocation
-             */
-            VkMemoryRequirements memReqs;
+        /**
+         * Memory types for buffer, best first (see Vk_PhysicalDeviceMemoryLib::rankMemoryTypes).
+         * Runtime error if no memory type has the required flags.
+         */
+        static TMemoryTypes rankMemoryTypes(
+            VkDevice vkDevice, VkBuffer buffer, const TMemoryTypes& memoryTypes,
+            VkMemoryPropertyFlags requiredFlags, VkMemoryPropertyFlags preferredFlags, /*out*/VkMemoryRequirements& memReqs
+        ) {
             vkGetBufferMemoryRequirements(vkDevice, buffer, &memReqs);
-    		Vk_CheckVkResult(typeid(NoneObj), vkBindBufferMemory(vkDevice, buffer, memory, 0), "Unable to bind buffer memory to device");
-		}
+            TMemoryTypes candidates = Vk_PhysicalDeviceMemoryLib::rankMemoryTypes(memoryTypes, memReqs.memoryTypeBits, requiredFlags, preferredFlags);
+            if(candidates.empty()){
+                vkDestroyBuffer(vkDevice, buffer, nullptr);
+                UT::Ut_Logger::RuntimeError(typeid(NoneObj), "No memory type with memoryPropertyFlags [{0}] fits the buffer (memoryTypeBits {1})", requiredFlags, memReqs.memoryTypeBits);
+            }
+            return candidates;
+        }
     };
 }
\ No newline at end of file
@@ -25,21 +25,34 @@ namespace VK5 {
         // }
         TLogicalQueuesOpFamilyMap _queuesOpMap;
 
+        // cached recordings, used by the record workers and the queues => created before and destroyed after both
+        std::unique_ptr<Vk_GpuTaskRecordCache> _recordCache;
+        // Shared stage 2 workers for all queues of this device. This one must be created before
+        // _logicalQueueFamilies because every Vk_Queue keeps a pointer to it.
+        std::unique_ptr<Vk_GpuTaskRecordPool> _recordPool;
+        // same as _recordPool: the queues keep a pointer to it
+        std::unique_ptr<Vk_QueueBackpressure> _backpressure;
+        // same as _recordPool
+        std::unique_ptr<Vk_GpuTaskTracer> _tracer;
         // this one is an array becuase it has to be allocated at runtime and really has 
         // to stay where it is afterwards (std::vector doesn't necessarily do that)
         // _logicalQueueFamilies is NOT indexed using the queue family index. It only contains the queue families
         // that can actually be used, given the Vk_GpuOp priorities. For example, if queue families 0 and 2 are used
         // then family 0 is at index 0 but family 2 is at index 1. If _logicalQueueFamilies is then indexed using the family indices
         //  => garbage-memory-out-of-bounds!
+        // NOTE: never modified after construction => dispatch reads it without a lock. The queues always stay in here,
+        // dispatch hands out plain pointers
         std::unique_ptr<TLogicalQueueFamilies> _logicalQueueFamilies;
-
-        std::mutex _mutex;
     public:
-        Vk_LogicalDeviceQueue(VkDevice device, const Vk_PhysicalDeviceQueue& physicalDeviceQueue)
+        Vk_LogicalDeviceQueue(VkDevice device, const Vk_PhysicalDeviceQueue& physicalDeviceQueue, float timestampPeriod, TGpuTaskRecordThreadCount recordThreadCount = 0)
         :
         _vkDevice(device),
         _queuesOpMap(Vk_LogicalDeviceQueueLib::createLogicalQueuesOpMap(physicalDeviceQueue.queueFamilyMap(), physicalDeviceQueue.queueFamilies())),
-        _logicalQueueFamilies(std::move(_createLogicalQueues(_vkDevice, physicalDeviceQueue.queueFamilyMap(), _queuesOpMap)))
+        _recordCache(std::make_unique<Vk_GpuTaskRecordCache>(device)),
+        _recordPool(std::make_unique<Vk_GpuTaskRecordPool>(recordThreadCount, _recordCache.get())),
+        _backpressure(std::make_unique<Vk_QueueBackpressure>()),
+        _tracer(std::make_unique<Vk_GpuTaskTracer>(physicalDeviceQueue.queueFamilies(), timestampPeriod)),
+        _logicalQueueFamilies(std::move(_createLogicalQueues(_vkDevice, physicalDeviceQueue.queueFamilyMap(), _queuesOpMap, _recordPool.get(), _recordCache.get(), _backpressure.get(), _tracer.get())))
         {}
 
         Vk_LogicalDeviceQueue(Vk_LogicalDeviceQueue& other) = delete;
@@ -47,6 +60,10 @@ namespace VK5 {
         :
         _vkDevice(other._vkDevice),
         _queuesOpMap(std::move(other._queuesOpMap)),
+        _recordCache(std::move(other._recordCache)),
+        _recordPool(std::move(other._recordPool)),
+        _backpressure(std::move(other._backpressure)),
+        _tracer(std::move(other._tracer)),
         _logicalQueueFamilies(std::move(other._logicalQueueFamilies))
         {
             other._vkDevice = nullptr;
@@ -56,6 +73,11 @@ namespace VK5 {
         Vk_LogicalDeviceQueue& operator=(Vk_LogicalDeviceQueue&& other) noexcept {
             if(this == &other) return *this;
             _vkDevice = other._vkDevice;
+            _queuesOpMap = std::move(other._queuesOpMap);
+            _recordCache = std::move(other._recordCache);
+            _recordPool = std::move(other._recordPool);
+            _backpressure = std::move(other._backpressure);
+            _tracer = std::move(other._tracer);
             _logicalQueueFamilies = std::move(other._logicalQueueFamilies);
 
             other._vkDevice = nullptr;
@@ -63,40 +85,89 @@ namespace VK5 {
             return *this;
         }
 
-        ~Vk_LogicalDeviceQueue(){}
+        ~Vk_LogicalDeviceQueue(){
+            /**
+             * NOTE: stop the record workers before the queues are destroyed. A worker that is still recording
+             * hands its task back to the parent queue, so the queues must still exist at that point.
+             */
+            if(_recordPool) _recordPool->stop();
+        }
 
         const TLogicalQueuesOpFamilyMap& queuesOpMap() const { return _queuesOpMap; }
+        const TGpuTaskRecordThreadCount recordThreadCount() const { return _recordPool->threadCount(); }
         const TLogicalQueueFamilies& queueFamilies() const { return *_logicalQueueFamilies.get(); }
-
-        std::unique_ptr<Vk_Queue> getQueue(Vk_GpuOp opType) {
+        Vk_GpuTaskRecordCache& recordCache() { return *_recordCache; }
+        Vk_GpuTaskTracer& tracer() { return *_tracer; }
+
+        /**
+         * Pick the least loaded queue that can do opType without taking it out of the pool. All capable
+         * families are considered, on equal load the family with the higher priority for opType wins.
+         * If every capable queue has GLOBAL_QUEUE_MAX_DEPTH unfinished tasks, the calling thread sleeps until
+         * one of them finishes something (backpressure). Except for the completion reactors (continuations of
+         * Vk_GpuFuture::then): they are the ones that finish tasks, they get the least loaded queue right away.
+         * Returns nullptr if no queue family can do opType.
+         */
+        Vk_Queue* dispatch(Vk_GpuOp opType) {
             if(!_queuesOpMap.contains(opType)) return nullptr;
+            return _dispatch(_queuesOpMap.at(opType));
+        }
+
+        /**
+         * Same as dispatch but only queues of familyIndex are considered (queue family ownership transfers
+         * have to run on a specific family). Returns nullptr if the device has no queues of familyIndex.
+         */
+        Vk_Queue* dispatchToFamily(TQueueFamilyIndex familyIndex) {
+            if(!_logicalQueueFamilies->contains(familyIndex)) return nullptr;
+            return _dispatch({ familyIndex });
+        }
+
+        // highest priority family for opType
+        bool firstFamily(Vk_GpuOp opType, TQueueFamilyIndex& familyIndex) const {
+            if(!_queuesOpMap.contains(opType) || _queuesOpMap.at(opType).empty()) return false;
+            familyIndex = _queuesOpMap.at(opType).front();
+            return true;
+        }
 
-            const auto& opFamilyIndices = _queuesOpMap.at(opType);
-            // no queues for Gpu_Op available
+    private:
+        // dispatch over the given families, ordered by priority
+        Vk_Queue* _dispatch(const std::vector<TQueueFamilyIndex>& opFamilyIndices) {
             if(opFamilyIndices.size() == 0) return nullptr;
 
-            std::unique_ptr<Vk_Queue> queue = nullptr;
-            {
-                auto lock = std::lock_guard<std::mutex>(_mutex);
-                for(auto familyIndex : opFamilyIndices){
-                    auto& queueList = _logicalQueueFamilies->at(familyIndex);
-                    if(queueList.size() > 0){
-                        queue = std::move(queueList.front());
-                        queueList.pop_front();
-                        break;
-                    }
+            while(true){
+                Vk_Queue* queue = _leastLoaded(opFamilyIndices);
+                if(queue == nullptr || queue->depth() < GLOBAL_QUEUE_MAX_DEPTH || Vk_Queue::onCompletionReactor()) return queue;
+
+                _backpressure->waiting.fetch_add(1);
+                {
+                    std::unique_lock<std::mutex> lock(_backpressure->mutex);
+                    // NOTE: wait_for because the queue may drain between _leastLoaded and here
+                    _backpressure->condition.wait_for(lock, std::chrono::nanoseconds(GLOBAL_FENCE_TIMEOUT), [&](){
+                        Vk_Queue* q = _leastLoaded(opFamilyIndices);
+                        return q == nullptr || q->depth() < GLOBAL_QUEUE_MAX_DEPTH;
+                    });
                 }
+                _backpressure->waiting.fetch_sub(1);
             }
-            return std::move(queue);
         }
 
-        void addQueue(Vk_GpuOp optype, std::unique_ptr<Vk_Queue> queue){
-            auto lock = std::lock_guard<std::mutex>(_mutex);
-            _logicalQueueFamilies->at(queue->familyIndex()).emplace_back(std::move(queue));
+        Vk_Queue* _leastLoaded(const std::vector<TQueueFamilyIndex>& opFamilyIndices) {
+            Vk_Queue* best = nullptr;
+            int64_t bestDepth = 0;
+            // opFamilyIndices is ordered by priority => strictly less keeps the preferred family on ties
+            for(auto familyIndex : opFamilyIndices){
+                for(const auto& q : _logicalQueueFamilies->at(familyIndex)){
+                    int64_t depth = q->depth();
+                    if(best == nullptr || depth < bestDepth){
+                        best = q.get();
+                        bestDepth = depth;
+                        if(bestDepth == 0) return best;
+                    }
+                }
+            }
+            return best;
         }
 
-    private:
-        std::unique_ptr<TLogicalQueueFamilies> _createLogicalQueues(VkDevice device, const TDeviceQueueFamilyMap& queueFamilyMap, TLogicalQueuesOpFamilyMap queuesOpMap){
+        std::unique_ptr<TLogicalQueueFamilies> _createLogicalQueues(VkDevice device, const TDeviceQueueFamilyMap& queueFamilyMap, TLogicalQueuesOpFamilyMap queuesOpMap, Vk_GpuTaskRecordPool* recordPool, Vk_GpuTaskRecordCache* recordCache, Vk_QueueBackpressure* backpressure, Vk_GpuTaskTracer* tracer){
             TGpuTargetOpFamilies queueTargetOp;
             for(const auto& qop : queuesOpMap){
                 queueTargetOp.insert({static_cast<Vk_GpuTargetOp>(qop.first), qop.second});
@@ -116,10 +187,9 @@ namespace VK5 {
             std::unique_ptr<TLogicalQueueFamilies> logicalQueues = std::make_unique<TLogicalQueueFamilies>();
             for(const auto& family : map){
                 TQueueFamilyIndex familyIndex = family.first;
-                if(!logicalQueues->contains(familyIndex)) logicalQueues->insert({familyIndex, {}});
-                auto& ll = logicalQueues->at(familyIndex);
+                auto& ll = (*logicalQueues)[familyIndex];
                 for(const TQueueIndex& queueIndex : family.second)
-                    ll.push_back(std::make_unique<Vk_Queue>(device, family.first, queueIndex, queueTargetOp));
+                    ll.push_back(std::make_unique<Vk_Queue>(device, family.first, queueIndex, queueTargetOp, recordPool, recordCache, backpressure, tracer));
             }
 
             return logicalQueues;
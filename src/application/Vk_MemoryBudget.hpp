@@ -0,0 +1,236 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+#include <functional>
+
+#include "../Defines.h"
+#include "Vk_PhysicalDeviceMemoryLib.hpp"
+
+namespace VK5 {
+    // part of the budget of a heap that Vk_MemoryBudget hands out, the rest stays free for the driver and other processes
+    constexpr double GLOBAL_MEMORY_BUDGET_FRACTION = 0.9;
+
+    /**
+     * Owner of device local data that can move it to host visible memory when a heap runs out of budget (see Vk_DataBuffer).
+     */
+    class Vk_MemoryBudgetClient {
+    public:
+        virtual ~Vk_MemoryBudgetClient() {}
+        // time of the last draw (any monotonic clock), the least recently drawn client is demoted first
+        virtual std::uint64_t lastUse() const = 0;
+        /**
+         * Move the device local data to host visible memory. Returns the amount of bytes that were moved, 0 if there
+         * was nothing to do. The old memory may be freed later, once no frame draws from it anymore.
+         * Runs on the thread that allocates: never block on a lock that thread may hold, return 0 instead.
+         */
+        virtual std::uint64_t demote() = 0;
+    };
+
+    /**
+     * While it lives, Vk_MemoryBudget::reserve on this thread doesn't demote client: the allocation runs inside the
+     * client (a resize, relocate or demote) that holds its own lock. Scopes nest.
+     */
+    class Vk_MemoryBudgetAllocatingScope {
+    public:
+        explicit Vk_MemoryBudgetAllocatingScope(Vk_MemoryBudgetClient* client) {
+            _clients().push_back(client);
+        }
+
+        ~Vk_MemoryBudgetAllocatingScope() {
+            _clients().pop_back();
+        }
+
+        Vk_MemoryBudgetAllocatingScope(const Vk_MemoryBudgetAllocatingScope& other) = delete;
+        Vk_MemoryBudgetAllocatingScope(Vk_MemoryBudgetAllocatingScope&& other) = delete;
+        Vk_MemoryBudgetAllocatingScope& operator=(const Vk_MemoryBudgetAllocatingScope& other) = delete;
+        Vk_MemoryBudgetAllocatingScope& operator=(Vk_MemoryBudgetAllocatingScope&& other) = delete;
+
+        // true if client allocates on this thread right now
+        static bool contains(Vk_MemoryBudgetClient* client) {
+            const auto& clients = _clients();
+            return std::find(clients.begin(), clients.end(), client) != clients.end();
+        }
+
+    private:
+        static std::vector<Vk_MemoryBudgetClient*>& _clients() {
+            thread_local std::vector<Vk_MemoryBudgetClient*> clients;
+            return clients;
+        }
+    };
+
+    // heapIndex is out of budget, missingBytes more are needed for the current allocation
+    typedef std::function<void(THeapIndex heapIndex, std::uint64_t missingBytes)> TMemoryPressureCallback;
+    typedef std::size_t TMemoryPressureCallbackId;
+
+    /**
+     * Budget governor for device memory. Counts every allocation of Vk_DeviceMemoryAllocator per heap and compares
+     * it against heapBudget of VK_EXT_memory_budget: heapUsage of the last update plus everything we allocated or
+     * freed since then must stay below GLOBAL_MEMORY_BUDGET_FRACTION of heapBudget. Without the extension (or before
+     * the first update) the heap size is the budget.
+     * If an allocation doesn't fit
+     *    1. the pressure callbacks are called (the application may drop caches, lower LODs...)
+     *    2. device local heaps only: clients are demoted, least recently drawn first, until it fits. Clients that
+     *       allocate on this thread (Vk_MemoryBudgetAllocatingScope) are skipped
+     *    3. otherwise reserve returns false and the allocator treats the memory type as out of memory
+     * Budget and usage are only as fresh as the last update, call Vk_PhysicalDevice::stateUpdate once per frame or so.
+     */
+    class Vk_MemoryBudget {
+        struct Heap {
+            // VkPhysicalDeviceMemoryBudgetPropertiesEXT::heapBudget or the heap size
+            std::uint64_t budget;
+            // VkPhysicalDeviceMemoryBudgetPropertiesEXT::heapUsage of the last update (all processes)
+            std::uint64_t usage;
+            // bytes allocated through this budget now and at the last update
+            std::uint64_t ours;
+            std::uint64_t oursAtUpdate;
+        };
+
+        double _fraction;
+        std::mutex _mutex;
+        std::vector<Heap> _heaps;
+
+        // NOTE: recursive: a demote allocates host visible memory, which may run into pressure again
+        std::recursive_mutex _pressureMutex;
+        std::vector<Vk_MemoryBudgetClient*> _clients;
+        TMemoryPressureCallbackId _nextCallbackId;
+        std::vector<std::pair<TMemoryPressureCallbackId, TMemoryPressureCallback>> _callbacks;
+
+    public:
+        explicit Vk_MemoryBudget(double fraction = GLOBAL_MEMORY_BUDGET_FRACTION)
+        : _fraction(fraction), _heaps({}), _clients({}), _nextCallbackId(0), _callbacks({})
+        {}
+
+        Vk_MemoryBudget(const Vk_MemoryBudget& other) = delete;
+        Vk_MemoryBudget(Vk_MemoryBudget&& other) = delete;
+        Vk_MemoryBudget& operator=(const Vk_MemoryBudget& other) = delete;
+        Vk_MemoryBudget& operator=(Vk_MemoryBudget&& other) = delete;
+
+        // heap sizes, they are the budget until the first update
+        void init(const TGpuMemoryHeapsState& heapsState) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            for(const auto& h : heapsState) _heap(h.heapIndex).budget = h.size.size;
+        }
+
+        // budget and usage of Vk_PhysicalDeviceMemory::stateUpdate, only valid with VK_EXT_memory_budget
+        void update(const TGpuMemoryHeapsState& heapsState) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            for(const auto& h : heapsState){
+                Heap& heap = _heap(h.heapIndex);
+                heap.budget = h.budget.size;
+                heap.usage = h.usage.size;
+                heap.oursAtUpdate = heap.ours;
+            }
+        }
+
+        // bytes that can still be allocated on heapIndex
+        std::uint64_t available(THeapIndex heapIndex) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _available(_heap(heapIndex));
+        }
+
+        // bytes allocated through this budget on heapIndex
+        std::uint64_t allocated(THeapIndex heapIndex) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _heap(heapIndex).ours;
+        }
+
+        /**
+         * Any thread. Count size bytes on heapIndex if they fit into the budget, relieve the pressure first if
+         * they don't (see class comment). False if it's still too much.
+         * NOTE: don't hold any lock a pressure callback or a client needs
+         */
+        bool reserve(THeapIndex heapIndex, std::uint64_t size, bool deviceLocal) {
+            std::uint64_t missing;
+            if(_tryReserve(heapIndex, size, missing)) return true;
+
+            std::lock_guard<std::recursive_mutex> lock(_pressureMutex);
+            // copies: callbacks and demotes may (un)register
+            auto callbacks = _callbacks;
+            for(const auto& c : callbacks) c.second(heapIndex, missing);
+            if(_tryReserve(heapIndex, size, missing)) return true;
+            if(!deviceLocal) return false;
+
+            std::vector<std::pair<std::uint64_t, Vk_MemoryBudgetClient*>> clients;
+            for(Vk_MemoryBudgetClient* c : _clients) clients.push_back({c->lastUse(), c});
+            std::sort(clients.begin(), clients.end(), [](const auto& a, const auto& b){ return a.first < b.first; });
+            std::uint64_t demoted = 0;
+            for(const auto& c : clients){
+                // the allocating client holds its own lock
+                if(Vk_MemoryBudgetAllocatingScope::contains(c.second)) continue;
+                std::uint64_t moved = c.second->demote();
+                if(moved == 0) continue;
+                if(_tryReserve(heapIndex, size, missing)) return true;
+                // the rest is freed once no frame draws from it anymore, demoting more clients doesn't help this allocation
+                demoted += moved;
+                if(demoted >= missing) break;
+            }
+            UT::Ut_Logger::Warn(typeid(this), "Memory budget of heap {0} exceeded: {1} bytes missing for an allocation of {2} bytes", heapIndex, missing, size);
+            return false;
+        }
+
+        // any thread: size bytes on heapIndex were freed
+        void release(THeapIndex heapIndex, std::uint64_t size) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            Heap& heap = _heap(heapIndex);
+            heap.ours -= std::min(heap.ours, size);
+        }
+
+        /**
+         * Clients must unregister before they are destroyed. removeClient waits for a demote that is running
+         * on another thread.
+         */
+        void addClient(Vk_MemoryBudgetClient* client) {
+            std::lock_guard<std::recursive_mutex> lock(_pressureMutex);
+            _clients.push_back(client);
+        }
+
+        void removeClient(Vk_MemoryBudgetClient* client) {
+            std::lock_guard<std::recursive_mutex> lock(_pressureMutex);
+            std::erase(_clients, client);
+        }
+
+        TMemoryPressureCallbackId addPressureCallback(TMemoryPressureCallback callback) {
+            std::lock_guard<std::recursive_mutex> lock(_pressureMutex);
+            _callbacks.push_back({_nextCallbackId, std::move(callback)});
+            return _nextCallbackId++;
+        }
+
+        void removePressureCallback(TMemoryPressureCallbackId id) {
+            std::lock_guard<std::recursive_mutex> lock(_pressureMutex);
+            std::erase_if(_callbacks, [id](const auto& c){ return c.first == id; });
+        }
+
+    private:
+        bool _tryReserve(THeapIndex heapIndex, std::uint64_t size, std::uint64_t& missing) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            Heap& heap = _heap(heapIndex);
+            std::uint64_t available = _available(heap);
+            if(size > available){
+                missing = size - available;
+                return false;
+            }
+            heap.ours += size;
+            missing = 0;
+            return true;
+        }
+
+        // _mutex must be locked. Unknown heaps have no limit
+        Heap& _heap(THeapIndex heapIndex) {
+            if(heapIndex >= _heaps.size()) _heaps.resize(heapIndex + 1, Heap { .budget = ~std::uint64_t(0), .usage = 0, .ours = 0, .oursAtUpdate = 0 });
+            return _heaps.at(heapIndex);
+        }
+
+        std::uint64_t _available(const Heap& heap) const {
+            if(heap.budget == ~std::uint64_t(0)) return heap.budget;
+            std::uint64_t limit = static_cast<std::uint64_t>(static_cast<double>(heap.budget) * _fraction);
+            // heapUsage already contains what we had at the last update
+            std::uint64_t used = heap.usage + heap.ours - std::min(heap.ours, heap.oursAtUpdate);
+            if(heap.ours < heap.oursAtUpdate) used -= std::min(used, heap.oursAtUpdate - heap.ours);
+            return limit > used ? limit - used : 0;
+        }
+    };
+}
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <map>
+#include <mutex>
+#include <algorithm>
 #include <unordered_map>
 
 #include "../Defines.h"
@@ -8,9 +11,20 @@
 #include "Vk_PhysicalDeviceQueue.hpp"
 #include "Vk_LogicalDevice.hpp"
 #include "Vk_LogicalDeviceQueue.hpp"
+#include "Vk_StagingRing.hpp"
+#include "Vk_Defragmenter.hpp"
 #include "./gpu_tasks/Vk_GpuTaskPool.hpp"
+#include "./gpu_tasks/Vk_GpuFuture.hpp"
 
 namespace VK5 {
+    // buffers that were created for one Vk_GpuTargetOp (VK_SHARING_MODE_EXCLUSIVE) and the family that owns them
+    struct Vk_ExclusiveBuffers {
+        std::mutex mutex;
+        std::unordered_map<VkBuffer, TQueueFamilyIndex> homeFamily;
+        // fence of the last frame that draws from the buffer (markInFlight). Releases to the transfer family wait for it
+        std::unordered_map<VkBuffer, VkFence> frameFence;
+    };
+
     class Vk_PhysicalDevice{
     private:
         TPhysicalDeviceIndex _index;
@@ -19,8 +33,13 @@ namespace VK5 {
         Vk_PhysicalDeviceQueue _physicalDeviceQueues;
         Vk_PhysicalDeviceMemory _physicalDeviceMemory;
         Vk_LogicalDevice _logicalDevice;
-        Vk_LogicalDeviceQueue _logicalDeviceQueue;
+        // NOTE: before _logicalDeviceQueue: the queues finish their last tasks on destruction and those go back to the pool
         Vk_GpuTaskPool _gpuTaskPool;
+        Vk_LogicalDeviceQueue _logicalDeviceQueue;
+        std::unique_ptr<Vk_ExclusiveBuffers> _exclusiveBuffers;
+        // NOTE: after _logicalDeviceQueue: the ring waits for its copies on destruction
+        std::unique_ptr<Vk_StagingRing> _stagingRing;
+        std::unique_ptr<Vk_Defragmenter> _defragmenter;
     public:
         /**
          * Enumerate all available physical devices.
@@ -48,7 +67,8 @@ namespace VK5 {
             TPhysicalDeviceIndex index,
             VkPhysicalDevice physicalDevice,
             const Vk_PhysicalDeviceLib::PhysicalDevicePR& pr,
-            const std::vector<Vk_GpuOp>& opPriorities
+            const std::vector<Vk_GpuOp>& opPriorities,
+            TGpuTaskRecordThreadCount recordThreadCount = 0
         )
         :
         _index(index),
@@ -57,9 +77,15 @@ namespace VK5 {
         _physicalDeviceQueues(physicalDevice, opPriorities),
         _physicalDeviceMemory(_physicalDevice),
         _logicalDevice(_physicalDevice, _pr, _physicalDeviceQueues),
-        _logicalDeviceQueue(_logicalDevice.vk_device(), _physicalDeviceQueues),
-        _gpuTaskPool(_logicalDevice.vk_device())
-        {}
+        _gpuTaskPool(_logicalDevice.vk_device(), _pr.extensionSupport.timelineSemaphore),
+        _logicalDeviceQueue(_logicalDevice.vk_device(), _physicalDeviceQueues, _pr.properties.limits.timestampPeriod, recordThreadCount),
+        _exclusiveBuffers(std::make_unique<Vk_ExclusiveBuffers>()),
+        _stagingRing(_createStagingRing()),
+        _defragmenter(std::make_unique<Vk_Defragmenter>(&_logicalDevice.allocator()))
+        {
+            memoryBudget().init(_physicalDeviceMemory.state());
+            stateUpdate();
+        }
 
         Vk_PhysicalDevice(const Vk_PhysicalDevice& other) = delete;
         Vk_PhysicalDevice(Vk_PhysicalDevice&& other)
@@ -70,8 +96,11 @@ namespace VK5 {
         _physicalDeviceQueues(std::move(other._physicalDeviceQueues)),
         _physicalDeviceMemory(std::move(other._physicalDeviceMemory)),
         _logicalDevice(std::move(other._logicalDevice)),
+        _gpuTaskPool(std::move(other._gpuTaskPool)),
         _logicalDeviceQueue(std::move(other._logicalDeviceQueue)),
-        _gpuTaskPool(std::move(other._gpuTaskPool))
+        _exclusiveBuffers(std::move(other._exclusiveBuffers)),
+        _stagingRing(std::move(other._stagingRing)),
+        _defragmenter(std::move(other._defragmenter))
         {
             other._physicalDevice = nullptr;
         }
@@ -79,21 +108,27 @@ namespace VK5 {
         Vk_PhysicalDevice& operator=(const Vk_PhysicalDevice& other) = delete;
         Vk_PhysicalDevice& operator=(Vk_PhysicalDevice&& other) noexcept {
             if(this == &other) return *this;
+            _destroyStagingRing();
             _index = other._index;
             _physicalDevice = std::move(other._physicalDevice);
             _pr = std::move(other._pr);
             _physicalDeviceQueues = std::move(other._physicalDeviceQueues);
             _physicalDeviceMemory = std::move(other._physicalDeviceMemory),
             _logicalDevice = std::move(other._logicalDevice);
-            _logicalDeviceQueue = std::move(other._logicalDeviceQueue);
             _gpuTaskPool = std::move(other._gpuTaskPool);
+            _logicalDeviceQueue = std::move(other._logicalDeviceQueue);
+            _exclusiveBuffers = std::move(other._exclusiveBuffers);
+            _stagingRing = std::move(other._stagingRing);
+            _defragmenter = std::move(other._defragmenter);
 
             other._physicalDevice = nullptr;
 
             return *this;
         }
 
-        ~Vk_PhysicalDevice(){}
+        ~Vk_PhysicalDevice(){
+            _destroyStagingRing();
+        }
 
         // Const PhysicalDevice getters
         const Vk_PhysicalDeviceLib::PhysicalDevicePR& physicalDevicePR() const { return _pr; }
@@ -102,56 +137,249 @@ namespace VK5 {
         const Vk_LogicalDeviceQueue& logicalDeviceQueue() const { return _logicalDeviceQueue; }
         const Vk_LogicalDevice& logicalDevice() const { return _logicalDevice; }
         const Vk_HeapSize queryPhysicalDeviceHeapSize(VkMemoryPropertyFlags flags) const { return _physicalDeviceMemory.queryMemoryHeapSize(flags); }
+        Vk_GpuTaskPool& gpuTaskPool() { return _gpuTaskPool; }
+        // per stage tracing of all gpu tasks of this device. Disabled by default
+        Vk_GpuTaskTracer& gpuTaskTracer() { return _logicalDeviceQueue.tracer(); }
+        // persistently mapped staging memory for uploads (see Vk_DataBufferLib::copyDataToBufferWithStaging)
+        Vk_StagingRing& stagingRing() { return *_stagingRing; }
+        // per heap budget of all buffer allocations, register pressure callbacks here
+        Vk_MemoryBudget& memoryBudget() { return _logicalDevice.allocator().budget(); }
+        // call step in idle frames to give back half empty memory blocks
+        Vk_Defragmenter& defragmenter() { return *_defragmenter; }
         
         // Non const modifiers
         /**
          * Update the current stored state of all GPU heaps. 
          */
         const Vk_HeapSize queryPhysicalDeviceHeapBudget(VkMemoryPropertyFlags flags) { 
-            _physicalDeviceMemory.stateUpdate();
+            stateUpdate();
             return _physicalDeviceMemory.queryGpuMemoryHeapBudget(flags); 
         }
 
-        void stateUpdate() { _physicalDeviceMemory.stateUpdate(); }
+        /**
+         * Also feeds the memory budget, call it regularly (once per frame is cheap).
+         */
+        void stateUpdate() {
+            _physicalDeviceMemory.stateUpdate();
+            // NOTE: without VK_EXT_memory_budget heapBudget and heapUsage are not written
+            if(_pr.extensionSupport.memoryBudget) memoryBudget().update(_physicalDeviceMemory.state());
+        }
 
-        Vk_GpuTaskRunner* enqueue(std::unique_ptr<Vk_GpuTask> task){
-            std::unique_ptr<Vk_Queue> queue = nullptr;
+        /**
+         * Transfer tasks that touch exclusive buffers (createAndAllocBuffer with a Vk_GpuTargetOp other than Auto)
+         * are pinned to a queue family:
+         *    - copies into exclusive buffers (uploads) run on the highest priority Transfer family. If that is not the
+         *      home family of a buffer, the buffer moves there and back: a release task on the home family, the copy with
+         *      acquire and release barriers (Vk_GpuTaskParams::Ownership), an acquire task on the home family. The three
+         *      are chained with timeline waits on the GPU.
+         *    - copies that read an exclusive buffer (resize, relocate, demote, readback) run on its home family, the buffer
+         *      may be drawn from at the same time and can't leave it.
+         * NOTE: with ownership transfers the returned future completes once the acquire tasks are finished too, its runner
+         * is still the one of task. The helper tasks go back to gpuTaskPool on their own. Such tasks must not have a submit function.
+         * NOTE: the release waits for the last frame that draws from the buffer, tell the device about frames with markInFlight.
+         */
+        Vk_GpuFuture enqueue(std::unique_ptr<Vk_GpuTask> task){
             auto op = task->opType();
-            while(!queue) queue = _logicalDeviceQueue.getQueue(op);
-            Vk_GpuTaskRunner* res = queue->enqueue(std::move(task));
-            _logicalDeviceQueue.addQueue(op, std::move(queue));
-            return res;
+            if(op == Vk_GpuOp::Transfer){
+                TQueueFamilyIndex familyIndex;
+                std::vector<Vk_QueueFamilyOwnership> ownership;
+                if(_exclusiveFamily(*task, familyIndex, ownership)) return _enqueueWithOwnership(std::move(task), familyIndex, std::move(ownership));
+            }
+
+            Vk_Queue* queue = _logicalDeviceQueue.dispatch(op);
+            if(queue == nullptr) UT::Ut_Logger::RuntimeError(typeid(this), "No queue family supports {0}", Vk_GpuOp2String(op));
+            Vk_GpuFuture future = Vk_GpuFuture::attach(*task);
+            queue->enqueue(std::move(task));
+            return future;
         }
         
+        /**
+         * Destroy buffers through these instead of Vk_LogicalDevice directly: cached recordings
+         * (Vk_GpuTaskModifier::c) that reference the buffers are dropped first.
+         */
+        /**
+         * The frame that is signaled by frameFence draws from buffer. Only remembered for exclusive buffers: a copy that
+         * takes one of them to the transfer family doesn't release it before the fence is signaled (see enqueue).
+         * Vk_DataBuffer::markInFlight calls this.
+         */
+        void markInFlight(VkBuffer buffer, VkFence frameFence) {
+            std::lock_guard<std::mutex> lock(_exclusiveBuffers->mutex);
+            if(!_exclusiveBuffers->homeFamily.contains(buffer)) return;
+            _exclusiveBuffers->frameFence[buffer] = frameFence;
+        }
+
+        void destroyBuffer(/*out*/VkBuffer& buffer, /*out*/VkDeviceMemory& memory) {
+            _logicalDeviceQueue.recordCache().forget(buffer);
+            _forgetExclusive(buffer);
+            _logicalDevice.destroyBuffer(buffer, memory);
+        }
+
+        void destroyBuffers(/*out*/std::vector<VkBuffer>&& buffers, /*out*/std::vector<VkDeviceMemory>&& memories) {
+            for(VkBuffer buffer : buffers){
+                _logicalDeviceQueue.recordCache().forget(buffer);
+                _forgetExclusive(buffer);
+            }
+            _logicalDevice.destroyBuffers(std::move(buffers), std::move(memories));
+        }
+
         template<class TStructureType>
         void copyCpuToGpu (const TStructureType* offsetCpuMemoryPtr, VkDeviceMemory gpuMemoryPtr, std::uint64_t copyByteSize, std::uint64_t srcByteOffset, std::uint64_t dstByteOffset){
             _logicalDevice.copyCpuToGpu(offsetCpuMemoryPtr, gpuMemoryPtr, copyByteSize, srcByteOffset, dstByteOffset);
         }
 
         /**
-         * TODO:Vk_GpuTargetOp - gpuTargetOp is currently ignored
-         *    - introduce an if:
-         *       1. if Vk_GpuTarget::Auto => collect all queue families and pass them all to Vk_LogicalDeviceLib::createBuffer
-         *       2. if Vk_GpuTarget::Not-Auto => get the queue family that fits the Vk_GpuTargetOp the best and pass only that one to Vk_LogicalDeviceLib::createBuffer
+         * memoryPropertyFlags are required, preferredFlags are taken if there is a memory type that has them.
+         * Returns the flags of the memory type the buffer ended up in.
+         * gpuTargetOp:
+         *    - Vk_GpuTargetOp::Auto: all queue families, VK_SHARING_MODE_CONCURRENT (staging, readback and the like)
+         *    - otherwise: VK_SHARING_MODE_EXCLUSIVE to the highest priority family of that op, its home family.
+         *      Copies move the ownership to the transfer family and back (see enqueue)
          */
-        void createAndAllocBuffer(VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags memoryPropertyFlags,
-			VkBuffer& buffer, VkDeviceMemory& memory, VkDeviceSize size, Vk_GpuTargetOp gpuTargetOp
+        VkMemoryPropertyFlags createAndAllocBuffer(VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags memoryPropertyFlags,
+			VkBuffer& buffer, VkDeviceMemory& memory, VkDeviceSize size, Vk_GpuTargetOp gpuTargetOp, VkMemoryPropertyFlags preferredFlags = 0
 		) {
-            // create the buffer (NOTE the TODO point for future adjustments)
-            std::vector<TQueueFamilyIndex> queueFamilies = UT::Ut_Std::umap_keys_to_vec(_logicalDeviceQueue.queueFamilies());
-            THeapIndex heapIndex = _physicalDeviceMemory.queryGpuMemoryHeapIndex(memoryPropertyFlags);
-            _logicalDevice.createAndAllocBuffer(usageFlags, memoryPropertyFlags, buffer, memory, size, queueFamilies, heapIndex);
+            TQueueFamilyIndex homeFamily;
+            bool exclusive = gpuTargetOp != Vk_GpuTargetOp::Auto && _logicalDeviceQueue.firstFamily(static_cast<Vk_GpuOp>(gpuTargetOp), homeFamily);
+            std::vector<TQueueFamilyIndex> queueFamilies = exclusive
+                ? std::vector<TQueueFamilyIndex>{ homeFamily }
+                : UT::Ut_Std::umap_keys_to_vec(_logicalDeviceQueue.queueFamilies());
+            VkMemoryPropertyFlags flags = _logicalDevice.createAndAllocBuffer(usageFlags, memoryPropertyFlags, preferredFlags, buffer, memory, size, queueFamilies, _physicalDeviceMemory.memoryTypes());
+            if(exclusive){
+                std::lock_guard<std::mutex> lock(_exclusiveBuffers->mutex);
+                _exclusiveBuffers->homeFamily[buffer] = homeFamily;
+            }
+            return flags;
 		}
 
-
         // Vulkan getters
         VkPhysicalDevice vk_physicalDevice() const { return _physicalDevice; }
         VkDevice vk_logicalDevice() const { return _logicalDevice.vk_device(); }
 
+    private:
+        void _forgetExclusive(VkBuffer buffer) {
+            if(buffer == nullptr) return;
+            std::lock_guard<std::mutex> lock(_exclusiveBuffers->mutex);
+            _exclusiveBuffers->homeFamily.erase(buffer);
+            _exclusiveBuffers->frameFence.erase(buffer);
+        }
+
+        // frame fences (markInFlight) of the buffers of ownership
+        std::vector<VkFence> _frameFences(const std::vector<Vk_QueueFamilyOwnership>& ownership) {
+            std::vector<VkFence> fences;
+            std::lock_guard<std::mutex> lock(_exclusiveBuffers->mutex);
+            for(const auto& o : ownership){
+                auto found = _exclusiveBuffers->frameFence.find(o.buffer);
+                if(found == _exclusiveBuffers->frameFence.end()) continue;
+                if(std::find(fences.begin(), fences.end(), found->second) == fences.end()) fences.push_back(found->second);
+            }
+            return fences;
+        }
+
         /**
-         * TODO: testing: put into corresponding braces at some point
+         * False if task touches no exclusive buffer. Otherwise the family task has to run on and the buffers that have
+         * to move there from their home family (see enqueue).
          */
-        std::unique_ptr<Vk_Queue> getQueue(Vk_GpuOp op) { return std::move(_logicalDeviceQueue.getQueue(op)); }
-        void addQueue(Vk_GpuOp op, std::unique_ptr<Vk_Queue> queue){ _logicalDeviceQueue.addQueue(op, std::move(queue)); }
+        bool _exclusiveFamily(const Vk_GpuTask& task, TQueueFamilyIndex& familyIndex, std::vector<Vk_QueueFamilyOwnership>& ownership) {
+            std::vector<VkBuffer> written = task.writtenBuffers();
+            std::vector<std::pair<VkBuffer, TQueueFamilyIndex>> exclusive;
+            const std::pair<VkBuffer, TQueueFamilyIndex>* read = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(_exclusiveBuffers->mutex);
+                for(VkBuffer buffer : task.buffers()){
+                    auto found = _exclusiveBuffers->homeFamily.find(buffer);
+                    if(found == _exclusiveBuffers->homeFamily.end()) continue;
+                    if(std::find_if(exclusive.begin(), exclusive.end(), [buffer](const auto& e){ return e.first == buffer; }) != exclusive.end()) continue;
+                    exclusive.push_back(*found);
+                }
+            }
+            if(exclusive.empty()) return false;
+
+            for(const auto& e : exclusive){
+                if(std::find(written.begin(), written.end(), e.first) != written.end()) continue;
+                read = &e;
+                break;
+            }
+            if(read != nullptr) familyIndex = read->second;
+            else if(!_logicalDeviceQueue.firstFamily(Vk_GpuOp::Transfer, familyIndex)) familyIndex = exclusive.front().second;
+
+            for(const auto& e : exclusive){
+                if(e.second == familyIndex) continue;
+                ownership.push_back(Vk_QueueFamilyOwnership { .buffer = e.first, .homeFamily = e.second, .transferFamily = familyIndex });
+            }
+            return true;
+        }
+
+        Vk_GpuFuture _enqueueToFamily(std::unique_ptr<Vk_GpuTask> task, TQueueFamilyIndex familyIndex) {
+            Vk_Queue* queue = _logicalDeviceQueue.dispatchToFamily(familyIndex);
+            if(queue == nullptr) UT::Ut_Logger::RuntimeError(typeid(this), "No queues in queue family {0}", familyIndex);
+            Vk_GpuFuture future = Vk_GpuFuture::attach(*task);
+            queue->enqueue(std::move(task));
+            return future;
+        }
+
+        // release => task => acquire, see enqueue
+        Vk_GpuFuture _enqueueWithOwnership(std::unique_ptr<Vk_GpuTask> task, TQueueFamilyIndex familyIndex, std::vector<Vk_QueueFamilyOwnership>&& ownership) {
+            if(ownership.empty()) return _enqueueToFamily(std::move(task), familyIndex);
+
+            // one release and one acquire per home family
+            std::map<TQueueFamilyIndex, std::vector<Vk_QueueFamilyOwnership>> homes;
+            for(const auto& o : ownership) homes[o.homeFamily].push_back(o);
+            Vk_GpuTaskPriority priority = task->priority();
+            TGpuTaskDeadline deadline = task->deadline();
+
+            // NOTE: the helper tasks go back to the pool from their own continuations. Their semaphores live on in the
+            // pool, but a reused task signals a new value => take the waits (w) before the return is attached
+            for(const auto& home : homes){
+                auto release = _gpuTaskPool.getOrCreateTask(Vk_GpuOp::Transfer);
+                release->mod()
+                    ->params(Vk_GpuTaskLib::Vk_QueueFamilyTransfer(std::vector<Vk_QueueFamilyOwnership>(home.second), false))
+                    ->r(Vk_GpuTaskLib::Vk_QueueFamilyTransfer::record)
+                    ->s(nullptr)
+                    ->c(false)
+                    ->p(priority, deadline);
+                // the home family may still draw from the buffers
+                for(VkFence fence : _frameFences(home.second)) release->mod()->f(fence);
+                Vk_GpuFuture released = _enqueueToFamily(std::move(release), home.first);
+                task->mod()->w(released.runner(), VK_PIPELINE_STAGE_TRANSFER_BIT);
+                _gpuTaskPool.returnWhenFinished(released);
+            }
+
+            task->mod()->o(std::move(ownership));
+            Vk_GpuFuture copied = _enqueueToFamily(std::move(task), familyIndex);
+
+            std::vector<Vk_GpuFuture> acquires;
+            for(auto& home : homes){
+                auto acquire = _gpuTaskPool.getOrCreateTask(Vk_GpuOp::Transfer);
+                acquire->mod()
+                    ->params(Vk_GpuTaskLib::Vk_QueueFamilyTransfer(std::move(home.second), true))
+                    ->r(Vk_GpuTaskLib::Vk_QueueFamilyTransfer::record)
+                    ->s(nullptr)
+                    ->c(false)
+                    ->p(priority, deadline)
+                    ->w(copied.runner(), VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+                acquires.push_back(_gpuTaskPool.returnWhenFinished(_enqueueToFamily(std::move(acquire), home.first)));
+            }
+            // task belongs to the caller, the buffers are only home again after the acquires
+            return Vk_GpuFuture::joined(copied, acquires);
+        }
+
+        std::unique_ptr<Vk_StagingRing> _createStagingRing() {
+            VkBuffer buffer;
+            VkDeviceMemory memory;
+            createAndAllocBuffer(
+                VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                buffer, memory, GLOBAL_STAGING_RING_SIZE, Vk_GpuTargetOp::Auto);
+            return std::make_unique<Vk_StagingRing>(
+                _logicalDevice.vk_device(), buffer, memory, GLOBAL_STAGING_RING_SIZE, _pr.properties.limits.optimalBufferCopyOffsetAlignment);
+        }
+
+        // the ring doesn't own its buffer: free it like every other buffer once the copies out of the ring are done
+        void _destroyStagingRing() {
+            if(!_stagingRing) return;
+            VkBuffer buffer = _stagingRing->vk_buffer();
+            VkDeviceMemory memory = _stagingRing->vk_memory();
+            _stagingRing.reset();
+            destroyBuffer(buffer, memory);
+        }
     };
 }
\ No newline at end of file
@@ -8,18 +8,21 @@ namespace VK5 {
     private:
         VkPhysicalDevice _physicalDevice;
         TGpuMemoryHeapsState _gpuMemoryHeapsState;
+        TMemoryTypes _memoryTypes;
     public:
         Vk_PhysicalDeviceMemory(VkPhysicalDevice physicalDevice)
         :
         _physicalDevice(physicalDevice),
-        _gpuMemoryHeapsState(Vk_PhysicalDeviceMemoryLib::initGpuMemoryHeapsState(_physicalDevice))
+        _gpuMemoryHeapsState(Vk_PhysicalDeviceMemoryLib::initGpuMemoryHeapsState(_physicalDevice)),
+        _memoryTypes(Vk_PhysicalDeviceMemoryLib::initMemoryTypes(_physicalDevice))
         {}
 
         Vk_PhysicalDeviceMemory(const Vk_PhysicalDeviceMemory& other) = delete;
         Vk_PhysicalDeviceMemory(Vk_PhysicalDeviceMemory&& other)
         :
         _physicalDevice(other._physicalDevice),
-        _gpuMemoryHeapsState(std::move(other._gpuMemoryHeapsState))
+        _gpuMemoryHeapsState(std::move(other._gpuMemoryHeapsState)),
+        _memoryTypes(std::move(other._memoryTypes))
         {
             other._physicalDevice = nullptr;
         }
@@ -28,6 +31,7 @@ namespace VK5 {
             if(this == &other) return *this;
             _physicalDevice = other._physicalDevice;
             _gpuMemoryHeapsState = std::move(other._gpuMemoryHeapsState);
+            _memoryTypes = std::move(other._memoryTypes);
             other._physicalDevice = nullptr;
             return *this;
         }
@@ -37,7 +41,9 @@ namespace VK5 {
 
         // const getters
         const TGpuMemoryHeapsState& state() const { return _gpuMemoryHeapsState; }
+        const TMemoryTypes& memoryTypes() const { return _memoryTypes; }
         const Vk_HeapSize queryMemoryHeapSize(VkMemoryPropertyFlags memoryPropertyFlags) const { return Vk_PhysicalDeviceMemoryLib::queryGpuMemoryHeapSize(_gpuMemoryHeapsState, memoryPropertyFlags); }
+        bool supportsMemoryPropertyFlags(VkMemoryPropertyFlags memoryPropertyFlags) const { return Vk_PhysicalDeviceMemoryLib::supportsMemoryPropertyFlags(_memoryTypes, memoryPropertyFlags); }
         const THeapIndex queryGpuMemoryHeapIndex(VkMemoryPropertyFlags memoryPropertyFlags) const { return Vk_PhysicalDeviceMemoryLib::queryGpuMemoryHeapIndex(_gpuMemoryHeapsState, memoryPropertyFlags); }
         const Vk_HeapSize queryGpuMemoryHeapBudget(VkMemoryPropertyFlags memoryPropertyFlags) const { return Vk_PhysicalDeviceMemoryLib::queryGpuMemoryHeapBudget(_gpuMemoryHeapsState, memoryPropertyFlags); }
     };
@@ -3,12 +3,24 @@
 #include <vector>
 #include <map>
 #include <unordered_map>
+#include <algorithm>
+#include <bit>
 
 #include "../Defines.h"
 #include "../external/tabulate/single_include/tabulate/tabulate.hpp"
 
 namespace VK5 {
     typedef uint32_t THeapIndex;
+    typedef uint32_t TMemoryTypeIndex;
+
+    // one entry of VkPhysicalDeviceMemoryProperties::memoryTypes
+    struct Vk_MemoryType {
+        TMemoryTypeIndex memoryTypeIndex;
+        THeapIndex heapIndex;
+        VkMemoryPropertyFlags flags;
+    };
+
+    typedef std::vector<Vk_MemoryType> TMemoryTypes;
 
     struct Vk_GpuMemoryHeapStr {
         THeapIndex heapIndex;
@@ -81,6 +93,54 @@ namespace VK5 {
             return 0;
         }
 
+        // true if at least one memory type has all of memoryPropertyFlags (and maybe more)
+        static bool supportsMemoryPropertyFlags(const TMemoryTypes& memoryTypes, VkMemoryPropertyFlags memoryPropertyFlags) {
+            for(const auto& t : memoryTypes){
+                if((t.flags & memoryPropertyFlags) == memoryPropertyFlags) return true;
+            }
+            return false;
+        }
+
+        static TMemoryTypes initMemoryTypes(VkPhysicalDevice physicalDevice) {
+            VkPhysicalDeviceMemoryProperties deviceMemoryProperties;
+            vkGetPhysicalDeviceMemoryProperties(physicalDevice, &deviceMemoryProperties);
+            TMemoryTypes memoryTypes;
+            for (uint32_t i = 0; i < deviceMemoryProperties.memoryTypeCount; ++i) {
+                memoryTypes.push_back({
+                    .memoryTypeIndex = i,
+                    .heapIndex = deviceMemoryProperties.memoryTypes[i].heapIndex,
+                    .flags = deviceMemoryProperties.memoryTypes[i].propertyFlags
+                });
+            }
+            return memoryTypes;
+        }
+
+        /**
+         * Memory types a resource can go into, best first. memoryTypeBits comes from VkMemoryRequirements, every
+         * candidate has all required flags. Order:
+         *  1. most of the preferred flags (DEVICE_LOCAL preferred for host visible memory picks ReBAR/UMA memory if there is any)
+         *  2. fewest flags nobody asked for (don't waste the small DEVICE_LOCAL | HOST_VISIBLE heap on device only buffers)
+         *  3. lowest index (the spec orders equal types by performance)
+         * Protected and lazily allocated types are never used unless required. Empty if nothing fits.
+         */
+        static TMemoryTypes rankMemoryTypes(const TMemoryTypes& memoryTypes, uint32_t memoryTypeBits, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred) {
+            const VkMemoryPropertyFlags special = VK_MEMORY_PROPERTY_PROTECTED_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+            TMemoryTypes candidates;
+            for(const auto& t : memoryTypes){
+                if((memoryTypeBits & (1u << t.memoryTypeIndex)) == 0) continue;
+                if((t.flags & required) != required) continue;
+                if((t.flags & special & ~required) != 0) continue;
+                candidates.push_back(t);
+            }
+            std::stable_sort(candidates.begin(), candidates.end(), [&](const Vk_MemoryType& a, const Vk_MemoryType& b){
+                int preferredA = std::popcount(a.flags & preferred);
+                int preferredB = std::popcount(b.flags & preferred);
+                if(preferredA != preferredB) return preferredA > preferredB;
+                return std::popcount(a.flags & ~(required | preferred)) < std::popcount(b.flags & ~(required | preferred));
+            });
+            return candidates;
+        }
+
         static Vk_HeapSize queryGpuMemoryHeapBudget(const TGpuMemoryHeapsState& memoryHeapsState, VkMemoryPropertyFlags memoryPropertyFlags) {
             for(const auto& hs : memoryHeapsState){
                 for(const auto& hsf : hs.heapFlags)
@@ -24,6 +24,8 @@ namespace VK5 {
         std::set<VkQueueFlagBits> flagBits;
         std::vector<Vk_GpuOp> opPriorities;
         VkExtent3D minImageTransferGranularity;
+        // 0 => no vkCmdWriteTimestamp on this family
+        uint32_t timestampValidBits;
         Vk_QueueFamilyPresentCapable presentCapable;
         uint32_t logicalQueuesIndex;
     };
@@ -139,6 +141,7 @@ namespace VK5 {
                     .flagBits = queueFlagBitsSet,
                     .opPriorities = _queueFlagBits2QueueTypePriorities(queueFlagBitsSet, opPriorities),
                     .minImageTransferGranularity = props.minImageTransferGranularity,
+                    .timestampValidBits = props.timestampValidBits,
                     .presentCapable = Vk_QueueFamilyPresentCapable::Undetermined
                 }});
             }
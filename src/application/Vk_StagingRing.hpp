@@ -0,0 +1,181 @@
+#pragma once
+
+#include <mutex>
+#include <deque>
+#include <vector>
+#include <condition_variable>
+#include <algorithm>
+
+#include "../Defines.h"
+#include "./gpu_tasks/Vk_GpuFuture.hpp"
+
+namespace VK5 {
+    // size of the persistently mapped staging ring of one device (see Vk_StagingRing)
+    constexpr VkDeviceSize GLOBAL_STAGING_RING_SIZE = 64ull*1024ull*1024ull;
+
+    // one region of the staging ring. data points to the mapped memory at offset
+    struct Vk_StagingAllocation {
+        VkBuffer buffer;
+        VkDeviceSize offset;
+        VkDeviceSize size;
+        void* data;
+        uint64_t id;
+
+        // false if the request did not fit into the ring at all
+        bool valid() const { return data != nullptr; }
+    };
+
+    /**
+     * One HOST_VISIBLE | HOST_COHERENT staging buffer per device that stays mapped for its whole lifetime.
+     * Uploads sub-allocate regions from it instead of creating, mapping and destroying a staging buffer each time:
+     *    auto staging = ring.allocate(size);
+     *    memcpy(staging.data, src, size);
+     *    ring.retire(staging, Vk_DataBufferLib::copyGpuToGpu(..., staging.buffer, ..., staging.offset, ...));
+     * Regions are handed out in order and freed in order: the tail only moves on once the oldest region's copy is
+     * finished (its Vk_GpuFuture is ready). If the ring is full, allocate blocks until the oldest copy is done.
+     * NOTE: every allocation must be retired, otherwise the ring runs full and allocate blocks forever.
+     * NOTE: requests larger than the ring return an invalid allocation, the caller has to use a dedicated staging buffer.
+     */
+    class Vk_StagingRing {
+        struct Region {
+            VkDeviceSize begin;
+            uint64_t id;
+            bool retired;
+            Vk_GpuFuture future;
+        };
+
+        VkDevice _vkDevice;
+        VkBuffer _vkBuffer;
+        VkDeviceMemory _vkMemory;
+        VkDeviceSize _capacity;
+        VkDeviceSize _alignment;
+        char* _mapped;
+
+        std::mutex _mutex;
+        std::condition_variable _retiredCondition;
+        // in allocation order, front is the oldest region (= tail of the ring)
+        std::deque<Region> _regions;
+        VkDeviceSize _head;
+        uint64_t _nextId;
+
+    public:
+        /**
+         * memory must be HOST_VISIBLE | HOST_COHERENT and buffer must have VK_BUFFER_USAGE_TRANSFER_SRC_BIT.
+         * The ring maps memory, but doesn't own buffer and memory: the owner destroys them after the ring
+         * (see Vk_PhysicalDevice::destroyBuffer).
+         */
+        Vk_StagingRing(VkDevice vkDevice, VkBuffer buffer, VkDeviceMemory memory, VkDeviceSize capacity, VkDeviceSize alignment)
+        :
+        _vkDevice(vkDevice),
+        _vkBuffer(buffer),
+        _vkMemory(memory),
+        _capacity(capacity),
+        _alignment(std::max<VkDeviceSize>(alignment, 16)),
+        _mapped(_map(vkDevice, memory)),
+        _head(0),
+        _nextId(0)
+        {}
+
+        Vk_StagingRing(const Vk_StagingRing& other) = delete;
+        Vk_StagingRing(Vk_StagingRing&& other) = delete;
+        Vk_StagingRing& operator=(const Vk_StagingRing& other) = delete;
+        Vk_StagingRing& operator=(Vk_StagingRing&& other) = delete;
+
+        ~Vk_StagingRing(){
+            // NOTE: the copies out of the ring must be finished before the buffer goes away
+            std::vector<Vk_GpuFuture> inFlight;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                for(const auto& r : _regions) inFlight.push_back(r.future);
+            }
+            for(const auto& f : inFlight) f.wait();
+
+            vkUnmapMemory(_vkDevice, _vkMemory);
+        }
+
+        VkBuffer vk_buffer() const { return _vkBuffer; }
+        VkDeviceMemory vk_memory() const { return _vkMemory; }
+        VkDeviceSize capacity() const { return _capacity; }
+
+        // any thread
+        Vk_StagingAllocation allocate(VkDeviceSize size) {
+            if(size == 0 || size > _capacity) return Vk_StagingAllocation { .buffer = VK_NULL_HANDLE, .offset = 0, .size = size, .data = nullptr, .id = 0 };
+
+            std::unique_lock<std::mutex> lock(_mutex);
+            while(true){
+                _freeFinished();
+                VkDeviceSize offset;
+                if(_tryAllocate(size, offset)){
+                    uint64_t id = _nextId++;
+                    return Vk_StagingAllocation { .buffer = _vkBuffer, .offset = offset, .size = size, .data = _mapped + offset, .id = id };
+                }
+
+                // full: wait for the oldest region. If it is not submitted yet, wait until it is
+                Region& oldest = _regions.front();
+                if(!oldest.retired){
+                    uint64_t id = oldest.id;
+                    _retiredCondition.wait(lock, [&](){ return _regions.empty() || _regions.front().id != id || _regions.front().retired; });
+                    continue;
+                }
+                Vk_GpuFuture future = oldest.future;
+                lock.unlock();
+                future.wait();
+                lock.lock();
+            }
+        }
+
+        /**
+         * Any thread. The region of allocation is free again once future is ready. Pass an invalid
+         * future (Vk_GpuFuture()) if the region was never used for a copy.
+         */
+        void retire(const Vk_StagingAllocation& allocation, Vk_GpuFuture future) {
+            if(!allocation.valid()) return;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                auto iter = std::find_if(_regions.begin(), _regions.end(), [&](const Region& r){ return r.id == allocation.id; });
+                if(iter == _regions.end()) UT::Ut_Logger::RuntimeError(typeid(this), "Staging ring region {0} is not allocated", allocation.id);
+                iter->retired = true;
+                iter->future = std::move(future);
+            }
+            _retiredCondition.notify_all();
+        }
+
+    private:
+        static char* _map(VkDevice vkDevice, VkDeviceMemory memory) {
+            void* data;
+            Vk_CheckVkResult(typeid(NoneObj), vkMapMemory(vkDevice, memory, 0, VK_WHOLE_SIZE, 0, &data), "Unable to map staging ring memory");
+            return static_cast<char*>(data);
+        }
+
+        // _mutex must be locked
+        void _freeFinished() {
+            while(!_regions.empty() && _regions.front().retired && _regions.front().future.ready()) _regions.pop_front();
+            if(_regions.empty()) _head = 0;
+        }
+
+        /**
+         * _mutex must be locked. The used part of the ring goes from the begin of the oldest region (tail) to _head.
+         * If the new region doesn't fit in between _head and the end of the buffer, it starts over at 0 and the rest
+         * of the buffer stays unused until the tail moves past it.
+         */
+        bool _tryAllocate(VkDeviceSize size, /*out*/VkDeviceSize& offset) {
+            VkDeviceSize tail = _regions.empty() ? 0 : _regions.front().begin;
+            VkDeviceSize begin = (_head + _alignment - 1) / _alignment * _alignment;
+            if(_regions.empty() || _head > tail){
+                // free: [_head, _capacity) and [0, tail)
+                if(begin + size > _capacity){
+                    begin = 0;
+                    // NOTE: strictly smaller, _head == tail means empty
+                    if(!_regions.empty() && size >= tail) return false;
+                }
+            }
+            // wrapped around, free: [_head, tail)
+            else if(begin + size >= tail) return false;
+
+            offset = begin;
+            _head = begin + size;
+            _regions.push_back(Region { .begin = begin, .id = _nextId, .retired = false, .future = Vk_GpuFuture() });
+            return true;
+        }
+    };
+}
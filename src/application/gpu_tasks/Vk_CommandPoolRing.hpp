@@ -0,0 +1,144 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+#include "../../Defines.h"
+#include "../../Vk_CI.hpp"
+#include "../Vk_PhysicalDeviceQueueLib.hpp"
+
+namespace VK5 {
+    // amount of command pools one Vk_CommandPoolRing cycles through
+    constexpr size_t GLOBAL_COMMAND_POOL_RING_SIZE = 3;
+    // amount of command buffers a new segment starts with
+    constexpr uint32_t GLOBAL_COMMAND_POOL_SEGMENT_SIZE = 16;
+
+    /**
+     * One command pool with a block of preallocated command buffers. Command buffers are handed out
+     * in order and never freed one by one. Once all of them are back (inFlight == 0) the whole pool
+     * is reset with one vkResetCommandPool.
+     */
+    class Vk_CommandPoolSegment {
+    friend class Vk_CommandPoolRing;
+        VkDevice _vkDevice;
+        VkCommandPool _vkCommandPool;
+        std::vector<VkCommandBuffer> _buffers;
+        uint32_t _next;
+        std::atomic<uint32_t> _inFlight;
+
+    public:
+        Vk_CommandPoolSegment(VkDevice vkDevice, TQueueFamilyIndex familyIndex)
+        :
+        _vkDevice(vkDevice),
+        _vkCommandPool(_createCommandPool(vkDevice, familyIndex)),
+        _next(0),
+        _inFlight(0)
+        {}
+
+        Vk_CommandPoolSegment(const Vk_CommandPoolSegment& other) = delete;
+        Vk_CommandPoolSegment(Vk_CommandPoolSegment&& other) = delete;
+        Vk_CommandPoolSegment& operator=(const Vk_CommandPoolSegment& other) = delete;
+        Vk_CommandPoolSegment& operator=(Vk_CommandPoolSegment&& other) = delete;
+
+        ~Vk_CommandPoolSegment(){
+            // destroying the pool frees all command buffers allocated from it
+            if(_vkCommandPool != nullptr) vkDestroyCommandPool(_vkDevice, _vkCommandPool, nullptr);
+        }
+
+        // any thread: the command buffer of a finished task comes back
+        void release() {
+            _inFlight.fetch_sub(1, std::memory_order_release);
+        }
+
+    private:
+        void _grow(uint32_t count) {
+            if(count == 0) return;
+            size_t old = _buffers.size();
+            _buffers.resize(old + count);
+            auto allocInfo = Vk_CI::VkCommandBufferAllocateInfo_W(count, _vkCommandPool).data;
+            Vk_CheckVkResult(typeid(this), vkAllocateCommandBuffers(_vkDevice, &allocInfo, _buffers.data() + old), "Failed to allocate command buffers!");
+        }
+
+        void _reset() {
+            Vk_CheckVkResult(typeid(this), vkResetCommandPool(_vkDevice, _vkCommandPool, 0), "Failed to reset command pool");
+            _next = 0;
+        }
+
+        static VkCommandPool _createCommandPool(VkDevice vkDevice, TQueueFamilyIndex familyIndex) {
+            // NOTE: no RESET_COMMAND_BUFFER_BIT: command buffers are only ever reset together with the whole pool
+            VkCommandPoolCreateInfo createInfo = Vk_CI::VkCommandPoolCreateInfo_W(familyIndex, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT).data;
+            VkCommandPool vkCommandPool;
+            Vk_CheckVkResult(typeid(NoneObj), vkCreateCommandPool(vkDevice, &createInfo, nullptr, &vkCommandPool), "Unable to create segment command pool");
+            return vkCommandPool;
+        }
+    };
+
+    /**
+     * Command buffers of one recording thread for one queue family. Command pools are externally synchronized,
+     * so every record worker of Vk_GpuTaskRecordPool owns one ring per queue family and nobody else
+     * allocates from or records into its pools.
+     * The ring cycles through GLOBAL_COMMAND_POOL_RING_SIZE segments. The current segment hands out its preallocated
+     * command buffers. When it runs out, the ring moves on to the next segment if all of that segment's command buffers
+     * are back (bulk reset), otherwise the current segment grows. Segments are refilled to the highest usage observed
+     * so far, so after a short warm up there is no allocation on the record path anymore.
+     */
+    class Vk_CommandPoolRing {
+        VkDevice _vkDevice;
+        TQueueFamilyIndex _familyIndex;
+        std::vector<std::unique_ptr<Vk_CommandPoolSegment>> _segments;
+        size_t _current;
+        uint32_t _peak;
+
+    public:
+        Vk_CommandPoolRing(VkDevice vkDevice, TQueueFamilyIndex familyIndex)
+        :
+        _vkDevice(vkDevice),
+        _familyIndex(familyIndex),
+        _segments(_createSegments(vkDevice, familyIndex)),
+        _current(0),
+        _peak(GLOBAL_COMMAND_POOL_SEGMENT_SIZE)
+        {
+            _segments.at(_current)->_grow(_peak);
+        }
+
+        Vk_CommandPoolRing(const Vk_CommandPoolRing& other) = delete;
+        Vk_CommandPoolRing(Vk_CommandPoolRing&& other) = delete;
+        Vk_CommandPoolRing& operator=(const Vk_CommandPoolRing& other) = delete;
+        Vk_CommandPoolRing& operator=(Vk_CommandPoolRing&& other) = delete;
+
+        const TQueueFamilyIndex familyIndex() const { return _familyIndex; }
+
+        // owning thread only. segment is the one release() has to be called on once the command buffer is done
+        VkCommandBuffer acquire(/*out*/Vk_CommandPoolSegment*& segment) {
+            Vk_CommandPoolSegment* cur = _segments.at(_current).get();
+            if(cur->_next == cur->_buffers.size()){
+                _peak = std::max(_peak, cur->_next);
+                size_t nextIndex = (_current + 1) % _segments.size();
+                Vk_CommandPoolSegment* next = _segments.at(nextIndex).get();
+                if(next->_inFlight.load(std::memory_order_acquire) == 0){
+                    next->_reset();
+                    next->_grow(_peak - static_cast<uint32_t>(std::min<size_t>(_peak, next->_buffers.size())));
+                    _current = nextIndex;
+                    cur = next;
+                }
+                else {
+                    // the GPU is behind: everything is still in use, so this one has to get bigger
+                    cur->_grow(std::max<uint32_t>(GLOBAL_COMMAND_POOL_SEGMENT_SIZE, cur->_next / 2));
+                }
+            }
+
+            cur->_inFlight.fetch_add(1, std::memory_order_relaxed);
+            segment = cur;
+            return cur->_buffers.at(cur->_next++);
+        }
+
+    private:
+        static std::vector<std::unique_ptr<Vk_CommandPoolSegment>> _createSegments(VkDevice vkDevice, TQueueFamilyIndex familyIndex) {
+            std::vector<std::unique_ptr<Vk_CommandPoolSegment>> segments;
+            for(size_t i=0; i<GLOBAL_COMMAND_POOL_RING_SIZE; ++i) segments.push_back(std::make_unique<Vk_CommandPoolSegment>(vkDevice, familyIndex));
+            return segments;
+        }
+    };
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <coroutine>
+#include <future>
+#include <type_traits>
+
+#include "Vk_GpuFutureLib.hpp"
+#include "Vk_GpuTask.hpp"
+
+namespace VK5 {
+    /**
+     * Returned by Vk_PhysicalDevice::enqueue. Completes once the task is finished (after the task's own
+     * continuation set with Vk_GpuTaskModifier::t ran and after waitResponsively would return).
+     * Compositions:
+     *    auto upload = dev.enqueue(std::move(uploadTask));
+     *    auto both = Vk_GpuFuture::when_all({upload, dev.enqueue(std::move(otherUpload))});
+     *    auto draw = both.then([&](){ return dev.enqueue(std::move(drawTask)); });
+     *    draw.then([](){ ... });
+     * Inside a coroutine, co_await future suspends until the task is finished and returns the task
+     * (same as waitResponsively does).
+     * For compatibility, Vk_GpuFuture converts to TGpuTaskRunner and forwards operator->, so
+     * dev.enqueue(std::move(task))->waitResponsively() still works.
+     * NOTE: continuations run on the thread that completes the future, usually the completion reactor
+     * of a Vk_Queue. Don't block in there.
+     */
+    class Vk_GpuFuture {
+        std::shared_ptr<Vk_GpuFutureState> _state;
+
+    public:
+        struct Awaiter {
+            std::shared_ptr<Vk_GpuFutureState> state;
+
+            bool await_ready() const { return !state || state->ready(); }
+
+            bool await_suspend(std::coroutine_handle<> handle) {
+                // false => the state completed in the meantime, don't suspend at all
+                return state->addContinuationIfPending([handle](){ handle.resume(); });
+            }
+
+            std::unique_ptr<Vk_GpuTask> await_resume() {
+                if(!state || state->runner() == nullptr) return nullptr;
+                // the task is finished at this point => returns right away
+                return state->runner()->waitResponsively();
+            }
+        };
+
+        Vk_GpuFuture() : _state(nullptr) {}
+        Vk_GpuFuture(std::shared_ptr<Vk_GpuFutureState> state) : _state(std::move(state)) {}
+
+        /**
+         * Create the future for the next submission of task. Must be called before the task is
+         * moved into Vk_Queue::enqueue.
+         */
+        static Vk_GpuFuture attach(Vk_GpuTask& task) {
+            task._future = std::make_shared<Vk_GpuFutureState>(static_cast<TGpuTaskRunner>(&task));
+            return Vk_GpuFuture(task._future);
+        }
+
+        bool valid() const { return _state != nullptr; }
+        bool ready() const { return !_state || _state->ready(); }
+
+        // nullptr for futures that come out of then, when_all and when_any
+        TGpuTaskRunner runner() const { return _state ? _state->runner() : nullptr; }
+        TGpuTaskRunner operator->() const { return runner(); }
+        operator TGpuTaskRunner() const { return runner(); }
+
+        Awaiter operator co_await() const { return Awaiter { .state = _state }; }
+
+        // block the calling thread until the future is complete. Don't call this from inside a continuation
+        void wait() const {
+            if(ready()) return;
+            auto done = std::make_shared<std::promise<void>>();
+            auto doneFuture = done->get_future();
+            _state->addContinuation([done](){ done->set_value(); });
+            doneFuture.wait();
+        }
+
+        /**
+         * Run continuation once this future is complete. The returned future completes after the continuation.
+         * If the continuation returns a Vk_GpuFuture itself (for example the next enqueue), the returned
+         * future completes once that one is complete.
+         */
+        template<class TContinuation>
+        Vk_GpuFuture then(TContinuation continuation) const {
+            auto next = std::make_shared<Vk_GpuFutureState>(nullptr);
+            auto run = [continuation, next](){
+                if constexpr (std::is_same_v<std::invoke_result_t<TContinuation>, Vk_GpuFuture>){
+                    Vk_GpuFuture inner = continuation();
+                    if(inner.valid()) inner._state->addContinuation([next](){ next->complete(); });
+                    else next->complete();
+                }
+                else {
+                    continuation();
+                    next->complete();
+                }
+            };
+            if(_state) _state->addContinuation(run);
+            else run();
+            return Vk_GpuFuture(next);
+        }
+
+        // completes once all futures are complete
+        static Vk_GpuFuture when_all(const std::vector<Vk_GpuFuture>& futures) {
+            auto next = std::make_shared<Vk_GpuFutureState>(nullptr);
+            auto remaining = std::make_shared<std::atomic<size_t>>(futures.size() + 1);
+            auto arrive = [next, remaining](){ if(remaining->fetch_sub(1) == 1) next->complete(); };
+            for(const auto& f : futures){
+                if(f._state) f._state->addContinuation(arrive);
+                else arrive();
+            }
+            // the extra count makes sure nothing completes before all continuations are registered
+            arrive();
+            return Vk_GpuFuture(next);
+        }
+
+        /**
+         * Future with the runner of future that completes once future and all of futures are complete. For a task
+         * that has more tasks chained behind it (see the ownership transfers of Vk_PhysicalDevice::enqueue).
+         */
+        static Vk_GpuFuture joined(const Vk_GpuFuture& future, const std::vector<Vk_GpuFuture>& futures) {
+            auto next = std::make_shared<Vk_GpuFutureState>(future.runner());
+            std::vector<Vk_GpuFuture> all = futures;
+            all.push_back(future);
+            when_all(all)._state->addContinuation([next](){ next->complete(); });
+            return Vk_GpuFuture(next);
+        }
+
+        // completes as soon as one of the futures is complete
+        static Vk_GpuFuture when_any(const std::vector<Vk_GpuFuture>& futures) {
+            auto next = std::make_shared<Vk_GpuFutureState>(nullptr);
+            if(futures.empty()) next->complete();
+            for(const auto& f : futures){
+                if(f._state) f._state->addContinuation([next](){ next->complete(); });
+                else next->complete();
+            }
+            return Vk_GpuFuture(next);
+        }
+    };
+}
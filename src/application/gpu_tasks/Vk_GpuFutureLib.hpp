@@ -0,0 +1,73 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+#include <memory>
+#include <functional>
+
+namespace VK5 {
+    class Vk_GpuTaskRunner;
+
+    /**
+     * Shared state behind a Vk_GpuFuture. Completed exactly once: by the completion reactor of the Vk_Queue
+     * that ran the task, or by the combinators of Vk_GpuFuture (then, when_all, when_any).
+     * NOTE: continuations run on the thread that completes the state (usually a completion reactor).
+     * They should hand heavy work to some other thread instead of running it inline.
+     */
+    class Vk_GpuFutureState {
+        std::mutex _mutex;
+        bool _ready;
+        std::vector<std::function<void()>> _continuations;
+        Vk_GpuTaskRunner* _runner;
+
+    public:
+        Vk_GpuFutureState(Vk_GpuTaskRunner* runner) : _ready(false), _runner(runner) {}
+
+        Vk_GpuFutureState(const Vk_GpuFutureState& other) = delete;
+        Vk_GpuFutureState(Vk_GpuFutureState&& other) = delete;
+        Vk_GpuFutureState& operator=(const Vk_GpuFutureState& other) = delete;
+        Vk_GpuFutureState& operator=(Vk_GpuFutureState&& other) = delete;
+
+        Vk_GpuTaskRunner* runner() const { return _runner; }
+
+        bool ready() {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _ready;
+        }
+
+        // runs continuation right away if the state is already complete
+        void addContinuation(std::function<void()> continuation) {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if(!_ready){
+                    _continuations.push_back(std::move(continuation));
+                    return;
+                }
+            }
+            continuation();
+        }
+
+        // false if the state is already complete. continuation is not run in that case
+        bool addContinuationIfPending(std::function<void()> continuation) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if(_ready) return false;
+            _continuations.push_back(std::move(continuation));
+            return true;
+        }
+
+        void complete() {
+            std::vector<std::function<void()>> continuations;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if(_ready) return;
+                _ready = true;
+                std::swap(continuations, _continuations);
+            }
+            /**
+             * NOTE: no lock is held while the continuations run: they may add continuations
+             * to this state or complete other states
+             */
+            for(auto& c : continuations) c();
+        }
+    };
+}
@@ -4,19 +4,25 @@
 #include <condition_variable>
 #include <functional>
 #include <array>
+#include <vector>
+#include <algorithm>
 
+#include "../../Vk_CI.hpp"
 #include "Vk_GpuTaskLib.hpp"
+#include "Vk_CommandPoolRing.hpp"
+#include "Vk_GpuFutureLib.hpp"
+#include "Vk_GpuTaskRecordCache.hpp"
+#include "Vk_GpuTaskTrace.hpp"
 
 namespace VK5 {
     class Vk_GpuTask;
     class Vk_QueueBase {
     friend class Vk_GpuTask;
     public:
-        virtual void _enqueueFree(VkCommandBuffer commandBuffer) = 0;
+        virtual const TQueueFamilyIndex familyIndex() const = 0;
         virtual void _enqueueSubmit(std::unique_ptr<Vk_GpuTask> task) = 0;
     };
 
-    typedef void(Vk_QueueBase::*TEnqueueFree)(std::unique_ptr<Vk_GpuTask>);
     typedef void(Vk_QueueBase::*TEnqueueSubmit)(std::unique_ptr<Vk_GpuTask>);
 
     enum class Vk_GpuTaskStages {
@@ -28,10 +34,23 @@ namespace VK5 {
         Count
     };
 
+    /**
+     * Point on the timeline semaphore of a task. Reached on the GPU once the
+     * submission of the task the value belongs to is finished.
+     */
+    struct Vk_GpuTaskSignal {
+        VkSemaphore semaphore;
+        uint64_t value;
+    };
+
     class Vk_Queue;
+    class Vk_GpuTaskRunner;
+    typedef Vk_GpuTaskRunner* TGpuTaskRunner;
+
     class Vk_GpuTaskRunner {
     public:
         virtual const Vk_GpuOp opType() const = 0;
+        virtual Vk_GpuTaskSignal signal() const = 0;
         virtual std::unique_ptr<Vk_GpuTask> waitResponsivelyUS(std::chrono::microseconds us) = 0;
         virtual std::unique_ptr<Vk_GpuTask> waitResponsivelyMS(std::chrono::milliseconds ms) = 0;
         virtual std::unique_ptr<Vk_GpuTask> waitResponsively() = 0;
@@ -39,92 +58,159 @@ namespace VK5 {
 
     class Vk_GpuTaskModifier {
     friend class Vk_GpuTask;
-        Vk_GpuTaskParams _params;
+        // NOTE: polymorphic, record and submit functions cast it back to the type they were made for
+        std::unique_ptr<Vk_GpuTaskParams> _params;
         TGpuTaskRecord _recordFunction;
         TGpuTaskSubmit _submitFunction;
         std::function<void()> _then;
+        std::vector<VkSemaphore> _waitSemaphores;
+        std::vector<uint64_t> _waitValues;
+        std::vector<VkPipelineStageFlags> _waitStages;
+        std::vector<VkFence> _hostFences;
+        bool _cached;
     public:
         Vk_GpuTaskModifier(Vk_GpuOp opType) 
         : 
-        _params(Vk_GpuTaskParams(opType)), 
+        _params(std::make_unique<Vk_GpuTaskParams>(opType)), 
         _recordFunction(nullptr), 
         _submitFunction(nullptr),
-        _then({})
+        _then({}),
+        _cached(false)
         {}
 
-        Vk_GpuTaskModifier* params(Vk_GpuTaskParams&& params) { _params = std::move(params); return this; }
+        template<class TParams>
+        Vk_GpuTaskModifier* params(TParams&& params) { _params = std::make_unique<std::decay_t<TParams>>(std::move(params)); return this; }
         Vk_GpuTaskModifier* r(TGpuTaskRecord recordFunction) { _recordFunction = recordFunction; return this; }
+        /**
+         * NOTE: without a submit function, the queue submits the command buffer itself (with the waits
+         * and the timeline signal of the task) and batches it together with all other such tasks that are ready at the same time.
+         */
         Vk_GpuTaskModifier* s(TGpuTaskSubmit submitFunction) { _submitFunction = submitFunction; return this; }
         Vk_GpuTaskModifier* t(const std::function<void()>& then) { _then = std::move(then); return this; }
+        /**
+         * Cached recording: the command buffer is recorded once per queue family, record function and
+         * params hash (Vk_GpuTaskParams::hash) and submitted again on every following enqueue with the same
+         * params. Stage 2 is skipped for those. Only has an effect if the params provide a hash.
+         * NOTE: the record function must not depend on anything but the params.
+         */
+        Vk_GpuTaskModifier* c(bool cached = true) { _cached = cached; return this; }
+        /**
+         * Priority lane and deadline of the task (see Vk_GpuTaskPriority). Stored in the params => call after params().
+         */
+        Vk_GpuTaskModifier* p(Vk_GpuTaskPriority priority, TGpuTaskDeadline deadline = GLOBAL_NO_DEADLINE) {
+            _params->Priority = priority;
+            _params->Deadline = deadline;
+            return this;
+        }
+        /**
+         * Queue family ownership transfers the recorded commands include (see Vk_GpuTaskLib::recordOwnershipBarriers).
+         * Stored in the params => call after params(). Vk_PhysicalDevice::enqueue sets them for copies of exclusive buffers.
+         */
+        Vk_GpuTaskModifier* o(std::vector<Vk_QueueFamilyOwnership>&& ownership) {
+            _params->Ownership = std::move(ownership);
+            return this;
+        }
+        /**
+         * Wait on the GPU for the current submission of dependency before this task starts at the given stage.
+         * Works across queues and families: there is no CPU round trip between the two tasks. Chains like
+         *    copyA = queue1->enqueue(std::move(a));
+         *    b->mod()->w(copyA, VK_PIPELINE_STAGE_TRANSFER_BIT);
+         *    copyB = queue2->enqueue(std::move(b));
+         * flow on the GPU only. The waits are consumed by the next submission of this task.
+         * NOTE: only tasks that leave the submission to the queue (no submit function) can wait.
+         * NOTE: dependency must stay alive until this task is submitted.
+         */
+        Vk_GpuTaskModifier* w(TGpuTaskRunner dependency, VkPipelineStageFlags stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT) {
+            Vk_GpuTaskSignal signal = dependency->signal();
+            _waitSemaphores.push_back(signal.semaphore);
+            _waitValues.push_back(signal.value);
+            _waitStages.push_back(stage);
+            return this;
+        }
+        /**
+         * Don't submit this task before fence is signaled. For work the application submits itself (frames, see
+         * Vk_DataBuffer::markInFlight): there is no timeline to wait for on the GPU. The submit thread of the queue
+         * checks the fence host side, other tasks of the queue pass the held back one.
+         * Consumed by the next submission of this task, like the waits (w).
+         */
+        Vk_GpuTaskModifier* f(VkFence fence) {
+            if(fence != VK_NULL_HANDLE) _hostFences.push_back(fence);
+            return this;
+        }
     };
 
-    typedef Vk_GpuTaskRunner* TGpuTaskRunner;
-
     class Vk_GpuTask : public Vk_GpuTaskRunner, public Vk_GpuTaskModifier {
     friend class Vk_Queue;
-        // static constexpr int mCount = static_cast<int>(Vk_GpuTaskStages::Count);
-
-        // Thank you:
-        // https://stackoverflow.com/questions/73158786/locking-an-array-of-stdmutex-using-a-stdlock-guard-array
-        // for fancy arrays:
-        template<typename Mutexes>
-        auto makeScopedLock(Mutexes& mutexes)
-        { return std::apply([](auto&... mutexes) { return std::scoped_lock{mutexes...}; }, mutexes); }
-
+    friend class Vk_GpuTaskRecordPool;
+    friend class Vk_GpuFuture;
         VkDevice _vkDevice;
         VkFence _vkFence;
         VkCommandBuffer _vkCommandBuffer;
         VkCommandPool _vkCommandPool;
+        // segment of the record worker's command pool ring _vkCommandBuffer comes from
+        Vk_CommandPoolSegment* _commandSegment;
+        // or the cached recording _vkCommandBuffer belongs to
+        Vk_GpuTaskRecordCache::Entry* _cacheEntry;
+        // set by Vk_Queue while the task occupies one of its background slots
+        bool _backgroundSlot;
+        // tracing (see Vk_GpuTaskTracer), set by Vk_Queue::enqueue for each submission
+        bool _traced;
+        bool _traceGpu;
+        Vk_GpuTaskTimes _times;
+        // two timestamps around the recorded commands, created on first use
+        VkQueryPool _vkQueryPool;
+
+        /**
+         * Every submission of this task signals _vkTimeline to the next _timelineValue. Other tasks
+         * wait for that value (see Vk_GpuTaskModifier::w). Timeline semaphores are core in Vulkan 1.2.
+         */
+        VkSemaphore _vkTimeline;
+        uint64_t _timelineValue;
+        VkTimelineSemaphoreSubmitInfo _vkTimelineSubmitInfo;
 
         Vk_GpuTaskStages _stage;
 
         std::unique_ptr<Vk_GpuTask> _self;
+        // completed after stage 5 of the next submission, see Vk_GpuFuture::attach
+        std::shared_ptr<Vk_GpuFutureState> _future;
         Vk_QueueBase* _parentQueue;
         TGpuTargetOpFamilies* _targetOpFamillies;
 
-        // check for initialization with variadic templates
-        // https://greitemann.dev/2018/09/15/variadic-expansion-in-aggregate-initialization/ 
-        // std::array<std::mutex, mCount> _mutex;
-        // std::array<std::condition_variable, mCount> _conditions;
-        struct Stage1_Alloc{
-            std::mutex mutex;
-            std::condition_variable condition;
-        } _stage1_alloc;
-        struct Stage2_Record{
-            std::mutex mutex;
-            std::condition_variable condition;
-        } _stage2_record;
-        struct Stage3_Submit{
-            std::mutex mutex;
-            std::condition_variable condition;
-        } _stage3_submit;
-        struct Stage4_Running{
-            std::mutex mutex;
-            std::condition_variable condition;
-        } _stage4_running;
+        // the waitResponsively methods wait here for stage 5
         struct Stage5_Finished{
             std::mutex mutex;
             std::condition_variable condition;
         } _stage5_finished;
 
         bool _terminate;
-        std::thread _recordThread;
-        std::thread _runningWorker;
     public:
-        Vk_GpuTask(VkDevice vkDevice, Vk_GpuOp opType) 
+        /**
+         * timelineSemaphore: Vk_PhysicalDeviceLib::PhysicalDevicePR::extensionSupport.timelineSemaphore. Dependencies (Vk_GpuTaskModifier::w)
+         * and futures are built on the timeline of the task => tasks can't exist without it.
+         */
+        Vk_GpuTask(VkDevice vkDevice, Vk_GpuOp opType, bool timelineSemaphore) 
         : 
         Vk_GpuTaskModifier(opType),
         _vkDevice(vkDevice),
         _vkFence(_createFence(_vkDevice)), 
         _vkCommandBuffer(nullptr), 
         _vkCommandPool(nullptr), 
+        _commandSegment(nullptr),
+        _cacheEntry(nullptr),
+        _backgroundSlot(false),
+        _traced(false),
+        _traceGpu(false),
+        _times({}),
+        _vkQueryPool(nullptr),
+        _vkTimeline(_createTimeline(_vkDevice, timelineSemaphore)),
+        _timelineValue(0),
+        _vkTimelineSubmitInfo({ .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO }),
         _stage(Vk_GpuTaskStages::Stage1_Alloc),
         _self(nullptr),
+        _future(nullptr),
         _parentQueue(nullptr),
         _targetOpFamillies(nullptr),
-        _terminate(false), 
-        _recordThread(std::thread(&Vk_GpuTask::_recordWorker, this)),
-        _runningWorker(std::thread(&Vk_GpuTask::_running, this))
+        _terminate(false)
         {}
         Vk_GpuTask(const Vk_GpuTask& other) = delete;
         Vk_GpuTask(Vk_GpuTask&& other) = delete;
@@ -134,23 +220,25 @@ namespace VK5 {
         virtual ~Vk_GpuTask(){
             std::cout << ">>>>>>>>>>>>>>>>>>> destroy task" << std::endl;
             {
-                auto scopedLock = std::scoped_lock {_stage1_alloc.mutex, _stage2_record.mutex, _stage3_submit.mutex, _stage4_running.mutex, _stage5_finished.mutex };
+                auto lock = std::unique_lock<std::mutex>(_stage5_finished.mutex);
                 _terminate = true;
             }
-            _stage1_alloc.condition.notify_all();
-            _stage2_record.condition.notify_all();
-            _stage3_submit.condition.notify_all();
-            _stage4_running.condition.notify_all();
             _stage5_finished.condition.notify_all();
 
-            if(_recordThread.joinable()) _recordThread.join();
-            if(_runningWorker.joinable()) _runningWorker.join();
             vkDestroyFence(_vkDevice, _vkFence, nullptr);
+            vkDestroySemaphore(_vkDevice, _vkTimeline, nullptr);
+            if(_vkQueryPool != nullptr) vkDestroyQueryPool(_vkDevice, _vkQueryPool, nullptr);
         }
 
         Vk_GpuTaskModifier* mod() { return static_cast<Vk_GpuTaskModifier*>(this); }
 
-        const Vk_GpuOp opType() const { return _params.Op; }
+        const Vk_GpuOp opType() const { return _params->Op; }
+        std::vector<VkBuffer> buffers() const { return _params->buffers(); }
+        std::vector<VkBuffer> writtenBuffers() const { return _params->writtenBuffers(); }
+        Vk_GpuTaskPriority priority() const { return _params->Priority; }
+        TGpuTaskDeadline deadline() const { return _params->Deadline; }
+
+        Vk_GpuTaskSignal signal() const { return Vk_GpuTaskSignal { .semaphore = _vkTimeline, .value = _timelineValue }; }
 
         std::unique_ptr<Vk_GpuTask> waitResponsivelyUS(std::chrono::microseconds us) {
             auto lock = std::unique_lock<std::mutex>(_stage5_finished.mutex);
@@ -191,81 +279,218 @@ namespace VK5 {
     private:
         void resetTask() {
             _stage = Vk_GpuTaskStages::Stage1_Alloc;
+            // value that the upcoming submission signals. Runs synchronously inside Vk_Queue::enqueue
+            // so the returned TGpuTaskRunner can be used as a dependency right away
+            _timelineValue++;
         }
 
-        // stage 1 and 5 (serialized for VkCommandPool)
-        void passAlloc(std::unique_ptr<Vk_GpuTask> self, VkCommandBuffer commandBuffer, Vk_QueueBase* pParentQueue, TGpuTargetOpFamilies* targetOpFamilies){
-            if(_vkCommandBuffer != nullptr) UT::Ut_Logger::RuntimeError(typeid(this), "CommandBuffer is not nullptr! Alloc before free => this is a bug!");
-            _vkCommandBuffer = commandBuffer;
-            _self = std::move(self);
+        // stage 1: run from Vk_Queue::enqueue
+        void passQueue(Vk_QueueBase* pParentQueue, TGpuTargetOpFamilies* targetOpFamilies){
             _parentQueue = pParentQueue;
             _targetOpFamillies = targetOpFamilies;
+        }
 
-            // goto next
+        // stage 1: run on the record worker that owns the command pool of commandBuffer
+        void passAlloc(VkCommandBuffer commandBuffer, Vk_CommandPoolSegment* segment){
+            if(_vkCommandBuffer != nullptr) UT::Ut_Logger::RuntimeError(typeid(this), "CommandBuffer is not nullptr! Alloc before free => this is a bug!");
+            _vkCommandBuffer = commandBuffer;
+            _commandSegment = segment;
+            _stamp(_times.allocated);
+
+            // goto next: the same worker records right away
             _stage = Vk_GpuTaskStages::Stage2_Record;
-            _stage2_record.condition.notify_one();
         }
 
-        void _recordWorker(){
-            // run endlessly... we should techincally get one task at the time
-            while(true){
-                {
-                    auto lock = std::unique_lock<std::mutex>(_stage2_record.mutex);
-                    _stage2_record.condition.wait(lock, [this](){
-                        return _stage == Vk_GpuTaskStages::Stage2_Record || _terminate;
-                    });
+        const Vk_GpuTaskParams& taskParams() const { return *_params; }
+        TGpuTaskRecord recordFunction() const { return _recordFunction; }
+        const std::vector<VkSemaphore>& waitSemaphores() const { return _waitSemaphores; }
+        bool waitsFor(VkSemaphore semaphore) const { return std::find(_waitSemaphores.begin(), _waitSemaphores.end(), semaphore) != _waitSemaphores.end(); }
+        bool hostFences() const { return !_hostFences.empty(); }
+        // one of the fences of Vk_GpuTaskModifier::f is not signaled yet
+        bool gatedByHostFence() const {
+            return std::any_of(_hostFences.begin(), _hostFences.end(), [this](VkFence fence){ return vkGetFenceStatus(_vkDevice, fence) != VK_SUCCESS; });
+        }
+        bool cachedRecording() const { return _cached && _recordFunction != nullptr && _params->hash() != 0; }
+
+        // stage 1 for cached recordings: the command buffer is already recorded
+        void passCached(Vk_GpuTaskRecordCache::Entry* entry){
+            if(_vkCommandBuffer != nullptr) UT::Ut_Logger::RuntimeError(typeid(this), "CommandBuffer is not nullptr! Alloc before free => this is a bug!");
+            _vkCommandBuffer = entry->commandBuffer();
+            _cacheEntry = entry;
+            _stamp(_times.allocated);
+            _stage = Vk_GpuTaskStages::Stage2_Record;
+        }
 
-                    if(_terminate) return;
-                    if(_recordFunction) _recordFunction(_vkCommandBuffer, _targetOpFamillies, _params);
+        // stage 2 for cached recordings: nothing to record, straight to the submit stage
+        void skipRecord(std::unique_ptr<Vk_GpuTask> self){
+            _stamp(_times.recorded);
+            _stage = Vk_GpuTaskStages::Stage3_Submit;
+            _parentQueue->_enqueueSubmit(std::move(self));
+        }
 
-                    // goto next: back to Vk_Queue because this one has to be in sync
-                    _stage = Vk_GpuTaskStages::Stage3_Submit;
+        // stage 2: run on one of the workers of Vk_GpuTaskRecordPool
+        void record(std::unique_ptr<Vk_GpuTask> self){
+            if(_recordFunction) {
+                auto beginInfo = Vk_CI::VkCommandBufferBeginInfo_W(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT).data;
+                Vk_CheckVkResult(typeid(this), vkBeginCommandBuffer(_vkCommandBuffer, &beginInfo), "Failed to begin command buffer");
+                if(_traceGpu){
+                    if(_vkQueryPool == nullptr) _vkQueryPool = _createQueryPool(_vkDevice);
+                    vkCmdResetQueryPool(_vkCommandBuffer, _vkQueryPool, 0, 2);
+                    vkCmdWriteTimestamp(_vkCommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, _vkQueryPool, 0);
                 }
-                /**
-                 * NOTE: make sure all locks are released before calling this one
-                 * _enqueueSubmit is thread safe
-                 */
-                _parentQueue->_enqueueSubmit(std::move(_self));
+                _recordFunction(_vkCommandBuffer, _targetOpFamillies, *_params);
+                if(_traceGpu) vkCmdWriteTimestamp(_vkCommandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, _vkQueryPool, 1);
+                Vk_CheckVkResult(typeid(this), vkEndCommandBuffer(_vkCommandBuffer), "Failed to end command buffer");
             }
+            _stamp(_times.recorded);
+
+            // goto next: back to Vk_Queue because this one has to be in sync
+            _stage = Vk_GpuTaskStages::Stage3_Submit;
+
+            /**
+             * NOTE: _enqueueSubmit is thread safe
+             */
+            _parentQueue->_enqueueSubmit(std::move(self));
         }
 
-        void submit(std::unique_ptr<Vk_GpuTask> self, VkQueue vkQueue) {
-            // submit task, run from Vk_Queue
-            if(_submitFunction) _submitFunction(_vkCommandBuffer, vkQueue, _vkFence, _params);
-            _self = std::move(self);
+        /**
+         * Tasks that only record a command buffer and leave the submission to the queue
+         * are collected by Vk_Queue and go to the GPU with one vkQueueSubmit per batch.
+         */
+        bool batchable() const { return _submitFunction == nullptr; }
+
+        /**
+         * Fill in the VkSubmitInfo for the batch submission of Vk_Queue: the recorded command buffer (if any),
+         * all dependencies and the timeline signal. A task without a record function becomes an empty
+         * submission that only waits and signals (useful to join several dependencies).
+         * NOTE: submitInfo points into this task. It is valid until the task is finished.
+         */
+        VkSubmitInfo submitInfo() {
+            _vkTimelineSubmitInfo.waitSemaphoreValueCount = static_cast<uint32_t>(_waitValues.size());
+            _vkTimelineSubmitInfo.pWaitSemaphoreValues = _waitValues.data();
+            _vkTimelineSubmitInfo.signalSemaphoreValueCount = 1;
+            _vkTimelineSubmitInfo.pSignalSemaphoreValues = &_timelineValue;
+
+            // submitInfo is not in Vk_CI because it's rather customized every time it shows up
+            VkSubmitInfo submitInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+            submitInfo.pNext = &_vkTimelineSubmitInfo;
+            submitInfo.waitSemaphoreCount = static_cast<uint32_t>(_waitSemaphores.size());
+            submitInfo.pWaitSemaphores = _waitSemaphores.data();
+            submitInfo.pWaitDstStageMask = _waitStages.data();
+            submitInfo.commandBufferCount = _recordFunction ? 1 : 0;
+            submitInfo.pCommandBuffers = &_vkCommandBuffer;
+            submitInfo.signalSemaphoreCount = 1;
+            submitInfo.pSignalSemaphores = &_vkTimeline;
+            return submitInfo;
+        }
 
-            // goto next
+        // stage 3 for batchable tasks: Vk_Queue did the vkQueueSubmit for us
+        void submitted() {
+            _stamp(_times.submitted);
             _stage = Vk_GpuTaskStages::Stage4_Running;
-            _stage4_running.condition.notify_one();
         }
 
-        void _running() {
-            while(true) {
-                {
-                    auto lock = std::unique_lock<std::mutex>(_stage4_running.mutex);
-                    _stage4_running.condition.wait(lock, [this](){
-                        return _stage == Vk_GpuTaskStages::Stage4_Running || _terminate;
-                    });
-
-                    if(_terminate) return;
-                    
-                    VkResult res = vkWaitForFences(_vkDevice, 1, &_vkFence, VK_TRUE, GLOBAL_FENCE_TIMEOUT);
-                    if(res == VK_TIMEOUT) UT::Ut_Logger::RuntimeError(typeid(this), "Signal timeout");
-                    else if (res != VK_SUCCESS) UT::Ut_Logger::RuntimeError(typeid(this), "Signal catastrophic result!");
-
-                    _parentQueue->_enqueueFree(_vkCommandBuffer);
-                    if(_then) _then();
-                    _vkCommandBuffer = nullptr;
-                    _parentQueue = nullptr;
-                    _targetOpFamillies = nullptr;
-
-                    _stage = Vk_GpuTaskStages::Stage5_Finished;
+        void submit(VkQueue vkQueue) {
+            // submit task with a custom submit function, run from Vk_Queue
+            if(!_waitSemaphores.empty()) UT::Ut_Logger::RuntimeError(typeid(this), "Tasks with a custom submit function can't wait for other tasks. Leave the submission to the queue!");
+            Vk_CheckVkResult(typeid(this), vkResetFences(_vkDevice, 1, &_vkFence), "Failed to reset task fence");
+            _submitFunction(_vkCommandBuffer, vkQueue, _vkFence, *_params);
+
+            // the custom submit function knows nothing about the timeline. Signal it with an empty submission:
+            // a semaphore signal covers all work submitted to the same queue before it
+            _vkTimelineSubmitInfo.waitSemaphoreValueCount = 0;
+            _vkTimelineSubmitInfo.pWaitSemaphoreValues = nullptr;
+            _vkTimelineSubmitInfo.signalSemaphoreValueCount = 1;
+            _vkTimelineSubmitInfo.pSignalSemaphoreValues = &_timelineValue;
+            VkSubmitInfo signalInfo = { VK_STRUCTURE_TYPE_SUBMIT_INFO };
+            signalInfo.pNext = &_vkTimelineSubmitInfo;
+            signalInfo.signalSemaphoreCount = 1;
+            signalInfo.pSignalSemaphores = &_vkTimeline;
+            Vk_CheckVkResult(typeid(this), vkQueueSubmit(vkQueue, 1, &signalInfo, nullptr), "Failed to signal task timeline");
+
+            // goto next: the task is handed to the completion reactor of Vk_Queue
+            _stamp(_times.submitted);
+            _stage = Vk_GpuTaskStages::Stage4_Running;
+        }
+
+        // run by the completion reactor of Vk_Queue before finish
+        Vk_GpuTaskTraceEvent traceEvent(const Vk_GpuTaskTracer& tracer, TQueueFamilyIndex familyIndex, TQueueIndex queueIndex) {
+            _stamp(_times.finished);
+            Vk_GpuTaskTraceEvent event {
+                .op = _params->Op, .priority = _params->Priority,
+                .familyIndex = familyIndex, .queueIndex = queueIndex,
+                .cached = _cacheEntry != nullptr, .times = _times,
+                .gpuTimestamps = false, .gpuBegin = 0, .gpuEnd = 0
+            };
+            if(_traceGpu){
+                // the fence is signaled => the results are available, no need to wait
+                std::array<uint64_t, 2> ticks;
+                VkResult res = vkGetQueryPoolResults(_vkDevice, _vkQueryPool, 0, 2, sizeof(ticks), ticks.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+                if(res == VK_SUCCESS){
+                    event.gpuTimestamps = true;
+                    event.gpuBegin = tracer.gpuTicksToNs(familyIndex, ticks.at(0));
+                    event.gpuEnd = tracer.gpuTicksToNs(familyIndex, ticks.at(1));
                 }
-                /**
-                 * NOTE: make sure all locks are released before calling notify
-                 */
-                _stage5_finished.condition.notify_one(); // everyone who is waiting
             }
+            return event;
+        }
+
+        /**
+         * Stage 5: run by the completion reactor of Vk_Queue once _vkFence is signaled.
+         * Returns the command buffer to its pool segment, runs the continuation and wakes everyone
+         * who is waiting inside one of the waitResponsively methods.
+         */
+        void finish(std::unique_ptr<Vk_GpuTask> self) {
+            std::shared_ptr<Vk_GpuFutureState> future = nullptr;
+            {
+                auto lock = std::unique_lock<std::mutex>(_stage5_finished.mutex);
+                // the command buffer goes back to its pool segment. It's reset together with the whole pool
+                if(_commandSegment) _commandSegment->release();
+                if(_cacheEntry) _cacheEntry->release();
+                _commandSegment = nullptr;
+                _cacheEntry = nullptr;
+                if(_then) _then();
+                _vkCommandBuffer = nullptr;
+                _parentQueue = nullptr;
+                _targetOpFamillies = nullptr;
+                _waitSemaphores.clear();
+                _waitValues.clear();
+                _waitStages.clear();
+                _hostFences.clear();
+                future = std::move(_future);
+                _self = std::move(self);
+
+                _stage = Vk_GpuTaskStages::Stage5_Finished;
+            }
+            /**
+             * NOTE: make sure all locks are released before calling notify
+             */
+            _stage5_finished.condition.notify_all(); // everyone who is waiting
+
+            /**
+             * NOTE: don't touch any member after this point: waitResponsively may have returned the
+             * task already. future is a local copy.
+             */
+            if(future) future->complete();
+        }
+
+        void _stamp(TTraceStamp& stamp) {
+            if(_traced) stamp = std::chrono::steady_clock::now();
+        }
+
+        VkQueryPool _createQueryPool(VkDevice vkDevice){
+            auto createInfo = Vk_CI::VkQueryPoolCreateInfo_W(VK_QUERY_TYPE_TIMESTAMP, 2).data;
+            VkQueryPool queryPool;
+            Vk_CheckVkResult(typeid(this), vkCreateQueryPool(vkDevice, &createInfo, nullptr, &queryPool), "Failed to create task timestamp query pool");
+            return queryPool;
+        }
+
+        VkSemaphore _createTimeline(VkDevice vkDevice, bool timelineSemaphore){
+            if(!timelineSemaphore) UT::Ut_Logger::RuntimeError(typeid(this), "The device doesn't support timeline semaphores (Vulkan 1.2 feature timelineSemaphore), gpu tasks need them");
+            auto createInfo = Vk_CI::VkSemaphoreCreateInfo_W(Vk_CI::VkSemaphoreTypeCreateInfo_W(VK_SEMAPHORE_TYPE_TIMELINE).data);
+            VkSemaphore semaphore;
+            Vk_CheckVkResult(typeid(this), vkCreateSemaphore(vkDevice, &createInfo.data, nullptr, &semaphore), "Failed to create task timeline semaphore");
+            return semaphore;
         }
 
         VkFence _createFence(VkDevice vkDevice){
@@ -1,20 +1,61 @@
 #pragma once
 
+#include <chrono>
+
 #include "../../Defines.h"
 
 namespace VK5 {
+    typedef std::chrono::steady_clock::time_point TGpuTaskDeadline;
+    constexpr TGpuTaskDeadline GLOBAL_NO_DEADLINE = TGpuTaskDeadline::max();
+
+    /**
+     * Queue family ownership transfer of an exclusive buffer (see Vk_PhysicalDevice::createAndAllocBuffer) around a
+     * copy on the transfer family: home releases => the copy acquires, copies and releases => home acquires.
+     */
+    struct Vk_QueueFamilyOwnership {
+        VkBuffer buffer;
+        // family the buffer was created for and the family that runs the copy
+        TQueueFamilyIndex homeFamily;
+        TQueueFamilyIndex transferFamily;
+    };
+
     struct Vk_GpuTaskParams {
         Vk_GpuOp Op;
+        // lane in Vk_Queue's submit stage. Inside a lane, the earlier deadline goes first.
+        // Tasks past their deadline are treated as Vk_GpuTaskPriority::FrameCritical
+        Vk_GpuTaskPriority Priority;
+        TGpuTaskDeadline Deadline;
+        // buffers the task has to take over from their home family, set by Vk_PhysicalDevice::enqueue
+        std::vector<Vk_QueueFamilyOwnership> Ownership;
 
-        Vk_GpuTaskParams(Vk_GpuOp op) : Op(op) {}
+        Vk_GpuTaskParams(Vk_GpuOp op) : Op(op), Priority(Vk_GpuTaskPriority::Interactive), Deadline(GLOBAL_NO_DEADLINE), Ownership({}) {}
         Vk_GpuTaskParams(const Vk_GpuTaskParams& other) = delete;
-        Vk_GpuTaskParams(Vk_GpuTaskParams&& other) : Op(other.Op) {}
+        Vk_GpuTaskParams(Vk_GpuTaskParams&& other) : Op(other.Op), Priority(other.Priority), Deadline(other.Deadline), Ownership(std::move(other.Ownership)) {}
         Vk_GpuTaskParams& operator=(const Vk_GpuTaskParams& other) = delete;
         Vk_GpuTaskParams& operator=(Vk_GpuTaskParams&& other) { 
             if(this == &other) return *this;
             Op = std::move(other.Op);
+            Priority = other.Priority;
+            Deadline = other.Deadline;
+            Ownership = std::move(other.Ownership);
             return *this;
         }
+        virtual ~Vk_GpuTaskParams() {}
+
+        /**
+         * Identifies the recorded commands for cached recording (see Vk_GpuTaskModifier::c).
+         * Two params with the same hash must record the exact same commands. 0 means "not cacheable".
+         */
+        virtual size_t hash() const { return 0; }
+        /**
+         * Everything the recorded commands depend on. A cache hit compares it in full, two params with the same
+         * hash may still be different. Must be provided by every params type that provides a hash.
+         */
+        virtual std::vector<uint64_t> recordKey() const { return {}; }
+        // all buffers the recorded commands reference. A cached recording is dropped if one of them is destroyed
+        virtual std::vector<VkBuffer> buffers() const { return {}; }
+        // the part of buffers() the recorded commands write to
+        virtual std::vector<VkBuffer> writtenBuffers() const { return {}; }
     };
     typedef std::unordered_map<Vk_GpuTargetOp, std::vector<TQueueFamilyIndex>> TGpuTargetOpFamilies;
     typedef void(*TGpuTaskRecord)(VkCommandBuffer, TGpuTargetOpFamilies*, const Vk_GpuTaskParams&);
@@ -22,6 +63,72 @@ namespace VK5 {
 
     class Vk_GpuTaskLib {
     public:
+        /**
+         * Release (release == true) or acquire half of the ownership transfers. toTransfer: home family => transfer family,
+         * otherwise back. Releases are recorded on the family that gives the buffer away, acquires on the one that takes it.
+         */
+        static void recordOwnershipBarriers(VkCommandBuffer commandBuffer, const std::vector<Vk_QueueFamilyOwnership>& ownership, bool toTransfer, bool release){
+            if(ownership.empty()) return;
+            std::vector<VkBufferMemoryBarrier> barriers;
+            for(const auto& o : ownership){
+                VkBufferMemoryBarrier barrier = { VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER };
+                // NOTE: the access mask of the other family is ignored
+                barrier.srcAccessMask = !release ? 0 : (toTransfer ? VK_ACCESS_MEMORY_WRITE_BIT : VK_ACCESS_TRANSFER_WRITE_BIT);
+                barrier.dstAccessMask = release ? 0 : (toTransfer ? VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT : VK_ACCESS_MEMORY_READ_BIT);
+                barrier.srcQueueFamilyIndex = toTransfer ? o.homeFamily : o.transferFamily;
+                barrier.dstQueueFamilyIndex = toTransfer ? o.transferFamily : o.homeFamily;
+                barrier.buffer = o.buffer;
+                barrier.offset = 0;
+                barrier.size = VK_WHOLE_SIZE;
+                barriers.push_back(barrier);
+            }
+            VkPipelineStageFlags srcStage = !release ? VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT : (toTransfer ? VK_PIPELINE_STAGE_ALL_COMMANDS_BIT : VK_PIPELINE_STAGE_TRANSFER_BIT);
+            VkPipelineStageFlags dstStage = release ? VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT : (toTransfer ? VK_PIPELINE_STAGE_TRANSFER_BIT : VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+            vkCmdPipelineBarrier(commandBuffer, srcStage, dstStage, 0, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data(), 0, nullptr);
+        }
+
+        /**
+         * Only the ownership barriers, runs on the home family before (release) and after (acquire) a copy on the
+         * transfer family. The buffers are in Vk_GpuTaskParams::Ownership.
+         */
+        struct Vk_QueueFamilyTransfer : public Vk_GpuTaskParams {
+            bool Acquire;
+            Vk_QueueFamilyTransfer(std::vector<Vk_QueueFamilyOwnership>&& ownership, bool acquire)
+            :
+            Vk_GpuTaskParams(Vk_GpuOp::Transfer),
+            Acquire(acquire)
+            {
+                Ownership = std::move(ownership);
+            }
+
+            Vk_QueueFamilyTransfer(const Vk_QueueFamilyTransfer& other) = delete;
+            Vk_QueueFamilyTransfer(Vk_QueueFamilyTransfer&& other)
+            :
+            Vk_GpuTaskParams(std::move(other)),
+            Acquire(other.Acquire)
+            {}
+
+            Vk_QueueFamilyTransfer& operator=(const Vk_QueueFamilyTransfer& other) = delete;
+            Vk_QueueFamilyTransfer& operator=(Vk_QueueFamilyTransfer&& other){
+                Vk_GpuTaskParams::operator=(std::move(other));
+                Acquire = other.Acquire;
+
+                return *this;
+            }
+
+            std::vector<VkBuffer> buffers() const {
+                std::vector<VkBuffer> res;
+                for(const auto& o : Ownership) res.push_back(o.buffer);
+                return res;
+            }
+
+            static void record(VkCommandBuffer commandBuffer, TGpuTargetOpFamilies* targetOpFamilies, const Vk_GpuTaskParams& params){
+                const Vk_QueueFamilyTransfer& taskParams = static_cast<const Vk_QueueFamilyTransfer&>(params);
+                // release: home => transfer, acquire: transfer => home
+                recordOwnershipBarriers(commandBuffer, taskParams.Ownership, !taskParams.Acquire, !taskParams.Acquire);
+            }
+        };
+
         struct Vk_CopyGpuToGpu : public Vk_GpuTaskParams {
             VkBuffer SrcBuffer;
             VkDeviceSize SrcOffset;
@@ -66,24 +173,71 @@ namespace VK5 {
                 return *this;
             }
 
+            size_t hash() const {
+                size_t seed = static_cast<size_t>(Op);
+                UT::Ut_Std::hash_combine(seed, SrcBuffer);
+                UT::Ut_Std::hash_combine(seed, SrcOffset);
+                UT::Ut_Std::hash_combine(seed, DstBuffer);
+                UT::Ut_Std::hash_combine(seed, DstOffset);
+                UT::Ut_Std::hash_combine(seed, Size);
+                UT::Ut_Std::hash_combine(seed, static_cast<int>(BufferTargetOp));
+                for(const auto& o : Ownership){
+                    UT::Ut_Std::hash_combine(seed, o.homeFamily);
+                    UT::Ut_Std::hash_combine(seed, o.transferFamily);
+                }
+                // 0 is reserved for "not cacheable"
+                return seed == 0 ? 1 : seed;
+            }
+
+            std::vector<uint64_t> recordKey() const {
+                std::vector<uint64_t> key = {
+                    static_cast<uint64_t>(Op),
+                    reinterpret_cast<uint64_t>(SrcBuffer), SrcOffset,
+                    reinterpret_cast<uint64_t>(DstBuffer), DstOffset,
+                    Size, static_cast<uint64_t>(BufferTargetOp)
+                };
+                for(const auto& o : Ownership){
+                    key.push_back(reinterpret_cast<uint64_t>(o.buffer));
+                    key.push_back(o.homeFamily);
+                    key.push_back(o.transferFamily);
+                }
+                return key;
+            }
+
+            std::vector<VkBuffer> buffers() const { return { SrcBuffer, DstBuffer }; }
+            std::vector<VkBuffer> writtenBuffers() const { return { DstBuffer }; }
+
             /**
-             * TODO:Vk_GpuTargetOp - use targetOpFamilies to include the propper VkBufferMemoryBarrier
-             *    - 1. transfer target buffer to a Transfer family
+             * With exclusive buffers (Ownership, see Vk_PhysicalDevice::enqueue) the copy runs on the transfer family:
+             *    - 1. acquire the buffers from their home family (released by a Vk_QueueFamilyTransfer task)
              *    - 2. insert copy command
-             *    - 3. transfer target buffer to a queue family that fits the target operation
-             * 
-             *    - the Vk_GpuTargetOp is included in Vk_CopyGpuToGpu
-             *    - currently it's set to Vk_GpuTargetOp::Auto default value
+             *    - 3. release the buffers back to their home family (acquired by a Vk_QueueFamilyTransfer task)
              */
-            static void record(VkCommandBuffer commandBuffer, const TGpuTargetOpFamilies& targetOpFamilies, const Vk_CopyGpuToGpu& taskParams){
-                auto beginInfo = Vk_CI::VkCommandBufferBeginInfo_W(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT).data;
-                vkBeginCommandBuffer(commandBuffer, &beginInfo); // begin recording command
+            static void record(VkCommandBuffer commandBuffer, TGpuTargetOpFamilies* targetOpFamilies, const Vk_GpuTaskParams& params){
+                // NOTE: vkBeginCommandBuffer and vkEndCommandBuffer are done by Vk_GpuTask
+                const Vk_CopyGpuToGpu& taskParams = static_cast<const Vk_CopyGpuToGpu&>(params);
+                recordOwnershipBarriers(commandBuffer, taskParams.Ownership, true, false);
                 VkBufferCopy copyRegion = {};
                 copyRegion.srcOffset = taskParams.SrcOffset; // optional
                 copyRegion.dstOffset = taskParams.DstOffset; // optional
                 copyRegion.size = taskParams.Size;
                 vkCmdCopyBuffer(commandBuffer, taskParams.SrcBuffer, taskParams.DstBuffer, 1, &copyRegion);
-                vkEndCommandBuffer(commandBuffer); // end recording command
+                recordOwnershipBarriers(commandBuffer, taskParams.Ownership, false, true);
+            }
+
+            // same as record, plus a barrier that makes the copied range visible to host reads (readback)
+            static void recordForHost(VkCommandBuffer commandBuffer, TGpuTargetOpFamilies* targetOpFamilies, const Vk_GpuTaskParams& params){
+                record(commandBuffer, targetOpFamilies, params);
+                const Vk_CopyGpuToGpu& taskParams = static_cast<const Vk_CopyGpuToGpu&>(params);
+                VkBufferMemoryBarrier barrier = { VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER };
+                barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+                barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+                barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                barrier.buffer = taskParams.DstBuffer;
+                barrier.offset = taskParams.DstOffset;
+                barrier.size = taskParams.Size;
+                vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
             }
 
             static void submit(VkCommandBuffer commandBuffer, VkQueue queue, VkFence fence, const Vk_GpuTaskParams& taskParams){
@@ -94,5 +248,58 @@ namespace VK5 {
                 VkResult res = vkQueueSubmit(queue, 1, &submitInfo, fence);
             }
         };
+
+        /**
+         * Many regions between the same two buffers in one vkCmdCopyBuffer (see Vk_DataBuffer::flush).
+         * NOTE: not cacheable (hash() == 0), the regions are different on every flush.
+         */
+        struct Vk_CopyRegionsGpuToGpu : public Vk_GpuTaskParams {
+            VkBuffer SrcBuffer;
+            VkBuffer DstBuffer;
+            std::vector<VkBufferCopy> Regions;
+            Vk_GpuTargetOp BufferTargetOp;
+            Vk_CopyRegionsGpuToGpu(
+                VkBuffer srcBuffer,
+                VkBuffer dstBuffer,
+                std::vector<VkBufferCopy>&& regions,
+                Vk_GpuTargetOp bufferTargetOp = Vk_GpuTargetOp::Auto
+            )
+            :
+            Vk_GpuTaskParams(Vk_GpuOp::Transfer),
+            SrcBuffer(srcBuffer), DstBuffer(dstBuffer),
+            Regions(std::move(regions)), BufferTargetOp(bufferTargetOp)
+            {}
+
+            Vk_CopyRegionsGpuToGpu(const Vk_CopyRegionsGpuToGpu& other) = delete;
+            Vk_CopyRegionsGpuToGpu(Vk_CopyRegionsGpuToGpu&& other)
+            :
+            Vk_GpuTaskParams(std::move(other)),
+            SrcBuffer(std::move(other.SrcBuffer)), DstBuffer(std::move(other.DstBuffer)),
+            Regions(std::move(other.Regions)), BufferTargetOp(std::move(other.BufferTargetOp))
+            {}
+
+            Vk_CopyRegionsGpuToGpu& operator=(const Vk_CopyRegionsGpuToGpu& other) = delete;
+            Vk_CopyRegionsGpuToGpu& operator=(Vk_CopyRegionsGpuToGpu&& other){
+                Vk_GpuTaskParams::operator=(std::move(other));
+                SrcBuffer = std::move(other.SrcBuffer);
+                DstBuffer = std::move(other.DstBuffer);
+                Regions = std::move(other.Regions);
+                BufferTargetOp = std::move(other.BufferTargetOp);
+
+                return *this;
+            }
+
+            std::vector<VkBuffer> buffers() const { return { SrcBuffer, DstBuffer }; }
+            std::vector<VkBuffer> writtenBuffers() const { return { DstBuffer }; }
+
+            // ownership barriers as in Vk_CopyGpuToGpu::record
+            static void record(VkCommandBuffer commandBuffer, TGpuTargetOpFamilies* targetOpFamilies, const Vk_GpuTaskParams& params){
+                // NOTE: vkBeginCommandBuffer and vkEndCommandBuffer are done by Vk_GpuTask
+                const Vk_CopyRegionsGpuToGpu& taskParams = static_cast<const Vk_CopyRegionsGpuToGpu&>(params);
+                recordOwnershipBarriers(commandBuffer, taskParams.Ownership, true, false);
+                vkCmdCopyBuffer(commandBuffer, taskParams.SrcBuffer, taskParams.DstBuffer, static_cast<uint32_t>(taskParams.Regions.size()), taskParams.Regions.data());
+                recordOwnershipBarriers(commandBuffer, taskParams.Ownership, false, true);
+            }
+        };
     };
 }
\ No newline at end of file
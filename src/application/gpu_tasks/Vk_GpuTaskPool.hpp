@@ -2,24 +2,38 @@
 
 #include <unordered_map>
 #include <forward_list>
+#include <memory>
 #include <mutex>
 
 #include "../../Defines.h"
 #include "Vk_GpuTask.hpp"
+#include "Vk_GpuFuture.hpp"
 
 namespace VK5 {
     class Vk_GpuTaskPool {
     private:
+        /**
+         * The tasks live in a shared storage: continuations of returnWhenFinished hold the storage, not the pool.
+         * They may run after the pool was moved or destroyed (for example while a Vk_Queue finishes its last tasks).
+         */
+        struct Storage {
+            std::mutex mutex;
+            std::unordered_map<Vk_GpuOp, std::forward_list<std::unique_ptr<Vk_GpuTask>>> tasks;
+            // set by the destructor of the pool, tasks that come back afterwards are destroyed right away
+            bool closed = false;
+        };
+
         VkDevice _vkDevice;
-        std::unordered_map<Vk_GpuOp, std::forward_list<std::unique_ptr<Vk_GpuTask>>> _tasks;
-        std::mutex _mutex;
+        bool _timelineSemaphore;
+        std::shared_ptr<Storage> _storage;
     public:
-        Vk_GpuTaskPool(VkDevice vkDevice) : _vkDevice(vkDevice) {}
+        Vk_GpuTaskPool(VkDevice vkDevice, bool timelineSemaphore) : _vkDevice(vkDevice), _timelineSemaphore(timelineSemaphore), _storage(std::make_shared<Storage>()) {}
         Vk_GpuTaskPool(const Vk_GpuTaskPool& other) = delete;
         Vk_GpuTaskPool(Vk_GpuTaskPool&& other)
         :
         _vkDevice(other._vkDevice),
-        _tasks(std::move(other._tasks))
+        _timelineSemaphore(other._timelineSemaphore),
+        _storage(std::move(other._storage))
         {
             other._vkDevice = nullptr;
         }
@@ -27,25 +41,34 @@ namespace VK5 {
         Vk_GpuTaskPool& operator=(const Vk_GpuTaskPool& other) = delete;
         Vk_GpuTaskPool& operator=(Vk_GpuTaskPool&& other) {
             if(this == &other) return *this;
+            _close();
             _vkDevice = other._vkDevice;
-            _tasks = std::move(other._tasks);
+            _timelineSemaphore = other._timelineSemaphore;
+            _storage = std::move(other._storage);
 
             other._vkDevice = nullptr;
 
             return *this;
         }
 
-        ~Vk_GpuTaskPool(){}
+        /**
+         * NOTE: the tasks are destroyed here, while the device still exists. Tasks that come back later
+         * (returnWhenFinished) are destroyed once they are back.
+         */
+        ~Vk_GpuTaskPool(){
+            _close();
+        }
 
         std::unique_ptr<Vk_GpuTask> getOrCreateTask(Vk_GpuOp op){
-            auto lock = std::lock_guard<std::mutex>(_mutex);
-            if(!_tasks.contains(op)){
+            auto lock = std::lock_guard<std::mutex>(_storage->mutex);
+            auto& tasks = _storage->tasks;
+            if(!tasks.contains(op) || tasks.at(op).empty()){
                 // create new task for op and return a unique ptr for it
-                return std::move(std::make_unique<Vk_GpuTask>(_vkDevice, op));
+                return std::move(std::make_unique<Vk_GpuTask>(_vkDevice, op, _timelineSemaphore));
             }
             else{
                 // return one of the already present tasks
-                auto& tt = _tasks.at(op);
+                auto& tt = tasks.at(op);
                 auto uPtr = std::move(tt.front());
                 tt.pop_front();
                 return std::move(uPtr);
@@ -53,14 +76,36 @@ namespace VK5 {
         }
 
         void returnTask(std::unique_ptr<Vk_GpuTask> task){
-            auto lock = std::lock_guard<std::mutex>(_mutex);
-            if(!_tasks.contains(task->opType())){
-                _tasks.insert({task->opType(), {}});
-                _tasks.at(task->opType()).emplace_front(std::move(task));
-            }
-            else{
-                _tasks.at(task->opType()).emplace_front(std::move(task));
+            _return(*_storage, std::move(task));
+        }
+
+        /**
+         * Give the task of future (a future of Vk_PhysicalDevice::enqueue) back to the pool once it is finished.
+         * The returned future completes after that.
+         */
+        Vk_GpuFuture returnWhenFinished(const Vk_GpuFuture& future){
+            std::shared_ptr<Storage> storage = _storage;
+            TGpuTaskRunner runner = future.runner();
+            // the task is finished when the continuation runs => waitResponsively returns right away
+            return future.then([storage, runner](){ _return(*storage, runner->waitResponsively()); });
+        }
+
+    private:
+        static void _return(Storage& storage, std::unique_ptr<Vk_GpuTask> task){
+            auto lock = std::lock_guard<std::mutex>(storage.mutex);
+            if(storage.closed) return;
+            Vk_GpuOp op = task->opType();
+            storage.tasks[op].emplace_front(std::move(task));
+        }
+
+        void _close(){
+            if(!_storage) return;
+            std::unordered_map<Vk_GpuOp, std::forward_list<std::unique_ptr<Vk_GpuTask>>> tasks;
+            {
+                auto lock = std::lock_guard<std::mutex>(_storage->mutex);
+                _storage->closed = true;
+                std::swap(tasks, _storage->tasks);
             }
         }
     };
-}
\ No newline at end of file
+}
@@ -0,0 +1,219 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <algorithm>
+
+#include "../../Defines.h"
+#include "../../Vk_CI.hpp"
+#include "../Vk_PhysicalDeviceQueueLib.hpp"
+#include "Vk_GpuTaskLib.hpp"
+
+namespace VK5 {
+    // amount of cached recordings per logical device before the least recently used ones are dropped
+    constexpr size_t GLOBAL_RECORD_CACHE_CAPACITY = 256;
+
+    /**
+     * Command buffers that are recorded once and submitted again and again (cached recording, see
+     * Vk_GpuTaskModifier::c). A recording is found by the queue family, the record function and
+     * Vk_GpuTaskParams::hash and only used if Vk_GpuTaskParams::recordKey matches too. Vk_Queue::enqueue looks the task up and, on a hit, hands the cached command buffer
+     * straight to the submit stage (stage 2 is skipped). On a miss, the record worker records into a command buffer
+     * of this cache instead of its own pools.
+     * Cached command buffers are recorded with VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT, so the same
+     * recording can be in flight more than once.
+     * NOTE: there is one command pool per queue family. Recording and freeing is serialized per family.
+     */
+    class Vk_GpuTaskRecordCache {
+    public:
+        class Entry {
+        friend class Vk_GpuTaskRecordCache;
+            VkCommandBuffer _vkCommandBuffer;
+            TQueueFamilyIndex _familyIndex;
+            std::vector<uint64_t> _recordKey;
+            std::vector<VkBuffer> _buffers;
+            std::atomic<uint32_t> _inFlight;
+            std::atomic<uint64_t> _lastUse;
+
+        public:
+            Entry(VkCommandBuffer commandBuffer, TQueueFamilyIndex familyIndex, std::vector<uint64_t>&& recordKey, std::vector<VkBuffer>&& buffers)
+            : _vkCommandBuffer(commandBuffer), _familyIndex(familyIndex), _recordKey(std::move(recordKey)), _buffers(std::move(buffers)), _inFlight(0), _lastUse(0)
+            {}
+
+            VkCommandBuffer commandBuffer() const { return _vkCommandBuffer; }
+
+            // any thread: one submission of this recording is finished
+            void release() { _inFlight.fetch_sub(1, std::memory_order_release); }
+        };
+
+    private:
+        struct Key {
+            TQueueFamilyIndex familyIndex;
+            TGpuTaskRecord recordFunction;
+            size_t hash;
+            bool operator==(const Key& other) const = default;
+        };
+
+        struct KeyHash {
+            size_t operator()(const Key& key) const {
+                size_t seed = key.hash;
+                UT::Ut_Std::hash_combine(seed, key.familyIndex);
+                UT::Ut_Std::hash_combine(seed, reinterpret_cast<uintptr_t>(key.recordFunction));
+                return seed;
+            }
+        };
+
+        struct Family {
+            VkCommandPool vkCommandPool;
+            std::mutex recordMutex;
+        };
+
+        VkDevice _vkDevice;
+        size_t _capacity;
+        std::atomic<uint64_t> _clock;
+
+        // guards _entries, _retired and _families
+        std::shared_mutex _mutex;
+        std::unordered_map<Key, std::unique_ptr<Entry>, KeyHash> _entries;
+        // no longer found by lookups but maybe still in flight. Freed once _inFlight == 0
+        std::vector<std::unique_ptr<Entry>> _retired;
+        std::unordered_map<TQueueFamilyIndex, std::unique_ptr<Family>> _families;
+
+    public:
+        Vk_GpuTaskRecordCache(VkDevice vkDevice, size_t capacity = GLOBAL_RECORD_CACHE_CAPACITY)
+        : _vkDevice(vkDevice), _capacity(capacity), _clock(0)
+        {}
+
+        Vk_GpuTaskRecordCache(const Vk_GpuTaskRecordCache& other) = delete;
+        Vk_GpuTaskRecordCache(Vk_GpuTaskRecordCache&& other) = delete;
+        Vk_GpuTaskRecordCache& operator=(const Vk_GpuTaskRecordCache& other) = delete;
+        Vk_GpuTaskRecordCache& operator=(Vk_GpuTaskRecordCache&& other) = delete;
+
+        ~Vk_GpuTaskRecordCache(){
+            // NOTE: all queues must be idle at this point. Destroying the pools frees all cached command buffers
+            for(auto& f : _families) vkDestroyCommandPool(_vkDevice, f.second->vkCommandPool, nullptr);
+        }
+
+        size_t size() {
+            std::shared_lock<std::shared_mutex> lock(_mutex);
+            return _entries.size();
+        }
+
+        // any thread. Returns nullptr on a miss. On a hit, Entry::release must be called once the submission is finished
+        Entry* acquire(TQueueFamilyIndex familyIndex, TGpuTaskRecord recordFunction, const Vk_GpuTaskParams& params) {
+            return _acquire(familyIndex, recordFunction, params.hash(), params.recordKey());
+        }
+
+        /**
+         * Record worker on a miss: record params with recordFunction into a new cached command buffer.
+         * If some other worker recorded the same thing in the meantime, that one is used.
+         */
+        Entry* record(TQueueFamilyIndex familyIndex, TGpuTaskRecord recordFunction, TGpuTargetOpFamilies* targetOpFamilies, const Vk_GpuTaskParams& params) {
+            size_t hash = params.hash();
+            std::vector<uint64_t> recordKey = params.recordKey();
+            Family& family = _family(familyIndex);
+            std::lock_guard<std::mutex> recordLock(family.recordMutex);
+
+            Entry* entry = _acquire(familyIndex, recordFunction, hash, recordKey);
+            if(entry != nullptr) return entry;
+
+            _freeRetired(familyIndex);
+
+            VkCommandBuffer vkCommandBuffer;
+            auto allocInfo = Vk_CI::VkCommandBufferAllocateInfo_W(1, family.vkCommandPool).data;
+            Vk_CheckVkResult(typeid(this), vkAllocateCommandBuffers(_vkDevice, &allocInfo, &vkCommandBuffer), "Failed to allocate cached command buffer!");
+
+            auto beginInfo = Vk_CI::VkCommandBufferBeginInfo_W(VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT).data;
+            Vk_CheckVkResult(typeid(this), vkBeginCommandBuffer(vkCommandBuffer, &beginInfo), "Failed to begin cached command buffer");
+            recordFunction(vkCommandBuffer, targetOpFamilies, params);
+            Vk_CheckVkResult(typeid(this), vkEndCommandBuffer(vkCommandBuffer), "Failed to end cached command buffer");
+
+            auto newEntry = std::make_unique<Entry>(vkCommandBuffer, familyIndex, std::move(recordKey), params.buffers());
+            entry = newEntry.get();
+            entry->_inFlight.store(1, std::memory_order_relaxed);
+            entry->_lastUse.store(_clock.fetch_add(1, std::memory_order_relaxed), std::memory_order_relaxed);
+            {
+                std::unique_lock<std::shared_mutex> lock(_mutex);
+                Key key { .familyIndex = familyIndex, .recordFunction = recordFunction, .hash = hash };
+                // hash collision: the older recording makes room
+                auto iter = _entries.find(key);
+                if(iter != _entries.end()){
+                    _retired.push_back(std::move(iter->second));
+                    _entries.erase(iter);
+                }
+                _entries.insert({key, std::move(newEntry)});
+                if(_entries.size() > _capacity) _evictLeastRecentlyUsed();
+            }
+            return entry;
+        }
+
+        /**
+         * Drop all recordings that reference buffer. Must be called before buffer is destroyed,
+         * otherwise a later cache hit would submit a command buffer that references a dead buffer.
+         */
+        void forget(VkBuffer buffer) {
+            std::unique_lock<std::shared_mutex> lock(_mutex);
+            for(auto iter = _entries.begin(); iter != _entries.end();){
+                const auto& buffers = iter->second->_buffers;
+                if(std::find(buffers.begin(), buffers.end(), buffer) == buffers.end()) { ++iter; continue; }
+                _retired.push_back(std::move(iter->second));
+                iter = _entries.erase(iter);
+            }
+        }
+
+    private:
+        Entry* _acquire(TQueueFamilyIndex familyIndex, TGpuTaskRecord recordFunction, size_t hash, const std::vector<uint64_t>& recordKey) {
+            std::shared_lock<std::shared_mutex> lock(_mutex);
+            auto iter = _entries.find(Key { .familyIndex = familyIndex, .recordFunction = recordFunction, .hash = hash });
+            if(iter == _entries.end() || iter->second->_recordKey != recordKey) return nullptr;
+            Entry* entry = iter->second.get();
+            entry->_inFlight.fetch_add(1, std::memory_order_relaxed);
+            entry->_lastUse.store(_clock.fetch_add(1, std::memory_order_relaxed), std::memory_order_relaxed);
+            return entry;
+        }
+
+        Family& _family(TQueueFamilyIndex familyIndex) {
+            {
+                std::shared_lock<std::shared_mutex> lock(_mutex);
+                auto iter = _families.find(familyIndex);
+                if(iter != _families.end()) return *iter->second;
+            }
+            std::unique_lock<std::shared_mutex> lock(_mutex);
+            if(!_families.contains(familyIndex)){
+                auto family = std::make_unique<Family>();
+                // NOTE: RESET_COMMAND_BUFFER_BIT is not needed, cached command buffers are never re-recorded
+                VkCommandPoolCreateInfo createInfo = Vk_CI::VkCommandPoolCreateInfo_W(familyIndex, 0).data;
+                Vk_CheckVkResult(typeid(this), vkCreateCommandPool(_vkDevice, &createInfo, nullptr, &family->vkCommandPool), "Unable to create record cache command pool");
+                _families.insert({familyIndex, std::move(family)});
+            }
+            return *_families.at(familyIndex);
+        }
+
+        // _mutex must be locked exclusively
+        void _evictLeastRecentlyUsed() {
+            while(_entries.size() > _capacity){
+                auto lru = _entries.end();
+                for(auto iter = _entries.begin(); iter != _entries.end(); ++iter){
+                    if(lru == _entries.end() || iter->second->_lastUse.load() < lru->second->_lastUse.load()) lru = iter;
+                }
+                if(lru == _entries.end()) return;
+                _retired.push_back(std::move(lru->second));
+                _entries.erase(lru);
+            }
+        }
+
+        // the record mutex of familyIndex must be locked (command pools are externally synchronized)
+        void _freeRetired(TQueueFamilyIndex familyIndex) {
+            std::unique_lock<std::shared_mutex> lock(_mutex);
+            VkCommandPool vkCommandPool = _families.at(familyIndex)->vkCommandPool;
+            std::erase_if(_retired, [&](const std::unique_ptr<Entry>& e){
+                if(e->_familyIndex != familyIndex || e->_inFlight.load(std::memory_order_acquire) != 0) return false;
+                vkFreeCommandBuffers(_vkDevice, vkCommandPool, 1, &e->_vkCommandBuffer);
+                return true;
+            });
+        }
+    };
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <thread>
+#include <deque>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+
+#include "../../Defines.h"
+#include "../../utils/Ut_MpscRing.hpp"
+#include "Vk_GpuTask.hpp"
+#include "Vk_CommandPoolRing.hpp"
+#include "Vk_GpuTaskRecordCache.hpp"
+
+namespace VK5 {
+    typedef uint32_t TGpuTaskRecordThreadCount;
+
+    /**
+     * Fixed size pool of workers that runs stage 2 (TGpuTaskRecord) for the tasks of all Vk_Queue
+     * of one logical device. Every worker owns a deque. New tasks are distributed round robin over
+     * the deques. A worker takes its own tasks from the back (the most recently enqueued one is most likely
+     * still in the cache) and steals from the front of the other deques if its own is empty.
+     * After recording, the task is passed back to its parent queue using Vk_QueueBase::_enqueueSubmit.
+     * Every worker owns one Vk_CommandPoolRing per queue family. The worker that records a task also
+     * allocates its command buffer, so no command pool is ever touched by two threads.
+     * Idle workers park on one Ut_Parker, enqueue wakes them.
+     */
+    class Vk_GpuTaskRecordPool {
+    private:
+        struct Worker {
+            std::deque<std::unique_ptr<Vk_GpuTask>> tasks;
+            std::mutex mutex;
+            // only used by the thread of this worker, destroyed with the pool (after all queues are idle)
+            std::unordered_map<TQueueFamilyIndex, std::unique_ptr<Vk_CommandPoolRing>> commandPools;
+        };
+
+        /**
+         * NOTE: the sequence of these variables is important. All workers and the synchronization
+         * primitives must exist before the first thread starts running.
+         */
+        Vk_GpuTaskRecordCache* _recordCache;
+        std::vector<std::unique_ptr<Worker>> _workers;
+        std::atomic<uint64_t> _next;
+        // tasks in all deques, changed under the lock of the deque => a worker that finds it > 0 but all deques empty lost a race
+        std::atomic<int64_t> _queued;
+        std::atomic<bool> _terminate;
+        UT::Ut_Parker _parker;
+        std::vector<std::thread> _threads;
+
+    public:
+        /**
+         * Default amount of record workers: half of the available hardware threads but at least one.
+         * Recording is cheap compared to the rest of the application, so there is no need to use more.
+         */
+        static TGpuTaskRecordThreadCount defaultThreadCount() {
+            return std::max<TGpuTaskRecordThreadCount>(1, std::thread::hardware_concurrency() / 2);
+        }
+
+        Vk_GpuTaskRecordPool(TGpuTaskRecordThreadCount threadCount, Vk_GpuTaskRecordCache* recordCache)
+        :
+        _recordCache(recordCache),
+        _workers(_createWorkers(threadCount == 0 ? defaultThreadCount() : threadCount)),
+        _next(0),
+        _queued(0),
+        _terminate(false)
+        {
+            for(size_t i=0; i<_workers.size(); ++i)
+                _threads.push_back(std::thread(&Vk_GpuTaskRecordPool::_workerLoop, this, i));
+        }
+
+        Vk_GpuTaskRecordPool(const Vk_GpuTaskRecordPool& other) = delete;
+        Vk_GpuTaskRecordPool(Vk_GpuTaskRecordPool&& other) = delete;
+        Vk_GpuTaskRecordPool& operator=(const Vk_GpuTaskRecordPool& other) = delete;
+        Vk_GpuTaskRecordPool& operator=(Vk_GpuTaskRecordPool&& other) = delete;
+
+        ~Vk_GpuTaskRecordPool(){
+            stop();
+        }
+
+        /**
+         * Stop all workers. Workers finish the task they are currently recording, everything that
+         * is still pending is dropped. Tasks enqueued after stop() are dropped too.
+         */
+        void stop() {
+            if(_terminate.exchange(true)) return;
+            _parker.notify();
+            for(auto& t : _threads) if(t.joinable()) t.join();
+            _threads.clear();
+            for(auto& w : _workers) w->tasks.clear();
+        }
+
+        TGpuTaskRecordThreadCount threadCount() const { return static_cast<TGpuTaskRecordThreadCount>(_workers.size()); }
+
+        void enqueue(std::unique_ptr<Vk_GpuTask> task) {
+            if(_terminate.load()) return;
+            auto& worker = _workers.at(_next.fetch_add(1, std::memory_order_relaxed) % _workers.size());
+            {
+                std::unique_lock<std::mutex> lock(worker->mutex);
+                worker->tasks.push_back(std::move(task));
+                _queued.fetch_add(1);
+            }
+            _parker.notify();
+        }
+
+    private:
+        std::vector<std::unique_ptr<Worker>> _createWorkers(TGpuTaskRecordThreadCount threadCount) {
+            std::vector<std::unique_ptr<Worker>> workers;
+            for(TGpuTaskRecordThreadCount i=0; i<threadCount; ++i) workers.push_back(std::make_unique<Worker>());
+            return workers;
+        }
+
+        Vk_CommandPoolRing& _commandPoolRing(size_t index, VkDevice vkDevice, TQueueFamilyIndex familyIndex) {
+            auto& pools = _workers.at(index)->commandPools;
+            if(!pools.contains(familyIndex)) pools.insert({familyIndex, std::make_unique<Vk_CommandPoolRing>(vkDevice, familyIndex)});
+            return *pools.at(familyIndex);
+        }
+
+        std::unique_ptr<Vk_GpuTask> _pop(size_t index) {
+            // own deque first, from the back
+            // NOTE: no order between the tasks of a queue from here on, Vk_Queue::_selectReady restores it for dependent tasks
+            {
+                auto& own = _workers.at(index);
+                std::unique_lock<std::mutex> lock(own->mutex);
+                if(!own->tasks.empty()){
+                    auto task = std::move(own->tasks.back());
+                    own->tasks.pop_back();
+                    _queued.fetch_sub(1);
+                    return task;
+                }
+            }
+            // steal from the front of all other deques, starting with the neighbour
+            for(size_t i=1; i<_workers.size(); ++i){
+                auto& other = _workers.at((index + i) % _workers.size());
+                std::unique_lock<std::mutex> lock(other->mutex);
+                if(!other->tasks.empty()){
+                    auto task = std::move(other->tasks.front());
+                    other->tasks.pop_front();
+                    _queued.fetch_sub(1);
+                    return task;
+                }
+            }
+            return nullptr;
+        }
+
+        void _workerLoop(size_t index) {
+            while(true){
+                _parker.park([this](){ return _queued.load() > 0 || _terminate.load(); });
+                if(_terminate.load()) return;
+
+                std::unique_ptr<Vk_GpuTask> task = _pop(index);
+                // another worker took it first => park again
+                if(!task) continue;
+
+                Vk_GpuTask* pTask = task.get();
+                if(pTask->cachedRecording()){
+                    // miss in Vk_Queue::enqueue => record once into the cache, following enqueues skip this stage
+                    auto* entry = _recordCache->record(pTask->_parentQueue->familyIndex(), pTask->recordFunction(), pTask->_targetOpFamillies, pTask->taskParams());
+                    pTask->passCached(entry);
+                    pTask->skipRecord(std::move(task));
+                    continue;
+                }
+
+                Vk_CommandPoolSegment* segment = nullptr;
+                VkCommandBuffer vkCommandBuffer = _commandPoolRing(index, pTask->_vkDevice, pTask->_parentQueue->familyIndex()).acquire(segment);
+                pTask->passAlloc(vkCommandBuffer, segment);
+                pTask->record(std::move(task));
+            }
+        }
+    };
+}
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iomanip>
+#include <unordered_map>
+#include <set>
+#include <algorithm>
+#include <limits>
+
+#include "../../Defines.h"
+#include "../../utils/Ut_MpscRing.hpp"
+#include "../Vk_PhysicalDeviceQueueLib.hpp"
+
+namespace VK5 {
+    // amount of trace events kept between two Vk_GpuTaskTracer::collect calls. If the ring is full, new events are dropped
+    constexpr size_t GLOBAL_TRACE_RING_CAPACITY = 16384;
+
+    typedef std::chrono::steady_clock::time_point TTraceStamp;
+
+    // CPU side stamps of one submission of a Vk_GpuTask
+    struct Vk_GpuTaskTimes {
+        TTraceStamp enqueued;   // Vk_Queue::enqueue
+        TTraceStamp allocated;  // the record worker has a command buffer (or the record cache had a hit)
+        TTraceStamp recorded;   // handed to the submit stage
+        TTraceStamp submitted;  // vkQueueSubmit returned
+        TTraceStamp finished;   // the completion reactor saw the fence
+    };
+
+    struct Vk_GpuTaskTraceEvent {
+        Vk_GpuOp op;
+        Vk_GpuTaskPriority priority;
+        TQueueFamilyIndex familyIndex;
+        TQueueIndex queueIndex;
+        bool cached;
+        Vk_GpuTaskTimes times;
+        // GPU execution in ns on the GPU clock (vkCmdWriteTimestamp), only set if gpuTimestamps == true
+        bool gpuTimestamps;
+        uint64_t gpuBegin;
+        uint64_t gpuEnd;
+    };
+
+    /**
+     * Per stage tracing of the gpu task pipeline. Once enabled, every submission of a Vk_GpuTask
+     * produces one Vk_GpuTaskTraceEvent with
+     *  - alloc wait: enqueue until the record worker has a command buffer
+     *  - record: recording on the record worker
+     *  - submit wait: waiting in the submit stage of Vk_Queue (batching, priority lanes)
+     *  - gpu: execution on the GPU, from timestamps around the recorded commands
+     *  - completion: end of execution until the completion reactor saw the fence
+     * The completion reactors push the events into a lock free ring, collect drains it. Export with toChromeJson,
+     * the output loads in chrome://tracing and ui.perfetto.dev.
+     * NOTE: cached recordings (Vk_GpuTaskModifier::c) are shared between submissions and have no gpu slice.
+     */
+    class Vk_GpuTaskTracer {
+        std::atomic<bool> _enabled;
+        std::atomic<uint64_t> _dropped;
+        float _timestampPeriod;
+        std::unordered_map<TQueueFamilyIndex, uint32_t> _timestampValidBits;
+        TTraceStamp _epoch;
+        UT::Ut_MpscRing<Vk_GpuTaskTraceEvent> _events;
+
+        // consumer side
+        std::mutex _mutex;
+        std::vector<Vk_GpuTaskTraceEvent> _collected;
+
+    public:
+        Vk_GpuTaskTracer(const TQueueFamilies& queueFamilies, float timestampPeriod)
+        :
+        _enabled(false),
+        _dropped(0),
+        _timestampPeriod(timestampPeriod),
+        _timestampValidBits(_getTimestampValidBits(queueFamilies)),
+        _epoch(std::chrono::steady_clock::now()),
+        _events(GLOBAL_TRACE_RING_CAPACITY)
+        {}
+
+        Vk_GpuTaskTracer(const Vk_GpuTaskTracer& other) = delete;
+        Vk_GpuTaskTracer(Vk_GpuTaskTracer&& other) = delete;
+        Vk_GpuTaskTracer& operator=(const Vk_GpuTaskTracer& other) = delete;
+        Vk_GpuTaskTracer& operator=(Vk_GpuTaskTracer&& other) = delete;
+
+        void enable(bool enabled) { _enabled.store(enabled, std::memory_order_relaxed); }
+        bool enabled() const { return _enabled.load(std::memory_order_relaxed); }
+        uint64_t dropped() const { return _dropped.load(std::memory_order_relaxed); }
+
+        // false if the queue family can't write timestamps (timestampValidBits == 0)
+        bool gpuTimestamps(TQueueFamilyIndex familyIndex) const {
+            auto iter = _timestampValidBits.find(familyIndex);
+            return _timestampPeriod > 0 && iter != _timestampValidBits.end() && iter->second > 0;
+        }
+
+        // raw timestamp query results => ns on the GPU clock
+        uint64_t gpuTicksToNs(TQueueFamilyIndex familyIndex, uint64_t ticks) const {
+            uint32_t validBits = _timestampValidBits.at(familyIndex);
+            if(validBits < 64) ticks &= (uint64_t(1) << validBits) - 1;
+            return static_cast<uint64_t>(static_cast<double>(ticks) * static_cast<double>(_timestampPeriod));
+        }
+
+        // any thread (completion reactors)
+        void push(Vk_GpuTaskTraceEvent& event) {
+            if(!_events.tryPush(event)) _dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // move all events out of the ring. Call this regularly while tracing is enabled, otherwise the ring runs full
+        void collect() {
+            std::lock_guard<std::mutex> lock(_mutex);
+            Vk_GpuTaskTraceEvent event;
+            while(_events.tryPop(event)) _collected.push_back(event);
+        }
+
+        void clear() {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _collected.clear();
+            _dropped.store(0);
+        }
+
+        /**
+         * Chrome trace event format (JSON object with traceEvents). One track per queue for the CPU side stages
+         * and one for the GPU execution.
+         * NOTE: without calibrated timestamps the GPU clock is mapped to the CPU clock with the smallest gap between
+         * the end of a GPU slice and its fence being seen by the completion reactor. GPU slices are therefore placed
+         * at most that gap too late.
+         */
+        void toChromeJson(std::ostream& stream) {
+            collect();
+            std::lock_guard<std::mutex> lock(_mutex);
+
+            std::unordered_map<uint64_t, int64_t> gpuOffsets;
+            for(const auto& e : _collected){
+                if(!e.gpuTimestamps) continue;
+                int64_t offset = _ns(e.times.finished) - static_cast<int64_t>(e.gpuEnd);
+                auto iter = gpuOffsets.find(_queueKey(e));
+                if(iter == gpuOffsets.end()) gpuOffsets.insert({_queueKey(e), offset});
+                else iter->second = std::min(iter->second, offset);
+            }
+
+            stream << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+            bool first = true;
+            std::set<uint64_t> queues;
+            for(const auto& e : _collected){
+                queues.insert(_queueKey(e));
+                int64_t tid = _tid(e);
+                _slice(stream, first, "alloc wait", e, tid, _ns(e.times.enqueued), _ns(e.times.allocated));
+                _slice(stream, first, "record", e, tid, _ns(e.times.allocated), _ns(e.times.recorded));
+                _slice(stream, first, "submit wait", e, tid, _ns(e.times.recorded), _ns(e.times.submitted));
+                int64_t completionBegin = _ns(e.times.submitted);
+                if(e.gpuTimestamps){
+                    int64_t offset = gpuOffsets.at(_queueKey(e));
+                    int64_t gpuBegin = static_cast<int64_t>(e.gpuBegin) + offset;
+                    int64_t gpuEnd = static_cast<int64_t>(e.gpuEnd) + offset;
+                    _slice(stream, first, "gpu", e, tid+1, gpuBegin, gpuEnd);
+                    completionBegin = gpuEnd;
+                }
+                _slice(stream, first, "completion", e, tid, completionBegin, _ns(e.times.finished));
+            }
+            for(uint64_t q : queues){
+                std::string name = std::to_string(q >> 32) + "|" + std::to_string(q & 0xFFFFFFFF);
+                _threadName(stream, first, static_cast<int64_t>(_tid(q)), "queue " + name + " cpu");
+                _threadName(stream, first, static_cast<int64_t>(_tid(q))+1, "queue " + name + " gpu");
+            }
+            stream << "]}";
+        }
+
+        void writeChromeJson(const std::string& path) {
+            std::ofstream file(path);
+            if(!file.is_open()) UT::Ut_Logger::RuntimeError(typeid(this), "Unable to open {0} for the gpu task trace", path);
+            toChromeJson(file);
+        }
+
+    private:
+        static std::unordered_map<TQueueFamilyIndex, uint32_t> _getTimestampValidBits(const TQueueFamilies& queueFamilies) {
+            std::unordered_map<TQueueFamilyIndex, uint32_t> validBits;
+            for(const auto& f : queueFamilies) validBits.insert({f.first, f.second.timestampValidBits});
+            return validBits;
+        }
+
+        static uint64_t _queueKey(const Vk_GpuTaskTraceEvent& e) { return (static_cast<uint64_t>(e.familyIndex) << 32) | e.queueIndex; }
+        // two tracks per queue: cpu stages and gpu execution
+        static int64_t _tid(uint64_t queueKey) { return static_cast<int64_t>(((queueKey >> 32) * 1000 + (queueKey & 0xFFFFFFFF)) * 2); }
+        static int64_t _tid(const Vk_GpuTaskTraceEvent& e) { return _tid(_queueKey(e)); }
+
+        int64_t _ns(TTraceStamp stamp) const { return std::chrono::duration_cast<std::chrono::nanoseconds>(stamp - _epoch).count(); }
+
+        static void _slice(std::ostream& stream, bool& first, const char* name, const Vk_GpuTaskTraceEvent& e, int64_t tid, int64_t begin, int64_t end) {
+            if(end < begin) end = begin;
+            if(!first) stream << ",";
+            first = false;
+            // NOTE: ts and dur are in microseconds
+            stream << std::fixed << std::setprecision(3)
+                   << "{\"name\":\"" << name << "\",\"cat\":\"gpu_task\",\"ph\":\"X\",\"pid\":0,\"tid\":" << tid
+                   << ",\"ts\":" << static_cast<double>(begin) / 1000.0
+                   << ",\"dur\":" << static_cast<double>(end - begin) / 1000.0
+                   << ",\"args\":{\"op\":\"" << Vk_GpuOp2String(e.op) << "\",\"priority\":" << static_cast<int>(e.priority)
+                   << ",\"cached\":" << (e.cached ? "true" : "false") << "}}";
+        }
+
+        static void _threadName(std::ostream& stream, bool& first, int64_t tid, const std::string& name) {
+            if(!first) stream << ",";
+            first = false;
+            stream << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << tid << ",\"args\":{\"name\":\"" << name << "\"}}";
+        }
+    };
+}
@@ -1,60 +1,132 @@
 #pragma once
 
 #include <thread>
-#include <queue>
+#include <atomic>
 #include <set>
+#include <unordered_set>
 #include <condition_variable>
 #include <unordered_map>
 #include <vector>
+#include <functional>
+#include <chrono>
+#include <algorithm>
 
 #include "../../Defines.h"
 #include "../../Vk_CI.hpp"
+#include "../../utils/Ut_MpscRing.hpp"
 #include "../Vk_PhysicalDeviceQueueLib.hpp"
 #include "Vk_GpuTask.hpp"
+#include "Vk_GpuTaskRecordPool.hpp"
+#include "Vk_GpuTaskTrace.hpp"
 
 namespace VK5 {
+    // capacity of the lock free rings between the stages of one Vk_Queue
+    constexpr size_t GLOBAL_QUEUE_RING_CAPACITY = 1024;
+    // amount of unfinished tasks per Vk_Queue before the dispatcher considers it saturated
+    constexpr int64_t GLOBAL_QUEUE_MAX_DEPTH = 256;
+    /**
+     * amount of Vk_GpuTaskPriority::Background tasks one Vk_Queue keeps on the GPU at the same time. The rest waits in the
+     * submit stage, so that more urgent tasks that come in later don't end up behind all of them
+     */
+    constexpr int64_t GLOBAL_QUEUE_BACKGROUND_SLOTS = 2;
+    // how often the submit thread looks at the fences of tasks that wait for them (Vk_GpuTaskModifier::f)
+    constexpr std::chrono::microseconds GLOBAL_QUEUE_HOST_FENCE_POLL = std::chrono::microseconds(250);
+
+    /**
+     * Shared by all Vk_Queue of one logical device. Threads that find all queues saturated wait here,
+     * the completion reactors of the queues wake them up once tasks finish.
+     */
+    struct Vk_QueueBackpressure {
+        std::mutex mutex;
+        std::condition_variable condition;
+        std::atomic<int> waiting {0};
+
+        void notify() {
+            if(waiting.load() == 0) return;
+            {
+                // NOTE: lock once to make sure the waiting thread is either not checking its condition or already waiting
+                std::unique_lock<std::mutex> lock(mutex);
+            }
+            condition.notify_all();
+        }
+    };
+
     class Vk_Queue : public Vk_QueueBase {
     private:
+        /**
+         * Everything that went to the GPU with one vkQueueSubmit and is signaled by one fence.
+         * Tasks with a custom TGpuTaskSubmit function are submitted on their own and use
+         * their own fence (pooledFence == false).
+         */
+        struct Vk_SubmitBatch {
+            VkFence fence;
+            bool pooledFence;
+            std::vector<std::unique_ptr<Vk_GpuTask>> tasks;
+        };
+
         VkDevice _vkDevice;
         TQueueFamilyIndex _familyIndex;
         TQueueIndex _queueIndex;
         VkQueue _vkQueue;
-        VkCommandPool _vkCommandPool;
         TGpuTargetOpFamilies _queueFamilyForTargetOp;
+        Vk_GpuTaskRecordPool* _recordPool;
+        Vk_GpuTaskRecordCache* _recordCache;
+        Vk_QueueBackpressure* _backpressure;
+        Vk_GpuTaskTracer* _tracer;
 
-        bool _terminate;
+        // amount of tasks that were enqueued but are not finished yet
+        std::atomic<int64_t> _depth;
+        // amount of background tasks that are submitted but not finished yet (see GLOBAL_QUEUE_BACKGROUND_SLOTS)
+        std::atomic<int64_t> _backgroundInFlight;
+        std::atomic<bool> _terminate;
+        // set once the submit thread is gone and the queue is idle (see destructor)
+        std::atomic<bool> _stopRunning;
 
         /**
-         * NOTE: the sequence of these variables is important. They are initialized exactly
-         * in the sequence they are written. If _allocFreeThread starts running before _allocFreeCondition
-         * and/or _allocFreeMutex are fully initialized, the whole thing won't work!!!
+         * Timelines of the tasks that were enqueued here but are not submitted yet. The record workers hand the tasks
+         * to the submit stage in any order (work stealing) => a task may get there before a task of this queue it waits for.
          */
-        std::queue<std::unique_ptr<Vk_GpuTask>> _allocTasks;
-        std::queue<VkCommandBuffer> _usedCommandBuffers;
-        std::mutex _allocFreeMutex;
-        std::condition_variable _allocFreeCondition;
-        std::thread _allocFreeThread;
+        std::mutex _unsubmittedMutex;
+        std::unordered_set<VkSemaphore> _unsubmitted;
 
         /**
          * NOTE: the sequence of these variables is important. They are initialized exactly
-         * in the sequence they are written. First, write the queue, then the mutex, then the
-         * condition_variable and at the very end, the thread. This will guarantee, that every
+         * in the sequence they are written. First, write the ring, then the parker
+         * and at the very end, the thread. This will guarantee, that every
          * part has what they need up and running in time.
+         * The record workers hand over tasks through a lock free MPSC ring. The submit
+         * thread only parks (futex) if the ring is empty.
+         * NOTE: there is no alloc/free stage: command buffers come from the command pools
+         * of the record workers (see Vk_CommandPoolRing).
          */
-        std::queue<std::unique_ptr<Vk_GpuTask>> _submitTasks;
-        std::mutex _submitMutex;
-        std::condition_variable _submitCondition;
+        UT::Ut_MpscRing<std::unique_ptr<Vk_GpuTask>> _submitTasks;
+        UT::Ut_Parker _submitParker;
         std::thread _submitThread;
 
+        /**
+         * Completion reactor: one thread per queue that waits on the fences of all tasks
+         * that are currently running on this queue. This keeps the amount of threads constant,
+         * no matter how many tasks are in flight.
+         * NOTE: same as above, the sequence of these variables is important.
+         */
+        std::vector<Vk_SubmitBatch> _runningBatches;
+        std::vector<VkFence> _freeFences;
+        std::mutex _runningMutex;
+        std::condition_variable _runningCondition;
+        std::thread _runningThread;
+        // set on the completion reactor threads of all queues, continuations run there
+        static inline thread_local bool _onCompletionReactor = false;
+
     public:
         // regular constructor
-        Vk_Queue(VkDevice vkDevice, uint32_t familyIndex, uint32_t queueIndex, std::unordered_map<Vk_GpuTargetOp, std::vector<TQueueFamilyIndex>> queueFamilyForTargetOp)
+        Vk_Queue(VkDevice vkDevice, uint32_t familyIndex, uint32_t queueIndex, std::unordered_map<Vk_GpuTargetOp, std::vector<TQueueFamilyIndex>> queueFamilyForTargetOp, Vk_GpuTaskRecordPool* recordPool, Vk_GpuTaskRecordCache* recordCache, Vk_QueueBackpressure* backpressure, Vk_GpuTaskTracer* tracer)
         : 
         _vkDevice(vkDevice), _familyIndex(familyIndex), _queueIndex(queueIndex),
-        _vkQueue(_getDeviceQueue(_vkDevice, _familyIndex, _queueIndex)), _vkCommandPool(_createCommandPool(_vkDevice, _familyIndex)),
-        _queueFamilyForTargetOp(queueFamilyForTargetOp), _terminate(false), 
-        _allocFreeThread(std::thread(&Vk_Queue::_allocFreeLoop, this)),
-        _submitThread(std::thread(&Vk_Queue::_submitLoop, this))
+        _vkQueue(_getDeviceQueue(_vkDevice, _familyIndex, _queueIndex)),
+        _queueFamilyForTargetOp(queueFamilyForTargetOp), _recordPool(recordPool), _recordCache(recordCache), _backpressure(backpressure), _tracer(tracer), _depth(0), _backgroundInFlight(0), _terminate(false), _stopRunning(false), 
+        _submitTasks(GLOBAL_QUEUE_RING_CAPACITY),
+        _submitThread(std::thread(&Vk_Queue::_submitLoop, this)),
+        _runningThread(std::thread(&Vk_Queue::_runningLoop, this))
         {}
 
         Vk_Queue(const Vk_Queue& other) = delete;
@@ -64,28 +136,36 @@ namespace VK5 {
 
         ~Vk_Queue(){
             {
-                std::scoped_lock lock {_allocFreeMutex, _submitMutex };
-                _terminate = true;
+                std::unique_lock<std::mutex> lock(_runningMutex);
+                _terminate.store(true);
             }
             /**
              * NOTE: make sure all the locks are released before notifying!
              */
-            _allocFreeCondition.notify_one();
-            if(_allocFreeThread.joinable()) _allocFreeThread.join();
-            _submitCondition.notify_one();
+            _submitParker.notify();
             if(_submitThread.joinable()) _submitThread.join();
 
+            /**
+             * NOTE: nothing is submitted anymore. Wait for the GPU before the completion reactor stops: it
+             * finishes everything that is still in flight (futures complete, command buffers go back)
+             * and that must not happen while the GPU still uses it.
+             */
             if(_vkQueue != nullptr) vkQueueWaitIdle(_vkQueue);
-            while(!_usedCommandBuffers.empty()){
-                VkCommandBuffer b = _usedCommandBuffers.front();
-                vkFreeCommandBuffers(_vkDevice, _vkCommandPool, 1, &b);
-                _usedCommandBuffers.pop();
+            {
+                std::unique_lock<std::mutex> lock(_runningMutex);
+                _stopRunning.store(true);
             }
-            if(_vkCommandPool != nullptr) vkDestroyCommandPool(_vkDevice, _vkCommandPool, nullptr);
+            _runningCondition.notify_one();
+            if(_runningThread.joinable()) _runningThread.join();
+
+            for(VkFence f : _freeFences) vkDestroyFence(_vkDevice, f, nullptr);
         }
 
         const TQueueFamilyIndex familyIndex() const { return _familyIndex; }
         const TQueueIndex queueIndex() const { return _queueIndex; }
+        const int64_t depth() const { return _depth.load(std::memory_order_relaxed); }
+        // true on the thread that finishes the tasks of a queue: it must never wait for a queue to drain (backpressure)
+        static bool onCompletionReactor() { return _onCompletionReactor; }
 
         std::string toString() const {
             std::stringstream ss;
@@ -96,7 +176,6 @@ namespace VK5 {
         TGpuTaskRunner enqueue(std::unique_ptr<Vk_GpuTask> task){
             TGpuTaskRunner res = nullptr;
             {
-				std::unique_lock<std::mutex> lock(_allocFreeMutex);
                 /**
                  * NOTE: This resetTask is important: it ensures that a task is always in Stage1 synchronously
                  * with the dispatching thread. This ensures that the expression
@@ -107,85 +186,371 @@ namespace VK5 {
                  * until it is returned by a waitResponsively() (and friends). GpuTaskRunner ptrs can't modify a task.
                  */
                 task->resetTask();
+                {
+                    std::lock_guard<std::mutex> lock(_unsubmittedMutex);
+                    _unsubmitted.insert(task->_vkTimeline);
+                }
                 res = reinterpret_cast<TGpuTaskRunner>(task.get());
-                _allocTasks.push(std::move(task));
-			}
-			_allocFreeCondition.notify_one();
+                _depth.fetch_add(1, std::memory_order_relaxed);
+                task->passQueue(this, &_queueFamilyForTargetOp);
+
+                task->_traced = _tracer->enabled();
+                task->_traceGpu = task->_traced && task->recordFunction() != nullptr && !task->cachedRecording() && _tracer->gpuTimestamps(_familyIndex);
+                task->_times = {};
+                task->_stamp(task->_times.enqueued);
+
+                // cached recording: if the same thing was recorded before, go straight to the submit stage
+                if(task->cachedRecording()){
+                    auto* entry = _recordCache->acquire(_familyIndex, task->recordFunction(), task->taskParams());
+                    if(entry != nullptr){
+                        task->passCached(entry);
+                        Vk_GpuTask* pTask = task.get();
+                        pTask->skipRecord(std::move(task));
+                        return res;
+                    }
+                }
+
+                // the record worker that picks the task up allocates the command buffer from its own pools
+                _recordPool->enqueue(std::move(task));
+            }
             return res;
         }
 
     private:
-        void _enqueueFree(VkCommandBuffer commandBuffer){
-            {
-				std::unique_lock<std::mutex> lock(_allocFreeMutex);
-                _usedCommandBuffers.push(commandBuffer);
-			}
+        void _enqueueSubmit(std::unique_ptr<Vk_GpuTask> task){
+            _submitTasks.push(std::move(task));
+            _submitParker.notify();
         }
 
-        void _allocFreeLoop() {
+        void _submitLoop() {
+            // pending keeps the background tasks that didn't get a slot yet across rounds
+            std::vector<std::unique_ptr<Vk_GpuTask>> pending;
+            std::vector<std::unique_ptr<Vk_GpuTask>> ready;
+            // tasks that wait for a task of this queue that didn't reach the submit stage yet. Checked again once new tasks arrive
+            std::vector<std::unique_ptr<Vk_GpuTask>> waiting;
             std::unique_ptr<Vk_GpuTask> cTask = nullptr;
-            VkCommandBuffer vkCommandBuffer;
             while(true){
-                {
-                    auto lock = std::unique_lock<std::mutex>(_allocFreeMutex);
-                    _allocFreeCondition.wait(lock, [this](){
-                        return !_allocTasks.empty() || !_usedCommandBuffers.empty() || _terminate;
-                    });
-                    
-                    if(_terminate){
-                        std::queue<std::unique_ptr<Vk_GpuTask>> empty;
-                        std::swap(_allocTasks, empty);
+                // drain everything that is pending => one vkQueueSubmit for everything that is allowed to go
+                while(_submitTasks.tryPop(cTask)) pending.push_back(std::move(cTask));
+                for(auto& task : waiting) pending.push_back(std::move(task));
+                waiting.clear();
+                _selectReady(pending, ready, waiting);
+
+                if(ready.empty()){
+                    // NOTE: the completion reactor notifies the parker once a background slot is free again
+                    auto wake = [this, &pending](){
+                        return !_submitTasks.empty() || _terminate.load() || (!pending.empty() && _backgroundInFlight.load() < GLOBAL_QUEUE_BACKGROUND_SLOTS);
+                    };
+                    /**
+                     * Nobody notifies about a held back task whose deadline passes (it becomes frame critical and goes without a
+                     * background slot) or about the fences of Vk_GpuTaskModifier::f => wake up for the earliest of those.
+                     */
+                    TGpuTaskDeadline wakeAt = GLOBAL_NO_DEADLINE;
+                    for(const auto& task : pending) wakeAt = std::min(wakeAt, task->taskParams().Deadline);
+                    bool fenceGated = std::any_of(waiting.begin(), waiting.end(), [](const std::unique_ptr<Vk_GpuTask>& task){ return task->hostFences(); });
+                    if(fenceGated) wakeAt = std::min(wakeAt, std::chrono::steady_clock::now() + GLOBAL_QUEUE_HOST_FENCE_POLL);
+                    if(wakeAt != GLOBAL_NO_DEADLINE) _submitParker.parkUntil(wake, wakeAt);
+                    else _submitParker.park(wake);
+                    if(_terminate.load()){
+                        while(_submitTasks.tryPop(cTask)) pending.push_back(std::move(cTask));
+                        for(auto& task : waiting) pending.push_back(std::move(task));
+                        _finishUnsubmitted(pending);
                         return;
                     }
+                    continue;
+                }
+
+                _submitPending(ready);
+                ready.clear();
+            }
+        }
+
+        /**
+         * Move everything that should go to the GPU now from pending to ready, most urgent first:
+         * lane (Vk_GpuTaskPriority), then deadline, then arrival. Tasks past their deadline count as frame critical.
+         * Background tasks only go if one of the GLOBAL_QUEUE_BACKGROUND_SLOTS is free, otherwise they stay in pending.
+         * Large background copies are split into chunks (see Vk_DataBufferLib::copyGpuToGpu), so an urgent task
+         * waits for at most GLOBAL_QUEUE_BACKGROUND_SLOTS chunks.
+         */
+        void _selectReady(std::vector<std::unique_ptr<Vk_GpuTask>>& pending, std::vector<std::unique_ptr<Vk_GpuTask>>& ready, std::vector<std::unique_ptr<Vk_GpuTask>>& waiting) {
+            if(pending.empty()) return;
+
+            // NOTE: tasks whose fences (Vk_GpuTaskModifier::f) are not signaled yet wait, no matter their lane
+            for(auto& task : pending){
+                if(task->gatedByHostFence()) waiting.push_back(std::move(task));
+            }
+            std::erase_if(pending, [](const std::unique_ptr<Vk_GpuTask>& task){ return task == nullptr; });
+            if(pending.empty()) return;
+
+            auto now = std::chrono::steady_clock::now();
+            auto lane = [now](const std::unique_ptr<Vk_GpuTask>& task){
+                const Vk_GpuTaskParams& params = task->taskParams();
+                return params.Deadline <= now ? Vk_GpuTaskPriority::FrameCritical : params.Priority;
+            };
+            std::stable_sort(pending.begin(), pending.end(), [&](const auto& a, const auto& b){
+                Vk_GpuTaskPriority la = lane(a);
+                Vk_GpuTaskPriority lb = lane(b);
+                if(la != lb) return la < lb;
+                return a->taskParams().Deadline < b->taskParams().Deadline;
+            });
+
+            int64_t background = _backgroundInFlight.load();
+            for(auto& task : pending){
+                if(lane(task) == Vk_GpuTaskPriority::Background){
+                    if(background >= GLOBAL_QUEUE_BACKGROUND_SLOTS) continue;
+                    background++;
+                    _takeBackgroundSlot(task.get());
+                }
+                ready.push_back(std::move(task));
+            }
+            std::erase_if(pending, [](const std::unique_ptr<Vk_GpuTask>& task){ return task == nullptr; });
 
-                    // first check, if we have some task that is finished and deposited it's command buffer
-                    // back here.
-                    if(_allocTasks.size() > 0){
-                        if(!_usedCommandBuffers.empty()){
-                            vkCommandBuffer = _usedCommandBuffers.front();
-                            _usedCommandBuffers.pop();
-                        }
-                        else {
-                            // if we don't have a spare command buffer, get one from the pool
-                            // technically, the cost should ammortize, but maybe it doesn't, so reuse rather than get new ones
-                            auto createInfo = Vk_CI::VkCommandBufferAllocateInfo_W(1, _vkCommandPool).data;
-                            Vk_CheckVkResult(typeid(this), vkAllocateCommandBuffers(_vkDevice, &createInfo, &vkCommandBuffer), "Failed to allocate command buffers!");
-                        }
-                        cTask = std::move(_allocTasks.front());
-                        _allocTasks.pop();
+            /**
+             * NOTE: a ready task that waits (Vk_GpuTaskModifier::w) for a held back task of this queue would wait for something
+             * that is submitted after it on the same queue. The held back task goes first instead (priority inheritance).
+             */
+            bool promoted = !pending.empty();
+            while(promoted){
+                promoted = false;
+                for(auto& task : pending){
+                    VkSemaphore timeline = task->_vkTimeline;
+                    bool waitedFor = std::any_of(ready.begin(), ready.end(), [timeline](const std::unique_ptr<Vk_GpuTask>& r){ return r->waitsFor(timeline); });
+                    if(!waitedFor) continue;
+                    _takeBackgroundSlot(task.get());
+                    ready.insert(ready.begin(), std::move(task));
+                    promoted = true;
+                }
+                std::erase_if(pending, [](const std::unique_ptr<Vk_GpuTask>& task){ return task == nullptr; });
+            }
+
+            /**
+             * NOTE: a task that waits for a task of this queue that is still being recorded would be submitted before
+             * its dependency. It goes to waiting until the dependency shows up. Holding one back may hold back its waiters too.
+             */
+            bool heldBack = true;
+            while(heldBack){
+                heldBack = false;
+                for(auto& task : ready){
+                    if(!_waitsForUnsubmitted(*task, ready)) continue;
+                    if(task->_backgroundSlot){
+                        task->_backgroundSlot = false;
+                        _backgroundInFlight.fetch_sub(1);
                     }
+                    waiting.push_back(std::move(task));
+                    heldBack = true;
                 }
-                if(cTask) cTask->passAlloc(std::move(cTask), vkCommandBuffer, this, &_queueFamilyForTargetOp);
+                std::erase_if(ready, [](const std::unique_ptr<Vk_GpuTask>& task){ return task == nullptr; });
             }
+
+            _orderByDependencies(ready);
         }
 
-        void _enqueueSubmit(std::unique_ptr<Vk_GpuTask> task){
+        // task waits for a timeline of this queue that is neither submitted nor in ready
+        bool _waitsForUnsubmitted(const Vk_GpuTask& task, const std::vector<std::unique_ptr<Vk_GpuTask>>& ready) {
+            std::lock_guard<std::mutex> lock(_unsubmittedMutex);
+            for(VkSemaphore semaphore : task.waitSemaphores()){
+                if(semaphore == task._vkTimeline || !_unsubmitted.contains(semaphore)) continue;
+                bool inReady = std::any_of(ready.begin(), ready.end(), [semaphore](const std::unique_ptr<Vk_GpuTask>& r){ return r != nullptr && r->_vkTimeline == semaphore; });
+                if(!inReady) return true;
+            }
+            return false;
+        }
+
+        void _markSubmitted(const Vk_GpuTask& task) {
+            std::lock_guard<std::mutex> lock(_unsubmittedMutex);
+            _unsubmitted.erase(task._vkTimeline);
+        }
+
+        /**
+         * The sort above only knows lanes: a frame critical task that waits for an interactive or background task of the
+         * same batch would end up in front of it. Stable topological pass: every task goes after the tasks of the batch it
+         * waits for, the dependencies move up to their waiter (they inherit its lane), the waiter stays where it is.
+         */
+        void _orderByDependencies(std::vector<std::unique_ptr<Vk_GpuTask>>& ready) {
+            if(ready.size() < 2) return;
+
+            std::vector<std::unique_ptr<Vk_GpuTask>> ordered;
+            ordered.reserve(ready.size());
+            std::function<void(size_t)> place = [&](size_t i){
+                // NOTE: taken out before the recursion => a cycle can't loop forever
+                std::unique_ptr<Vk_GpuTask> task = std::move(ready.at(i));
+                for(size_t j = 0; j < ready.size(); ++j){
+                    if(ready.at(j) != nullptr && task->waitsFor(ready.at(j)->_vkTimeline)) place(j);
+                }
+                ordered.push_back(std::move(task));
+            };
+            for(size_t i = 0; i < ready.size(); ++i){
+                if(ready.at(i) != nullptr) place(i);
+            }
+            ready = std::move(ordered);
+        }
+
+        /**
+         * Terminate: tasks that never went to the GPU finish like the ones that did. Their futures complete, waitResponsively
+         * returns them and _depth goes back down. Their timelines are never signaled => nothing may wait for them on the GPU.
+         */
+        void _finishUnsubmitted(std::vector<std::unique_ptr<Vk_GpuTask>>& tasks) {
+            int64_t backgroundCount = 0;
+            for(auto& t : tasks){
+                Vk_GpuTask* task = t.get();
+                if(task->_backgroundSlot) backgroundCount++;
+                task->_backgroundSlot = false;
+                _markSubmitted(*task);
+                task->finish(std::move(t));
+            }
+            int64_t finishedCount = static_cast<int64_t>(tasks.size());
+            tasks.clear();
+            if(backgroundCount > 0) _backgroundInFlight.fetch_sub(backgroundCount);
+            if(finishedCount > 0){
+                _depth.fetch_sub(finishedCount, std::memory_order_relaxed);
+                _backpressure->notify();
+            }
+        }
+
+        void _takeBackgroundSlot(Vk_GpuTask* task) {
+            task->_backgroundSlot = true;
+            _backgroundInFlight.fetch_add(1);
+        }
+
+        void _submitPending(std::vector<std::unique_ptr<Vk_GpuTask>>& pending) {
+            Vk_SubmitBatch batch { .fence = nullptr, .pooledFence = true, .tasks = {} };
+            std::vector<VkSubmitInfo> submitInfos;
+            submitInfos.reserve(pending.size());
+
+            for(auto& task : pending){
+                if(!task->batchable()){
+                    // custom submit functions go on their own with the task fence
+                    task->submit(_vkQueue);
+                    _markSubmitted(*task);
+                    Vk_SubmitBatch single { .fence = task->_vkFence, .pooledFence = false, .tasks = {} };
+                    single.tasks.push_back(std::move(task));
+                    _enqueueRunning(std::move(single));
+                    continue;
+                }
+
+                // waits for the dependencies and signals the task timeline
+                submitInfos.push_back(task->submitInfo());
+                batch.tasks.push_back(std::move(task));
+            }
+
+            if(batch.tasks.empty()) return;
+
+            batch.fence = _acquireFence();
+            VkResult res = vkQueueSubmit(_vkQueue, static_cast<uint32_t>(submitInfos.size()), submitInfos.data(), batch.fence);
+            Vk_CheckVkResult(typeid(this), res, "Failed to submit batch of {0} tasks to queue {1}", submitInfos.size(), toString());
+            for(auto& task : batch.tasks){
+                _markSubmitted(*task);
+                task->submitted();
+            }
+            _enqueueRunning(std::move(batch));
+        }
+
+        VkFence _acquireFence() {
+            VkFence fence = nullptr;
             {
-				std::unique_lock<std::mutex> lock(_submitMutex);
-                _submitTasks.push(std::move(task));
-			}
-			_submitCondition.notify_one();
+                std::unique_lock<std::mutex> lock(_runningMutex);
+                if(!_freeFences.empty()){
+                    fence = _freeFences.back();
+                    _freeFences.pop_back();
+                }
+            }
+            if(fence == nullptr){
+                VkFenceCreateInfo fenceInfo { VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
+                Vk_CheckVkResult(typeid(this), vkCreateFence(_vkDevice, &fenceInfo, nullptr, &fence), "Failed to create batch fence");
+            }
+            else {
+                Vk_CheckVkResult(typeid(this), vkResetFences(_vkDevice, 1, &fence), "Failed to reset batch fence");
+            }
+            return fence;
         }
 
-        void _submitLoop() {
-            std::unique_ptr<Vk_GpuTask> cTask = nullptr;
+        void _enqueueRunning(Vk_SubmitBatch batch){
+            {
+                std::unique_lock<std::mutex> lock(_runningMutex);
+                _runningBatches.push_back(std::move(batch));
+            }
+            _runningCondition.notify_one();
+        }
+
+        void _runningLoop() {
+            _onCompletionReactor = true;
+            std::vector<Vk_SubmitBatch> inFlight;
+            std::vector<Vk_SubmitBatch> finished;
+            std::vector<VkFence> fences;
             while(true){
                 {
-                    auto lock = std::unique_lock<std::mutex>(_submitMutex);
-                    _submitCondition.wait(lock, [this](){
-                        return !_submitTasks.empty() || _terminate;
-                    });
-                    
-                    if(_terminate){
-                        std::queue<std::unique_ptr<Vk_GpuTask>> empty;
-                        std::swap(_submitTasks, empty);
-                        return;
+                    auto lock = std::unique_lock<std::mutex>(_runningMutex);
+                    // only sleep if there is nothing to wait for on the GPU
+                    if(inFlight.empty()){
+                        _runningCondition.wait(lock, [this](){
+                            return !_runningBatches.empty() || _stopRunning;
+                        });
+                    }
+
+                    // pick up everything that was submitted since the last round
+                    for(auto& b : _runningBatches) inFlight.push_back(std::move(b));
+                    _runningBatches.clear();
+                }
+
+                if(_stopRunning){
+                    // the queue is idle at this point (see destructor) => everything in flight is done
+                    _finishBatches(inFlight);
+                    return;
+                }
+
+                fences.clear();
+                for(const auto& b : inFlight) fences.push_back(b.fence);
+
+                // wait for any of the fences. The timeout is short on purpose: batches that are submitted
+                // while we wait here are only picked up in the next round.
+                VkResult res = vkWaitForFences(_vkDevice, static_cast<uint32_t>(fences.size()), fences.data(), VK_FALSE, GLOBAL_FENCE_TIMEOUT);
+                if(res == VK_TIMEOUT) continue;
+                else if(res != VK_SUCCESS) UT::Ut_Logger::RuntimeError(typeid(this), "Signal catastrophic result!");
+
+                // more than one fence may be signaled at this point => collect all of them
+                for(auto& b : inFlight){
+                    if(vkGetFenceStatus(_vkDevice, b.fence) == VK_SUCCESS) finished.push_back(std::move(b));
+                }
+                std::erase_if(inFlight, [](const Vk_SubmitBatch& b){ return b.tasks.empty(); });
+                _finishBatches(finished);
+            }
+        }
+
+        /**
+         * NOTE: finish runs the continuations and releases the command buffers. No locks of the
+         * completion reactor are held at this point.
+         */
+        void _finishBatches(std::vector<Vk_SubmitBatch>& finished) {
+            int64_t finishedCount = 0;
+            int64_t backgroundCount = 0;
+            for(auto& b : finished){
+                for(auto& t : b.tasks){
+                    Vk_GpuTask* task = t.get();
+                    if(task->_backgroundSlot) backgroundCount++;
+                    task->_backgroundSlot = false;
+                    if(task->_traced){
+                        Vk_GpuTaskTraceEvent event = task->traceEvent(*_tracer, _familyIndex, _queueIndex);
+                        _tracer->push(event);
                     }
-                    
-                    cTask = std::move(_submitTasks.front());
-                    _submitTasks.pop();
+                    task->finish(std::move(t));
+                    finishedCount++;
                 }
-                if(cTask) cTask->submit(std::move(cTask), _vkQueue);
+                if(b.pooledFence){
+                    std::unique_lock<std::mutex> lock(_runningMutex);
+                    _freeFences.push_back(b.fence);
+                }
+            }
+            finished.clear();
+
+            if(backgroundCount > 0){
+                // held back background tasks may go now
+                _backgroundInFlight.fetch_sub(backgroundCount);
+                _submitParker.notify();
+            }
+
+            if(finishedCount > 0){
+                _depth.fetch_sub(finishedCount, std::memory_order_relaxed);
+                _backpressure->notify();
             }
         }
 
@@ -195,13 +560,5 @@ namespace VK5 {
             vkGetDeviceQueue(vkDevice, familyIndex, queueIndex, &vkQueue);
             return vkQueue;
         }
-
-        VkCommandPool _createCommandPool(VkDevice vkDevice, TQueueFamilyIndex familyIndex) {
-            VkCommandPool vkCommandPool;
-            // create command pool for the device graphics queue
-            auto cmCreateInfo = Vk_CI::VkCommandPoolCreateInfo_W(familyIndex).data;
-            Vk_CheckVkResult(typeid(NoneObj), vkCreateCommandPool(_vkDevice, &cmCreateInfo, nullptr, &vkCommandPool), std::string("Unable to create command pool for queue ") + Vk_Queue::toString());
-            return vkCommandPool;
-        }
     };
 }
\ No newline at end of file
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <mutex>
+#include <shared_mutex>
+#include <typeinfo>
+
+#include "../Defines.h"
+#include "Vk_DataBufferLib.hpp"
+
+namespace VK5 {
+	// default block size of Vk_ChunkedDataBuffer
+	constexpr std::uint64_t GLOBAL_DATA_CHUNK_SIZE = 4ull*1024ull*1024ull;
+
+	/**
+	 * Device local data buffer that grows by appending fixed size blocks instead of reallocating. Growing costs
+	 * O(new data): nothing that is already on the GPU is copied and memory never doubles during a resize. If a new
+	 * block doesn't fit into device memory, only that block fails (OutOfDeviceMemoryException) and all data
+	 * uploaded so far stays where it is.
+	 * Every block holds a whole number of elements, so the renderer binds and draws block by block:
+	 *    for(const auto& r : buffer.bindRanges()){
+	 *        vkCmdBindVertexBuffers(cmd, 0, 1, &r.buffer, &r.offset);
+	 *        vkCmdDraw(cmd, r.count, 1, 0, 0);
+	 *    }
+	 * NOTE: sparse binding would give one VkBuffer for all blocks, but needs the sparseBinding feature and a queue
+	 * with VK_QUEUE_SPARSE_BINDING_BIT, neither of which Vk_PhysicalDevice asks for. The block list works everywhere.
+	 */
+	template<typename TStructureType>
+	class Vk_ChunkedDataBuffer {
+	public:
+		struct BindRange {
+			VkBuffer buffer;
+			VkDeviceSize offset;
+			// global index of the first element in the block
+			uint32_t firstElement;
+			uint32_t count;
+		};
+
+	private:
+		Vk_GpuTargetOp _gpuTargetOp;
+		Vk_PhysicalDevice* _physicalDevice;
+		std::string _objName;
+		std::string _associatedObject;
+		Vk_DataBufferLib::BufferType _type;
+		size_t _blockCount;
+		size_t _count;
+		std::shared_mutex _localMutex;
+
+		std::vector<VkBuffer> _blocks;
+		std::vector<VkDeviceMemory> _blockMemory;
+		// copies of the last update, blocks are only destroyed once they are done
+		Vk_GpuFuture _pendingUpdate;
+
+	public:
+		Vk_ChunkedDataBuffer(
+			Vk_PhysicalDevice* physicalDevice,
+			const std::string& associatedObject,
+			const TStructureType* pStructuredData,
+			size_t count,
+			std::string objName = "",
+			std::uint64_t blockByteSize = GLOBAL_DATA_CHUNK_SIZE,
+			Vk_GpuTargetOp gpuTargetOp = Vk_GpuTargetOp::Auto
+		)
+			:
+			_gpuTargetOp(gpuTargetOp),
+			_physicalDevice(physicalDevice),
+			_objName(objName + "[" + std::string(typeid(TStructureType).name()) + "]"),
+			_associatedObject("(=" + associatedObject + "=)"),
+			_type(Vk_DataBufferLib::getInitBufferType<TStructureType>()),
+			_blockCount(std::max<size_t>(1, static_cast<size_t>(blockByteSize / sizeof(TStructureType)))),
+			_count(0),
+			_blocks({}),
+			_blockMemory({}),
+			_pendingUpdate()
+		{
+			UT::Ut_Logger::Log(typeid(this), UT::GlobalCasters::castConstructorTitle(
+				Vk_Lib::formatWithObjName(_objName, (std::string("Create Chunked Data Buffer ") + std::string(typeid(TStructureType).name()) + _associatedObject))));
+			if(pStructuredData != nullptr && count > 0) update(pStructuredData, count, 0).wait();
+		}
+
+		Vk_ChunkedDataBuffer(const Vk_ChunkedDataBuffer& other) = delete;
+		Vk_ChunkedDataBuffer(Vk_ChunkedDataBuffer&& other) = delete;
+		Vk_ChunkedDataBuffer& operator=(const Vk_ChunkedDataBuffer& other) = delete;
+		Vk_ChunkedDataBuffer& operator=(Vk_ChunkedDataBuffer&& other) = delete;
+
+		~Vk_ChunkedDataBuffer() {
+			UT::Ut_Logger::Log(typeid(this), UT::GlobalCasters::castDestructorTitle(Vk_Lib::formatWithObjName(_objName, (std::string("Destroy Chunked Data Buffer ") + std::string(typeid(TStructureType).name()) + _associatedObject))));
+			_pendingUpdate.wait();
+			_physicalDevice->destroyBuffers(std::move(_blocks), std::move(_blockMemory));
+		}
+
+		/*
+		* Get the current count of elements in the buffer
+		*/
+		size_t bufferCount() {
+			auto lock = std::shared_lock<std::shared_mutex>(_localMutex);
+			return _count;
+		}
+
+		/*
+		* Get the amount of elements the allocated blocks can hold
+		*/
+		size_t maxBufferCount() {
+			auto lock = std::shared_lock<std::shared_mutex>(_localMutex);
+			return _blocks.size() * _blockCount;
+		}
+
+		// elements per block
+		size_t blockCount() const { return _blockCount; }
+
+		/*
+		* One entry per block that holds data, in element order. The last one is only partially used.
+		*/
+		std::vector<BindRange> bindRanges() {
+			auto lock = std::shared_lock<std::shared_mutex>(_localMutex);
+			std::vector<BindRange> ranges;
+			for(size_t b=0; b*_blockCount < _count; ++b){
+				ranges.push_back({
+					.buffer = _blocks.at(b),
+					.offset = 0,
+					.firstElement = static_cast<uint32_t>(b*_blockCount),
+					.count = static_cast<uint32_t>(std::min(_blockCount, _count - b*_blockCount))
+				});
+			}
+			return ranges;
+		}
+
+		/*
+		* Same semantics as Vk_DataBuffer::update: structuredData holds newCount elements in total and [newFrom, newTo)
+		* is copied (newTo == 0 means newCount). Missing blocks are appended first, none of the existing data moves.
+		* Returns once everything is staged and enqueued, the future completes once the data is on the GPU.
+		* Waits for the copies of the previous update first.
+		*/
+		Vk_GpuFuture update(
+			const TStructureType* structuredData,
+			size_t newCount,
+			size_t newFrom,
+			size_t newTo=0
+		) {
+			auto lock = std::lock_guard<std::shared_mutex>(_localMutex);
+			_pendingUpdate.wait();
+			if(newTo == 0) newTo = newCount;
+			if(newFrom > newTo || newTo > newCount){
+				UT::Ut_Logger::RuntimeError(typeid(this), "Update of object {0}-{1} failed: [{2}, {3}) is not inside the {4} new elements", _objName, _associatedObject, newFrom, newTo, newCount);
+			}
+
+			while(_blocks.size() * _blockCount < newCount) _appendBlock();
+			_count = newCount;
+
+			std::vector<Vk_GpuFuture> copies;
+			std::uint64_t blockByteSize = static_cast<std::uint64_t>(_blockCount * sizeof(TStructureType));
+			for(size_t b = newFrom / _blockCount; b*_blockCount < newTo; ++b){
+				size_t blockBegin = b*_blockCount;
+				// shift the data so that the element indices inside the block are the source and the target offset at the same time
+				Vk_DataBufferLib::StructuredData<TStructureType> blockData {.count=newCount - blockBegin, .data=structuredData + blockBegin};
+				size_t from = std::max(newFrom, blockBegin) - blockBegin;
+				size_t to = std::min(newTo, blockBegin + _blockCount) - blockBegin;
+				copies.push_back(Vk_DataBufferLib::copyDataToBufferWithStagingAsync(_physicalDevice, _type, _blocks.at(b), blockByteSize, blockData, from, to, _objName, _associatedObject));
+			}
+			_pendingUpdate = Vk_GpuFuture::when_all(copies);
+			return _pendingUpdate;
+		}
+
+		/*
+		* Free the blocks that hold no data anymore. Waits for the copies of the last update.
+		*/
+		void shrinkToFit() {
+			auto lock = std::lock_guard<std::shared_mutex>(_localMutex);
+			_pendingUpdate.wait();
+			size_t used = (_count + _blockCount - 1) / _blockCount;
+			while(_blocks.size() > used){
+				_physicalDevice->destroyBuffer(_blocks.back(), _blockMemory.back());
+				_blocks.pop_back();
+				_blockMemory.pop_back();
+			}
+		}
+
+	private:
+		void _appendBlock() {
+			VkBuffer block;
+			VkDeviceMemory blockMemory;
+			std::uint64_t blockByteSize = static_cast<std::uint64_t>(_blockCount * sizeof(TStructureType));
+			Vk_DataBufferLib::createDeviceLocalBuffer(_physicalDevice, _type, block, blockMemory, blockByteSize, Vk_DataBufferLib::Usage::Both, _gpuTargetOp);
+			_blocks.push_back(block);
+			_blockMemory.push_back(blockMemory);
+		}
+	};
+}
@@ -3,14 +3,29 @@
 #include <mutex>
 #include <typeinfo>
 #include <atomic>
+#include <chrono>
 
 #include "../Defines.h"
+#include "../utils/Ut_BlockDiff.hpp"
 #include "Vk_DataBufferLib.hpp"
 
 namespace VK5 {
+	// granularity of the diff in Vk_DataBuffer::updateDelta
+	constexpr size_t GLOBAL_DELTA_BLOCK_SIZE = 256;
 
 	template<typename TStructureType>
-	class Vk_DataBuffer {
+	class Vk_DataBuffer : public Vk_MemoryBudgetClient, public Vk_RelocatableClient {
+		// buffer replaced by relocate, demote or promote, destroyed once marked and fence is signaled
+		struct Retired {
+			VkBuffer buffer;
+			VkDeviceMemory memory;
+			// fence of a frame submitted after the replacement (markInFlight), that frame's fence covers all earlier ones
+			VkFence fence;
+			bool marked;
+			// completes once the buffer isn't handed out by vk_buffer anymore
+			Vk_GpuFuture replaced;
+		};
+
 		Vk_GpuTargetOp _gpuTargetOp;
 		Vk_PhysicalDevice* _physicalDevice;
 		std::vector<TStructureType> _cpuDataBuffer;
@@ -26,25 +41,60 @@ namespace VK5 {
 		std::atomic_int32_t _bufferIndex;
 		std::vector<VkBuffer> _buffer;
 		std::vector<VkDeviceMemory> _bufferMemory;
+		// last updateAsync, the double and ring buffering strategies flip _bufferIndex once it is complete (_pendingFlip)
+		Vk_GpuFuture _pendingUpdate;
+		/**
+		* Slot _bufferIndex switches to once _pendingUpdate is complete, -1 if none. Applied by the next call that holds
+		* _localMutex (_applyFlip), never on the completion reactor: all flips happen under the lock.
+		*/
+		int32_t _pendingFlip;
+		// relocate with a single buffer: replaces _buffer.at(0) once _pendingUpdate is complete, same as _pendingFlip
+		VkBuffer _pendingBuffer;
+		VkDeviceMemory _pendingBufferMemory;
+		// collected by markDirty, uploaded by flush
+		std::vector<Vk_DataBufferLib::Range> _dirtyRanges;
+
+		// *_RingBuffering only
+		size_t _ringSlots;
+		// *_RingBuffering and Staged_DoubleBuffering: fence of the last frame that draws from the slot (markInFlight), VK_NULL_HANDLE if none
+		std::vector<VkFence> _slotFences;
+		// *_RingBuffering and Staged_DoubleBuffering: ranges written into other slots since the slot was written the last time
+		std::vector<std::vector<Vk_DataBufferLib::Range>> _slotStaleRanges;
+		// Direct_RingBuffering: persistently mapped memory of each slot
+		std::vector<char*> _slotMapped;
+
+		// updateDelta: the data as of the last updateDelta. Empty if some other update came in between
+		std::vector<TStructureType> _deltaShadow;
+
+		// readbackAsync: persistently mapped readback buffer, created on first use and grown with the buffer
+		VkBuffer _readbackBuffer;
+		VkDeviceMemory _readbackMemory;
+		const char* _readbackMapped;
+		std::uint64_t _readbackSize;
+		bool _readbackCoherent;
+		Vk_GpuFuture _pendingReadback;
+
+		// steady clock ticks of the last markDrawn or markInFlight
+		std::atomic<std::uint64_t> _lastUse;
+		// Staged_*: the buffers live in host visible memory because device local memory ran out (see demote)
+		bool _demoted;
+		std::vector<Retired> _retired;
 	public:
 		Vk_DataBuffer(
-			/**
-			 * TODO:Vk_GpuTargetOp - add this param to Vk_DataBuffer and adjust all instantiations (Graphics or Compute)
-			 * Vk_GpuTargetOp bufferTargetOp,
-			 */
 			Vk_PhysicalDevice* physicalDevice,
 			const std::string& associatedObject,
 			const TStructureType* pStructuredData,
 			size_t count,
 			Vk_BufferUpdateBehaviour updateBehaviour,
 			Vk_BufferSizeBehaviour sizeBehaviour,
-			std::string objName = ""
+			std::string objName = "",
+			// amount of buffers for the *_RingBuffering update behaviours, ignored otherwise
+			size_t ringSlots = GLOBAL_BUFFER_RING_SLOTS,
+			// queue family that uses the buffer, Auto shares it between all of them (see Vk_PhysicalDevice::createAndAllocBuffer)
+			Vk_GpuTargetOp gpuTargetOp = Vk_GpuTargetOp::Auto
 		)
 			:
-			/**
-			 * TODO:Vk_GpuTargetOp - remove default value here
-			 */
-			_gpuTargetOp(Vk_GpuTargetOp::Auto),
+			_gpuTargetOp(gpuTargetOp),
 			_physicalDevice(physicalDevice),
 			_cpuDataBuffer({}),
 			_count(count),
@@ -56,18 +106,51 @@ namespace VK5 {
 			_associatedObject("(=" + associatedObject + "=)"),
 			_bufferIndex(0),
 			_buffer({}),
-			_bufferMemory({})
+			_bufferMemory({}),
+			_pendingUpdate(),
+			_pendingFlip(-1),
+			_pendingBuffer(VK_NULL_HANDLE),
+			_pendingBufferMemory(VK_NULL_HANDLE),
+			_dirtyRanges({}),
+			_ringSlots(std::max<size_t>(ringSlots, 2)),
+			_slotFences({}),
+			_slotStaleRanges({}),
+			_slotMapped({}),
+			_deltaShadow({}),
+			_readbackBuffer(VK_NULL_HANDLE),
+			_readbackMemory(VK_NULL_HANDLE),
+			_readbackMapped(nullptr),
+			_readbackSize(0),
+			_readbackCoherent(true),
+			_pendingReadback(),
+			_lastUse(_now()),
+			_demoted(false),
+			_retired({})
 		{
 			UT::Ut_Logger::Log(typeid(this), UT::GlobalCasters::castConstructorTitle(
 				Vk_Lib::formatWithObjName(_objName, (std::string("Create Vertex Buffer ") + std::string(typeid(TStructureType).name()) + _associatedObject))));
 
 			Vk_DataBufferLib::checkAsserts(_objName, bufferCount());
 			_createDataBufferForUpdateStrategy(Vk_DataBufferLib::StructuredData<TStructureType>{.count=count, .data=pStructuredData});
+			// Direct_* buffers are host visible anyways
+			if(!_isDirect()){
+				_physicalDevice->memoryBudget().addClient(this);
+				_physicalDevice->defragmenter().addClient(this);
+			}
 		}
 
 		~Vk_DataBuffer() {
 			UT::Ut_Logger::Log(typeid(this), UT::GlobalCasters::castDestructorTitle(Vk_Lib::formatWithObjName(_objName, (std::string("Destroy Vertex Buffer ") + std::string(typeid(TStructureType).name()) + _associatedObject))));
-			_physicalDevice->logicalDevice().destroyBuffers(std::move(_buffer), std::move(_bufferMemory));
+			// first: waits for a demote on another thread
+			_physicalDevice->memoryBudget().removeClient(this);
+			_physicalDevice->defragmenter().removeClient(this);
+			// the continuation of an async update still references this buffer. A relocated buffer takes over its slot first
+			_waitForPendingUpdate();
+			_pendingReadback.wait();
+			_destroyReadbackBuffer();
+			_unmapSlots();
+			for(Retired& r : _retired) _physicalDevice->destroyBuffer(r.buffer, r.memory);
+			_physicalDevice->destroyBuffers(std::move(_buffer), std::move(_bufferMemory));
 		}
 
 		/*
@@ -75,8 +158,8 @@ namespace VK5 {
 		* This will return a pointer to the current buffer
 		*/
 		VkBuffer vk_buffer() {
-			// _bufferIndex is an atomic. It will always point to an existing entry
-			// of _buffer
+			auto lock = std::lock_guard<std::shared_mutex>(_localMutex);
+			_applyFlip();
 			return _buffer.at(_bufferIndex);
 		}
 
@@ -118,6 +201,7 @@ namespace VK5 {
 		*/
 		void resize(size_t newCount) {
 			auto lock = std::lock_guard<std::shared_mutex>(_localMutex);
+			_waitForPendingUpdate();
 			_resizeDataBufferForUpdateStrategy(newCount, _count);
 		}
 
@@ -150,13 +234,31 @@ namespace VK5 {
 		/*
 		* Write the data of the GPU buffer into a CPU size vector and return a pointer
 		* to the CPU sized buffer. Call vk_clearCpuBuffer() to clear the CPU sized data vector.
+		* This is readbackAsync of everything plus a wait.
 		*/
 		const std::vector<TStructureType>& getData() {
 			auto lock = std::lock_guard<std::shared_mutex>(_localMutex);
+			_waitForPendingUpdate();
 			_getDataToCpu();
 			return _cpuDataBuffer;
 		}
 		
+		/*
+		* Copy the elements [from, to) from the GPU into target (resized to to - from). Returns right after the copy
+		* is enqueued, target is filled once the future is complete. target must outlive the future.
+		* The data goes through a persistently mapped, host cached readback buffer of this data buffer, nothing is
+		* allocated per call. A readback waits for the previous one and for a pending async update of this buffer.
+		* NOTE: the copy into target runs on the completion reactor of the transfer queue.
+		*/
+		Vk_GpuFuture readbackAsync(size_t from, size_t to, std::vector<TStructureType>& target) {
+			auto lock = std::lock_guard<std::shared_mutex>(_localMutex);
+			if(from > to || to > _count){
+				UT::Ut_Logger::RuntimeError(typeid(this), "Readback of object {0}-{1} failed: [{2}, {3}) is not inside the {4} elements of the buffer", _objName, _associatedObject, from, to, _count);
+			}
+			target.resize(to - from);
+			return _readbackAsync(from, to, target.data());
+		}
+
 		/*
 		* Clear the CPU sided vector. Note: this will not clear the GPU sided memory.
 		*/
@@ -233,8 +335,8 @@ namespace VK5 {
 		* The total update duration [us] is returned.
 		* For the two 'GlobalLock' update strategies, the update is completely synchronized.
 		* For all other update strategies, the update goes into the currently not used buffer or a newly
-		* allocated one that is later switched (lazy). The switch is performed inside the draw method
-		* after a vk_rebuildAndRedraw() call on the viewer.
+		* allocated one that is later switched (lazy). The switch is performed under the local lock, at the latest
+		* by the next vk_buffer() call.
 		*/
 		int64_t update(
 			const TStructureType* structuredData,
@@ -244,12 +346,264 @@ namespace VK5 {
 		) {
 			auto lock = std::lock_guard<std::shared_mutex>(_localMutex);
 			auto t1 = std::chrono::high_resolution_clock::now();
+			_waitForPendingUpdate();
+			_deltaShadow.clear();
 			_updateDataBufferForUpdateStrategy({.count=newCount, .data=structuredData}, newFrom, newTo);
 			auto t2 = std::chrono::high_resolution_clock::now();
 			auto diff = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
 			return diff;
 		}
 
+		/*
+		* Same semantics as update, but returns as soon as the data is in staging memory and the GPU copy
+		* is enqueued. structuredData may be changed or freed right after the call.
+		* The returned future completes once the new data is visible through vk_buffer():
+		*  * Staged_DoubleBuffering: the copy goes into the back buffer once no frame draws from it anymore (markInFlight),
+		*    _bufferIndex flips on the first vk_buffer (or other call) after the copy is done.
+		*  * Staged_GlobalLock: the copy goes into the only buffer. Don't draw from it until the future is complete.
+		*  * Direct_GlobalLock: the data is written directly, the returned future is already complete.
+		* Only one async update is in flight per buffer: the next update (async or not) waits for the previous
+		* one's copy first. A resize (newCount > maxBufferCount()) is still synchronous.
+		*/
+		Vk_GpuFuture updateAsync(
+			const TStructureType* structuredData,
+			size_t newCount,
+			size_t newFrom,
+			size_t newTo=0
+		) {
+			auto lock = std::lock_guard<std::shared_mutex>(_localMutex);
+			_waitForPendingUpdate();
+
+			_deltaShadow.clear();
+			Vk_DataBufferLib::StructuredData<TStructureType> data {.count=newCount, .data=structuredData};
+			if(!_prepareUpdateForUpdateStrategy(data, newFrom, newTo)) return Vk_GpuFuture();
+			_pendingUpdate = _copyDataToBufferForUpdateStrategyAsync(data, newFrom, newTo);
+			_count = newCount;
+			return _pendingUpdate;
+		}
+
+		/*
+		* The frame that is signaled by frameFence draws from buffer (a value of vk_buffer()). Call this after every submit
+		* of a frame that uses the buffer.
+		* *_RingBuffering: updates don't write into that buffer until the fence is signaled.
+		* All behaviours: buffers replaced by relocate, demote or promote are destroyed once the fence of a frame
+		* submitted after the replacement is signaled. Without markInFlight they are kept until the buffer is destroyed.
+		* NOTE: don't reset frameFence before it's submitted again: an unsignaled fence keeps the slot busy.
+		*/
+		void markInFlight(VkBuffer buffer, VkFence frameFence) {
+			auto lock = std::lock_guard<std::shared_mutex>(_localMutex);
+			_lastUse = _now();
+			_applyFlip();
+			_releaseRetired();
+			_physicalDevice->markInFlight(buffer, frameFence);
+			for(Retired& r : _retired){
+				if(!r.replaced.ready()) continue;
+				r.fence = frameFence;
+				r.marked = true;
+			}
+			auto iter = std::find(_buffer.begin(), _buffer.end(), buffer);
+			if(iter == _buffer.end() || _slotFences.empty()) return;
+			_slotFences.at(static_cast<size_t>(iter - _buffer.begin())) = frameFence;
+		}
+
+		/*
+		* The buffer was drawn from. Under memory pressure the least recently drawn buffers leave device local memory first.
+		* markInFlight does this too.
+		*/
+		void markDrawn() {
+			_lastUse = _now();
+		}
+
+		std::uint64_t lastUse() const override {
+			return _lastUse.load();
+		}
+
+		/*
+		* True if the buffers are in host visible memory instead of device local memory
+		*/
+		bool isDemoted() {
+			auto lock = std::shared_lock<std::shared_mutex>(_localMutex);
+			return _demoted;
+		}
+
+		/**
+		* Called by Vk_MemoryBudget: move all buffers to host visible memory. The GPU keeps drawing from them, only slower.
+		* Gives up (returns 0) if the buffer is busy on another thread. Never called for the buffer that allocates (see Vk_MemoryBudgetAllocatingScope).
+		* NOTE: like the ones of relocate, the old buffers are retired until no frame draws from them (see markInFlight).
+		*/
+		std::uint64_t demote() override {
+			auto lock = std::unique_lock<std::shared_mutex>(_localMutex, std::try_to_lock);
+			if(!lock.owns_lock() || _demoted || _isDirect()) return 0;
+			_demoted = true;
+			UT::Ut_Logger::Warn(typeid(this), "Memory budget exceeded: moving buffer {0} to host visible memory", (_objName + _associatedObject));
+			return _moveBuffers();
+		}
+
+		/*
+		* Move demoted buffers back to device local memory, for example once Vk_MemoryBudget::available has room again.
+		* Buffers that don't fit stay in host visible memory.
+		*/
+		void promote() {
+			auto lock = std::lock_guard<std::shared_mutex>(_localMutex);
+			if(!_demoted) return;
+			_demoted = false;
+			if(_moveBuffers() < _buffer.size() * _maxBufferByteSize()) _demoted = true;
+		}
+
+		/**
+		* Called by Vk_Defragmenter: recreate buffer in a new allocation. The current buffer is never touched:
+		* its data is copied into a new buffer that replaces a back buffer (buffer itself if it isn't the current one),
+		* _bufferIndex flips to it once the copy is done. Updates wait for the copy like for any other pending update.
+		* The replaced buffer is retired until releaseRetired finds it unused (see markInFlight).
+		* *_GlobalLock have nothing to flip to and swap the buffer once the copy is done. Never blocks,
+		* returns 0 while an earlier copy is pending.
+		*/
+		std::uint64_t relocate(VkBuffer buffer) override {
+			auto lock = std::unique_lock<std::shared_mutex>(_localMutex, std::try_to_lock);
+			if(!lock.owns_lock() || !_pendingUpdate.ready() || !_pendingReadback.ready()) return 0;
+			_applyFlip();
+			auto iter = std::find(_buffer.begin(), _buffer.end(), buffer);
+			if(iter == _buffer.end()) return 0;
+
+			std::uint64_t dataSize = static_cast<std::uint64_t>(_bufferByteSize());
+			std::uint64_t maxSize = static_cast<std::uint64_t>(_maxBufferByteSize());
+			VkBuffer newBuffer = VK_NULL_HANDLE;
+			VkDeviceMemory newBufferMemory = VK_NULL_HANDLE;
+			try {
+				_createGpuBuffer(newBuffer, newBufferMemory, maxSize);
+			}
+			catch (const OutOfDeviceMemoryException&) {
+				return 0;
+			}
+
+			std::string nn = "#Relocate#" + _objName + _associatedObject;
+			size_t current = static_cast<size_t>(_bufferIndex.load());
+			if(_buffer.size() == 1){
+				// the new buffer takes over once the copy is done, under the lock (_applyFlip)
+				VkBuffer oldBuffer = _buffer.at(0);
+				VkDeviceMemory oldBufferMemory = _bufferMemory.at(0);
+				Vk_GpuFuture copied;
+				if(dataSize > 0) copied = Vk_DataBufferLib::copyGpuToGpu(_physicalDevice, nn, oldBuffer, maxSize, newBuffer, maxSize, dataSize, 0, 0, Vk_GpuTaskPriority::Background);
+				_pendingUpdate = copied;
+				_pendingBuffer = newBuffer;
+				_pendingBufferMemory = newBufferMemory;
+				_retired.push_back({.buffer = oldBuffer, .memory = oldBufferMemory, .fence = VK_NULL_HANDLE, .marked = false, .replaced = _pendingUpdate});
+				return maxSize;
+			}
+
+			size_t slot = static_cast<size_t>(iter - _buffer.begin());
+			size_t target = slot != current ? slot : (current + 1) % _buffer.size();
+			// a ring slot knows the last frame that drew from it, a double buffer's back buffer has to wait for the next frame
+			bool ring = _isRingBuffering();
+			_retired.push_back({.buffer = _buffer.at(target), .memory = _bufferMemory.at(target), .fence = ring ? _slotFences.at(target) : VK_NULL_HANDLE, .marked = ring, .replaced = Vk_GpuFuture()});
+			// the new buffer gets the complete current data
+			if(ring) _slotFences.at(target) = VK_NULL_HANDLE;
+			if(!_slotStaleRanges.empty()) _slotStaleRanges.at(target).clear();
+			_unmapSlots();
+			_buffer.at(target) = newBuffer;
+			_bufferMemory.at(target) = newBufferMemory;
+			_mapSlots();
+
+			Vk_GpuFuture copied;
+			if(dataSize > 0) copied = Vk_DataBufferLib::copyGpuToGpu(_physicalDevice, nn, _buffer.at(current), maxSize, newBuffer, maxSize, dataSize, 0, 0, Vk_GpuTaskPriority::Background);
+			_pendingUpdate = copied;
+			_pendingFlip = static_cast<int32_t>(target);
+			return maxSize;
+		}
+
+		void releaseRetired() override {
+			auto lock = std::unique_lock<std::shared_mutex>(_localMutex, std::try_to_lock);
+			if(!lock.owns_lock()) return;
+			_releaseRetired();
+		}
+
+		// _localMutex must be locked
+		void _releaseRetired() {
+			VkDevice lDev = _physicalDevice->vk_logicalDevice();
+			std::erase_if(_retired, [&](Retired& r){
+				if(!r.replaced.ready() || !r.marked) return false;
+				if(r.fence != VK_NULL_HANDLE && vkGetFenceStatus(lDev, r.fence) != VK_SUCCESS) return false;
+				_physicalDevice->destroyBuffer(r.buffer, r.memory);
+				return true;
+			});
+		}
+
+		/*
+		* Register [from, to) (in elements) as changed. Nothing is copied until flush.
+		*/
+		void markDirty(size_t from, size_t to) {
+			auto lock = std::lock_guard<std::shared_mutex>(_localMutex);
+			if(to > from) _dirtyRanges.push_back({.from=from, .to=to});
+		}
+
+		/*
+		* Upload all ranges registered with markDirty since the last flush from structuredData (newCount elements
+		* in total, same as update). Overlapping and nearby ranges are merged first (GLOBAL_DIRTY_RANGE_MERGE_GAP),
+		* all of them go into the staging ring together and are copied with one vkCmdCopyBuffer with one
+		* VkBufferCopy region per merged range.
+		* Like updateAsync, this returns once the copy is enqueued and the returned future completes
+		* once the data is visible through vk_buffer().
+		*/
+		Vk_GpuFuture flush(const TStructureType* structuredData, size_t newCount) {
+			auto lock = std::lock_guard<std::shared_mutex>(_localMutex);
+			_waitForPendingUpdate();
+
+			size_t mergeGapCount = static_cast<size_t>(GLOBAL_DIRTY_RANGE_MERGE_GAP / sizeof(TStructureType));
+			std::vector<Vk_DataBufferLib::Range> ranges = Vk_DataBufferLib::coalesceRanges(std::move(_dirtyRanges), mergeGapCount);
+			_dirtyRanges.clear();
+			for(auto& r : ranges) r.to = std::min(r.to, newCount);
+			std::erase_if(ranges, [](const Vk_DataBufferLib::Range& r){ return r.to <= r.from; });
+			if(ranges.empty()) return Vk_GpuFuture();
+
+			_deltaShadow.clear();
+			Vk_DataBufferLib::StructuredData<TStructureType> data {.count=newCount, .data=structuredData};
+			size_t newTo = ranges.back().to;
+			if(!_prepareUpdateForUpdateStrategy(data, ranges.front().from, newTo)) return Vk_GpuFuture();
+			_pendingUpdate = _copyRangesToBufferForUpdateStrategyAsync(data, ranges);
+			_count = newCount;
+			return _pendingUpdate;
+		}
+
+		/*
+		* Upload only what changed since the last updateDelta. structuredData (newCount elements in total) is
+		* compared with a CPU copy of the last upload in blocks of GLOBAL_DELTA_BLOCK_SIZE bytes (see UT::Ut_BlockDiff),
+		* the changed blocks are uploaded like flush does it. Uploaded bytes scale with the change, not with the
+		* buffer size. Elements beyond the last count are always uploaded.
+		* NOTE: the copy costs memory of the size of the data on the CPU side. The first updateDelta and the first
+		* one after any other kind of update upload everything.
+		*/
+		Vk_GpuFuture updateDelta(const TStructureType* structuredData, size_t newCount) {
+			auto lock = std::lock_guard<std::shared_mutex>(_localMutex);
+			_waitForPendingUpdate();
+
+			std::vector<Vk_DataBufferLib::Range> ranges;
+			size_t compareCount = std::min(_deltaShadow.size(), newCount);
+			auto spans = UT::Ut_BlockDiff::diff(_deltaShadow.data(), structuredData, compareCount * sizeof(TStructureType), GLOBAL_DELTA_BLOCK_SIZE);
+			for(const auto& span : spans){
+				// round out to whole elements
+				ranges.push_back({.from=span.from / sizeof(TStructureType), .to=(span.to + sizeof(TStructureType) - 1) / sizeof(TStructureType)});
+			}
+			if(newCount > compareCount) ranges.push_back({.from=compareCount, .to=newCount});
+
+			_deltaShadow.resize(newCount);
+			for(const auto& r : ranges) std::copy(structuredData + r.from, structuredData + r.to, _deltaShadow.begin() + r.from);
+			if(ranges.empty()){
+				_count = newCount;
+				return Vk_GpuFuture();
+			}
+
+			Vk_DataBufferLib::StructuredData<TStructureType> data {.count=newCount, .data=structuredData};
+			size_t newTo = ranges.back().to;
+			if(!_prepareUpdateForUpdateStrategy(data, ranges.front().from, newTo)){
+				_deltaShadow.clear();
+				return Vk_GpuFuture();
+			}
+			size_t mergeGapCount = static_cast<size_t>(GLOBAL_DIRTY_RANGE_MERGE_GAP / sizeof(TStructureType));
+			_pendingUpdate = _copyRangesToBufferForUpdateStrategyAsync(data, Vk_DataBufferLib::coalesceRanges(std::move(ranges), mergeGapCount));
+			_count = newCount;
+			return _pendingUpdate;
+		}
+
 	private:
 		size_t _getNextMaxCount(size_t oldMaxCount) {
 			return Vk_DataBufferLib::getNextMaxCount(_sizeBehaviour, oldMaxCount);
@@ -286,34 +640,68 @@ namespace VK5 {
 			std::uint64_t dataSize = static_cast<std::uint64_t>(_bufferByteSize());
 			std::uint64_t maxSize = static_cast<std::uint64_t>(_maxBufferByteSize());
 
+			_unmapSlots();
+			// all slots copy at the same time, the old buffers are retired like the ones of relocate (see markInFlight)
+			std::vector<Vk_GpuFuture> copies;
+			bool ring = _isRingBuffering();
 			for(int i=0; i<_buffer.size(); ++i){
 				VkBuffer newBuffer = nullptr;
 				VkDeviceMemory newBufferMemory = nullptr;
 				try {
 					VkBuffer buf = _buffer.at(i);
 					VkDeviceMemory mem = _bufferMemory.at(i);
-					Vk_DataBufferLib::createDeviceLocalBuffer(_physicalDevice, _type, newBuffer, newBufferMemory, maxSize, Vk_DataBufferLib::Usage::Both, _gpuTargetOp);
+					_createGpuBuffer(newBuffer, newBufferMemory, maxSize);
 					std::string nn = "#Resize#" + _objName + _associatedObject;
-					Vk_DataBufferLib::copyGpuToGpu(_physicalDevice, nn, buf, oldMaxSize, newBuffer, maxSize, dataSize);
-					_physicalDevice->logicalDevice().destroyBuffer(buf, mem);
+					// background: a large resize must not hold up the small updates that frames wait for
+					copies.push_back(Vk_DataBufferLib::copyGpuToGpu(_physicalDevice, nn, buf, oldMaxSize, newBuffer, maxSize, dataSize, 0, 0, Vk_GpuTaskPriority::Background));
+					_retired.push_back({.buffer = buf, .memory = mem, .fence = ring ? _slotFences.at(i) : VK_NULL_HANDLE, .marked = ring, .replaced = Vk_GpuFuture()});
+					if(ring) _slotFences.at(i) = VK_NULL_HANDLE;
 					_buffer.at(i) = newBuffer;
 					_bufferMemory.at(i) = newBufferMemory;
 				}
 				catch (const OutOfDeviceMemoryException&) {
 					Vk_DataBufferLib::deviceLocalMemoryOverflowMessage(_physicalDevice, _objName, maxSize);
+					_physicalDevice->destroyBuffer(newBuffer, newBufferMemory);
+					if(!_demoted && !_isDirect()){
+						// the remaining buffers grow in host visible memory instead, nothing has to go through the cpu
+						_demoted = true;
+						--i;
+						continue;
+					}
 					// copy to cpu first, remove old buffer and then copy back
-					_physicalDevice->logicalDevice().destroyBuffer(newBuffer, newBufferMemory);
+					Vk_GpuFuture::when_all(copies).wait();
 					_getDataToCpu();
-					_physicalDevice->logicalDevice().destroyBuffers(std::move(_buffer), std::move(_bufferMemory));
+					_physicalDevice->destroyBuffers(std::move(_buffer), std::move(_bufferMemory));
 					_createDataBufferForUpdateStrategy(Vk_DataBufferLib::StructuredData{.count=_cpuDataBuffer.size(), .data=_cpuDataBuffer.data()});
+					return;
 				}
 			}
+			// resize is synchronous: the new buffers are handed out by vk_buffer right after this
+			Vk_GpuFuture::when_all(copies).wait();
+			_mapSlots();
+			// ring slots that no frame draws from go right away
+			_releaseRetired();
 		}
 
 		void _updateDataBufferForUpdateStrategy(
 			const Vk_DataBufferLib::StructuredData<TStructureType>& structuredData,
 			size_t newFrom,
 			size_t newTo
+		) {
+			if(!_prepareUpdateForUpdateStrategy(structuredData, newFrom, newTo)) return;
+			_copyDataToBufferForUpdateStrategy(structuredData, newFrom, newTo);
+
+			_count = structuredData.count;
+		}
+
+		/**
+		* Checks and resize before the data of an update is copied. Returns false if there is nothing to update.
+		* newTo == 0 is replaced by structuredData.count.
+		*/
+		bool _prepareUpdateForUpdateStrategy(
+			const Vk_DataBufferLib::StructuredData<TStructureType>& structuredData,
+			size_t newFrom,
+			size_t& newTo
 		) {
 			size_t newDataCount = structuredData.count - newFrom;
 			std::uint64_t offsetSize = static_cast<std::uint64_t>(newFrom * sizeof(TStructureType));
@@ -321,7 +709,7 @@ namespace VK5 {
 
 			if(newDataSize < sizeof(TStructureType)){
 				UT::Ut_Logger::Error(typeid(this), "Update of object {0}-{1} failed: data size is {2} byte but must be greater than {3} byte!", _objName, _associatedObject, newDataSize, sizeof(TStructureType));
-				return;
+				return false;
 			}
 
 			size_t newMaxCount;
@@ -336,30 +724,69 @@ namespace VK5 {
 			if(newTo == 0){
 				newTo = structuredData.count;
 			}
-			_copyDataToBufferForUpdateStrategy(structuredData, newFrom, newTo);
-
-			_count = structuredData.count;
+			return true;
 		}
 
+		// _localMutex must be locked
 		void _getDataToCpu() {
-			std::uint64_t bs = bufferByteSize();
+			_cpuDataBuffer.clear();
+			_cpuDataBuffer.resize(_bufferCount());
+			_readbackAsync(0, _bufferCount(), _cpuDataBuffer.data()).wait();
+		}
 
-			// create host buffer to copy all necessary data into cpu accessible memory, lets call it stagingBuffer
-			VkBuffer stagingBuffer;
-			VkDeviceMemory stagingBufferMemory;
-			Vk_DataBufferLib::createStagingBuffer(_physicalDevice, _type, stagingBuffer, stagingBufferMemory, bs, Vk_DataBufferLib::Usage::Destination, _gpuTargetOp);
+		// _localMutex must be locked
+		Vk_GpuFuture _readbackAsync(size_t from, size_t to, TStructureType* target) {
+			_pendingReadback.wait();
+			_waitForPendingUpdate();
+			if(from == to) return Vk_GpuFuture();
+			_createReadbackBuffer();
 
-			// copy data to staging buffer from non-cpu accessible vertex buffer
-			// free memory afterwards
-			std::string nn = "#Get" + _objName + _associatedObject;
-			Vk_DataBufferLib::copyGpuToGpu(_physicalDevice, nn, _buffer.at(_bufferIndex), bs, stagingBuffer, bs, bs);
+			std::uint64_t byteFrom = static_cast<std::uint64_t>(from * sizeof(TStructureType));
+			std::uint64_t byteSize = static_cast<std::uint64_t>((to - from) * sizeof(TStructureType));
+			// cached recording: periodic readbacks of the same range reuse the command buffer
+			Vk_GpuFuture copied = Vk_DataBufferLib::_copyGpuToGpuTask(
+				_physicalDevice, _buffer.at(_bufferIndex), _readbackBuffer, byteSize, byteFrom, byteFrom,
+				Vk_GpuTaskPriority::Interactive, true, Vk_GpuTaskLib::Vk_CopyGpuToGpu::recordForHost);
 
-			// map memory into variable to actually use it
-			_cpuDataBuffer.clear();
-			_cpuDataBuffer.resize(bufferCount());
-			Vk_DataBufferLib::copyGpuToCpu(_physicalDevice, stagingBufferMemory, _cpuDataBuffer.data(), bs);
+			VkDevice lDev = _physicalDevice->vk_logicalDevice();
+			VkDeviceMemory memory = _readbackMemory;
+			const char* mapped = _readbackMapped;
+			bool coherent = _readbackCoherent;
+			_pendingReadback = copied.then([lDev, memory, mapped, coherent, byteFrom, byteSize, target](){
+				if(!coherent){
+					VkMappedMemoryRange range = { VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE };
+					range.memory = memory;
+					range.offset = 0;
+					range.size = VK_WHOLE_SIZE;
+					vkInvalidateMappedMemoryRanges(lDev, 1, &range);
+				}
+				memcpy(static_cast<void*>(target), mapped + byteFrom, byteSize);
+			});
+			return _pendingReadback;
+		}
+
+		// (re)create the readback buffer if it's smaller than the data buffer. No readback may be in flight
+		void _createReadbackBuffer() {
+			std::uint64_t maxSize = static_cast<std::uint64_t>(_maxBufferByteSize());
+			if(_readbackSize >= maxSize) return;
+			_destroyReadbackBuffer();
 
-			_physicalDevice->logicalDevice().destroyBuffer(stagingBuffer, stagingBufferMemory);
+			// NOTE: Auto: only the host reads it, the copies into it may come from any family
+			_readbackCoherent = Vk_DataBufferLib::createReadbackBuffer(_physicalDevice, _type, _readbackBuffer, _readbackMemory, maxSize, Vk_GpuTargetOp::Auto);
+			void* data;
+			Vk_CheckVkResult(typeid(this), vkMapMemory(_physicalDevice->vk_logicalDevice(), _readbackMemory, 0, VK_WHOLE_SIZE, 0, &data), "Unable to map readback buffer");
+			_readbackMapped = static_cast<const char*>(data);
+			_readbackSize = maxSize;
+		}
+
+		void _destroyReadbackBuffer() {
+			if(_readbackBuffer == VK_NULL_HANDLE) return;
+			vkUnmapMemory(_physicalDevice->vk_logicalDevice(), _readbackMemory);
+			_physicalDevice->destroyBuffer(_readbackBuffer, _readbackMemory);
+			_readbackBuffer = VK_NULL_HANDLE;
+			_readbackMemory = VK_NULL_HANDLE;
+			_readbackMapped = nullptr;
+			_readbackSize = 0;
 		}
 
 		void _createDataBufferForUpdateStrategy(const Vk_DataBufferLib::StructuredData<TStructureType>& structuredData) {
@@ -377,6 +804,10 @@ namespace VK5 {
 			// free memory afterwards
 			if (structuredData.data != nullptr) {
 				Vk_DataBufferLib::copyDataToBufferWithStaging(_physicalDevice, _type, _buffer.at(_bufferIndex), _maxBufferByteSize(), structuredData, 0, _bufferCount(), _objName, _associatedObject);
+				// the other slots catch up with their first update
+				for(size_t i=0; i<_slotStaleRanges.size(); ++i){
+					if(i != static_cast<size_t>(_bufferIndex)) _slotStaleRanges.at(i).push_back({.from=0, .to=_bufferCount()});
+				}
 			}
 		}
 
@@ -385,7 +816,7 @@ namespace VK5 {
 				// create one real buffer in non-cpu accessible memory
 				VkBuffer lBuffer;
 				VkDeviceMemory lBufferMemory;
-				Vk_DataBufferLib::createDeviceLocalBuffer(_physicalDevice, _type, lBuffer, lBufferMemory, maxSize, Vk_DataBufferLib::Usage::Both, _gpuTargetOp);
+				_createGpuBuffer(lBuffer, lBufferMemory, maxSize);
 				_buffer.push_back(lBuffer);
 				_bufferMemory.push_back(lBufferMemory);
 			}
@@ -404,19 +835,33 @@ namespace VK5 {
 				for(int i=0; i<2; ++i){
 					VkBuffer lBuffer;
 					VkDeviceMemory lBufferMemory;
-					Vk_DataBufferLib::createDeviceLocalBuffer(_physicalDevice, _type, lBuffer, lBufferMemory, maxSize, Vk_DataBufferLib::Usage::Both, _gpuTargetOp);
+					_createGpuBuffer(lBuffer, lBufferMemory, maxSize);
 					_buffer.push_back(lBuffer);
 					_bufferMemory.push_back(lBufferMemory);
 				}
+				_slotFences.assign(2, VK_NULL_HANDLE);
+				_slotStaleRanges.assign(2, {});
 			}
 			else if(_updateBehaviour == Vk_BufferUpdateBehaviour::Direct_GlobalLock){
 				// create one real _buffer in cpu-accessible memory
 				VkBuffer lBuffer;
 				VkDeviceMemory lBufferMemory;
-				Vk_DataBufferLib::createDeviceLocalCPUAccessibleBuffer(_physicalDevice, _type, lBuffer, lBufferMemory, maxSize, Vk_DataBufferLib::Usage::Both, _gpuTargetOp);
+				_createGpuBuffer(lBuffer, lBufferMemory, maxSize);
 				_buffer.push_back(lBuffer);
 				_bufferMemory.push_back(lBufferMemory);
 			}
+			else if(_updateBehaviour == Vk_BufferUpdateBehaviour::Staged_RingBuffering || _updateBehaviour == Vk_BufferUpdateBehaviour::Direct_RingBuffering){
+				for(size_t i=0; i<_ringSlots; ++i){
+					VkBuffer lBuffer;
+					VkDeviceMemory lBufferMemory;
+					_createGpuBuffer(lBuffer, lBufferMemory, maxSize);
+					_buffer.push_back(lBuffer);
+					_bufferMemory.push_back(lBufferMemory);
+				}
+				_slotFences.assign(_ringSlots, VK_NULL_HANDLE);
+				_slotStaleRanges.assign(_ringSlots, {});
+				_mapSlots();
+			}
 			// else if(_updateBehaviour == Vk_BufferUpdateBehaviour::Direct_DoubleBuffering){
 			// 	for(int i=0; i<2; ++i){
 			// 		VkBuffer lBuffer;
@@ -431,42 +876,13 @@ namespace VK5 {
 			}
 		}
 
-		void flipIndex(){
-			// Try to lock the localMutex to avoid a potential wait time. There should be no danger
-			// of a deadlock here
-			// if(_localMutex.try_lock()){
-				// if we manage to get the lock, flip the buffer index...
-				_bufferIndex = (this->_bufferIndex+1)%2; 
-			// 	_localMutex.unlock();
-			// }
-			// else {
-			// 	// ...otherwise, add the flip function to the device updates one more time
-			// 	if(attempts == 0) return;
-
-			// 	// try "attempts" times to flip the buffer. If it doesn't work, re-enqueue the
-			// 	// flip command. Note: this is not recursion. It's adding one lambda function to a queue
-			// 	// using the **up-to-date** _bufferIndex
-			// 	_physicalDevice->bridge.addUpdateForNextFrame(
-			// 		[this, &attempts](){ 
-			// 			if(_localMutex.try_lock()){
-			// 				this->_bufferIndex = (this->_bufferIndex+1)%2; 
-			// 				_localMutex.unlock();
-			// 			}
-			// 			else{
-			// 				flipIndex(attempts - 1);
-			// 			}
-			// 		}
-			// 	);
-			// }
-		}
-
 		void flipIndexAndErase(){
 			if(_bufferIndex == 1){
 				std::cout << "lol" << std::endl;
 			}
 			int oldInd = _bufferIndex;
 			// Note: this can take some time...
-			_physicalDevice->logicalDevice().destroyBuffer(buffer.at(oldInd), _bufferMemory.at(oldInd));
+			_physicalDevice->destroyBuffer(buffer.at(oldInd), _bufferMemory.at(oldInd));
 			_buffer.at(oldInd) = nullptr;
 			_bufferMemory.at(oldInd) = nullptr;
 			_bufferIndex = (_bufferIndex+1)%2; 
@@ -507,19 +923,24 @@ namespace VK5 {
 				// this one must be global lock because we copy data during a rendering process
 				// which changes data that the rendering commands access during drawing
 				auto lock = AcquireGlobalWriteLock("Vk_DataBuffer[_copyDataToBufferForUpdateStrategy]");
-				Vk_DataBufferLib::copyDataToBufferWithStaging(_physicalDevice, _type, _buffer.at(0), maxBufferSize(), structuredData, from, to, _objName, _associatedObject);
+				Vk_DataBufferLib::copyDataToBufferWithStaging(_physicalDevice, _type, _buffer.at(0), _maxBufferByteSize(), structuredData, from, to, _objName, _associatedObject);
 			}
 			else if(_updateBehaviour == Vk_BufferUpdateBehaviour::Direct_GlobalLock){
 				// this one must be global lock because we copy data during a rendering process
 				// which changes data that the rendering commands access during drawing
 				auto lock = AcquireGlobalWriteLock("Vk_DataBuffer[_copyDataToBufferForUpdateStrategy]");
-				Vk_DataBufferLib::copyDataToBufferDirect(_physicalDevice, _type, _bufferMemory.at(0), maxBufferSize(), structuredData, from, to, _objName, _associatedObject);
+				Vk_DataBufferLib::copyDataToBufferDirect(_physicalDevice, _type, _bufferMemory.at(0), _maxBufferByteSize(), structuredData, from, to, _objName, _associatedObject);
 			}
 			else if(_updateBehaviour == Vk_BufferUpdateBehaviour::Staged_DoubleBuffering){
-				// copy to not used buffer and then flip them inside a synchronized bridge update
-				// the update function is globally synched, so no need for mutexes here apart from the local one
-				Vk_DataBufferLib::copyDataToBufferWithStaging(_physicalDevice, _type, _buffer.at((_bufferIndex+1)%2), maxBufferSize(), structuredData, from, to, _objName, _associatedObject);
-				_physicalDevice->bridge.addUpdateForNextFrame( [this](){ this->flipIndex(); });
+				// copy to the not used buffer and flip right away, the copy is done and _localMutex is held (same as _applyFlip)
+				size_t backIndex = static_cast<size_t>((_bufferIndex+1)%2);
+				_waitForSlot(backIndex);
+				for(const auto& r : _takeSlotRanges(backIndex, structuredData, {{.from=from, .to=to}}))
+					Vk_DataBufferLib::copyDataToBufferWithStaging(_physicalDevice, _type, _buffer.at(backIndex), _maxBufferByteSize(), structuredData, r.from, r.to, _objName, _associatedObject);
+				_bufferIndex = static_cast<int32_t>(backIndex);
+			}
+			else if(_isRingBuffering()){
+				_copyRangesToRingSlotAsync(structuredData, {{.from=from, .to=to}}).wait();
 			}
 			// else if(_updateBehaviour == Vk_BufferUpdateBehaviour::Direct_DoubleBuffering){
 			// 	// copy to not used buffer and then flip them inside a synchronized bridge update
@@ -547,5 +968,217 @@ namespace VK5 {
 				UT::Ut_Logger::RuntimeError(typeid(this), "Unknown update behaviour strategy {0}", Vk_BufferUpdateBehaviourToString(_updateBehaviour));
 			}
 		}
+
+		Vk_GpuFuture _copyDataToBufferForUpdateStrategyAsync(const Vk_DataBufferLib::StructuredData<TStructureType>& structuredData, size_t from, size_t to){
+			if(_updateBehaviour == Vk_BufferUpdateBehaviour::Staged_GlobalLock){
+				return Vk_DataBufferLib::copyDataToBufferWithStagingAsync(_physicalDevice, _type, _buffer.at(0), _maxBufferByteSize(), structuredData, from, to, _objName, _associatedObject);
+			}
+			else if(_updateBehaviour == Vk_BufferUpdateBehaviour::Direct_GlobalLock){
+				Vk_DataBufferLib::copyDataToBufferDirect(_physicalDevice, _type, _bufferMemory.at(0), _maxBufferByteSize(), structuredData, from, to, _objName, _associatedObject);
+				return Vk_GpuFuture();
+			}
+			else if(_updateBehaviour == Vk_BufferUpdateBehaviour::Staged_DoubleBuffering){
+				return _copyRangesToBackBufferAsync(structuredData, {{.from=from, .to=to}});
+			}
+			else if(_isRingBuffering()){
+				return _copyRangesToRingSlotAsync(structuredData, {{.from=from, .to=to}});
+			}
+			UT::Ut_Logger::RuntimeError(typeid(this), "Unknown update behaviour strategy {0}", Vk_BufferUpdateBehaviourToString(_updateBehaviour));
+			return Vk_GpuFuture();
+		}
+
+		Vk_GpuFuture _copyRangesToBufferForUpdateStrategyAsync(const Vk_DataBufferLib::StructuredData<TStructureType>& structuredData, const std::vector<Vk_DataBufferLib::Range>& ranges){
+			if(_updateBehaviour == Vk_BufferUpdateBehaviour::Staged_GlobalLock){
+				return Vk_DataBufferLib::copyRangesToBufferWithStagingAsync(_physicalDevice, _type, _buffer.at(0), _maxBufferByteSize(), structuredData, ranges, _objName, _associatedObject);
+			}
+			else if(_updateBehaviour == Vk_BufferUpdateBehaviour::Direct_GlobalLock){
+				for(const auto& r : ranges) Vk_DataBufferLib::copyDataToBufferDirect(_physicalDevice, _type, _bufferMemory.at(0), _maxBufferByteSize(), structuredData, r.from, r.to, _objName, _associatedObject);
+				return Vk_GpuFuture();
+			}
+			else if(_updateBehaviour == Vk_BufferUpdateBehaviour::Staged_DoubleBuffering){
+				return _copyRangesToBackBufferAsync(structuredData, ranges);
+			}
+			else if(_isRingBuffering()){
+				return _copyRangesToRingSlotAsync(structuredData, ranges);
+			}
+			UT::Ut_Logger::RuntimeError(typeid(this), "Unknown update behaviour strategy {0}", Vk_BufferUpdateBehaviourToString(_updateBehaviour));
+			return Vk_GpuFuture();
+		}
+
+		static std::uint64_t _now() {
+			return static_cast<std::uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+		}
+
+		bool _isDirect() const {
+			return _updateBehaviour == Vk_BufferUpdateBehaviour::Direct_GlobalLock || _updateBehaviour == Vk_BufferUpdateBehaviour::Direct_RingBuffering;
+		}
+
+		// Direct_*: host visible memory, device local if possible. Staged_*: device local memory unless demoted
+		void _createGpuBuffer(VkBuffer& buffer, VkDeviceMemory& memory, std::uint64_t maxSize) {
+			// _localMutex is locked, the memory budget must not demote this buffer
+			Vk_MemoryBudgetAllocatingScope allocating(this);
+			if(_isDirect())
+				Vk_DataBufferLib::createDeviceLocalCPUAccessibleBuffer(_physicalDevice, _type, buffer, memory, maxSize, Vk_DataBufferLib::Usage::Both, _gpuTargetOp);
+			else if(_demoted)
+				Vk_DataBufferLib::createHostBuffer(_physicalDevice, _type, buffer, memory, maxSize, Vk_DataBufferLib::Usage::Both, _gpuTargetOp);
+			else
+				Vk_DataBufferLib::createDeviceLocalBuffer(_physicalDevice, _type, buffer, memory, maxSize, Vk_DataBufferLib::Usage::Both, _gpuTargetOp);
+		}
+
+		/**
+		* _localMutex must be locked. Recreate every buffer with _createGpuBuffer (same size) and copy the data over.
+		* Stops at the first buffer that doesn't fit, that one and the rest stay where they are.
+		* The old buffers are retired like the ones of relocate. Returns the amount of bytes that were moved.
+		*/
+		std::uint64_t _moveBuffers() {
+			_waitForPendingUpdate();
+			_pendingReadback.wait();
+			std::uint64_t dataSize = static_cast<std::uint64_t>(_bufferByteSize());
+			std::uint64_t maxSize = static_cast<std::uint64_t>(_maxBufferByteSize());
+			std::uint64_t moved = 0;
+			for(size_t i=0; i<_buffer.size(); ++i){
+				VkBuffer newBuffer = VK_NULL_HANDLE;
+				VkDeviceMemory newBufferMemory = VK_NULL_HANDLE;
+				try {
+					_createGpuBuffer(newBuffer, newBufferMemory, maxSize);
+				}
+				catch (const OutOfDeviceMemoryException&) {
+					break;
+				}
+				std::string nn = "#Move#" + _objName + _associatedObject;
+				if(dataSize > 0) Vk_DataBufferLib::copyGpuToGpu(_physicalDevice, nn, _buffer.at(i), maxSize, newBuffer, maxSize, dataSize, 0, 0, Vk_GpuTaskPriority::Background).wait();
+				bool ring = _isRingBuffering();
+				_retired.push_back({.buffer = _buffer.at(i), .memory = _bufferMemory.at(i), .fence = ring ? _slotFences.at(i) : VK_NULL_HANDLE, .marked = ring, .replaced = Vk_GpuFuture()});
+				if(ring) _slotFences.at(i) = VK_NULL_HANDLE;
+				_buffer.at(i) = newBuffer;
+				_bufferMemory.at(i) = newBufferMemory;
+				moved += maxSize;
+			}
+			// ring slots that no frame draws from go right away
+			_releaseRetired();
+			return moved;
+		}
+
+		bool _isRingBuffering() const {
+			return _updateBehaviour == Vk_BufferUpdateBehaviour::Staged_RingBuffering || _updateBehaviour == Vk_BufferUpdateBehaviour::Direct_RingBuffering;
+		}
+
+		void _mapSlots() {
+			if(_updateBehaviour != Vk_BufferUpdateBehaviour::Direct_RingBuffering) return;
+			VkDevice lDev = _physicalDevice->vk_logicalDevice();
+			_slotMapped.clear();
+			for(VkDeviceMemory memory : _bufferMemory){
+				void* data;
+				Vk_CheckVkResult(typeid(this), vkMapMemory(lDev, memory, 0, VK_WHOLE_SIZE, 0, &data), "Unable to map ring buffer slot");
+				_slotMapped.push_back(static_cast<char*>(data));
+			}
+		}
+
+		void _unmapSlots() {
+			VkDevice lDev = _physicalDevice->vk_logicalDevice();
+			for(size_t i=0; i<_slotMapped.size(); ++i) vkUnmapMemory(lDev, _bufferMemory.at(i));
+			_slotMapped.clear();
+		}
+
+		/**
+		* Next slot after the current one that no frame in flight draws from. The current slot is never used:
+		* the next frame may be recorded with it any time. If all others are busy, wait for the one after the current.
+		*/
+		size_t _acquireRingSlot() {
+			VkDevice lDev = _physicalDevice->vk_logicalDevice();
+			size_t current = static_cast<size_t>(_bufferIndex.load());
+			for(size_t i=1; i<_ringSlots; ++i){
+				size_t slot = (current + i) % _ringSlots;
+				VkFence fence = _slotFences.at(slot);
+				if(fence == VK_NULL_HANDLE || vkGetFenceStatus(lDev, fence) == VK_SUCCESS){
+					_slotFences.at(slot) = VK_NULL_HANDLE;
+					return slot;
+				}
+			}
+			size_t slot = (current + 1) % _ringSlots;
+			_waitForSlot(slot);
+			return slot;
+		}
+
+		// block until the last frame that draws from slot is done (markInFlight)
+		void _waitForSlot(size_t slot) {
+			VkFence& fence = _slotFences.at(slot);
+			if(fence != VK_NULL_HANDLE){
+				VkDevice lDev = _physicalDevice->vk_logicalDevice();
+				Vk_CheckVkResult(typeid(this), vkWaitForFences(lDev, 1, &fence, VK_TRUE, UINT64_MAX), "Unable to wait for buffer slot {0}", slot);
+			}
+			fence = VK_NULL_HANDLE;
+		}
+
+		void _waitForPendingUpdate() {
+			_pendingUpdate.wait();
+			_applyFlip();
+		}
+
+		// see _pendingFlip and _pendingBuffer. Call with _localMutex held
+		void _applyFlip() {
+			if((_pendingFlip < 0 && _pendingBuffer == VK_NULL_HANDLE) || !_pendingUpdate.ready()) return;
+			if(_pendingBuffer != VK_NULL_HANDLE){
+				_buffer.at(0) = _pendingBuffer;
+				_bufferMemory.at(0) = _pendingBufferMemory;
+				_pendingBuffer = VK_NULL_HANDLE;
+				_pendingBufferMemory = VK_NULL_HANDLE;
+			}
+			if(_pendingFlip >= 0) _bufferIndex = _pendingFlip;
+			_pendingFlip = -1;
+		}
+
+		/**
+		* Write ranges into a free slot and make it the current one. The slot also gets all ranges other slots
+		* received since it was written the last time, structuredData holds the complete data, so they are taken from there.
+		* Staged: the index switches once the copy is done. Direct: the data is written right away (coherent memory).
+		*/
+		Vk_GpuFuture _copyRangesToRingSlotAsync(const Vk_DataBufferLib::StructuredData<TStructureType>& structuredData, const std::vector<Vk_DataBufferLib::Range>& ranges) {
+			size_t slot = _acquireRingSlot();
+			std::vector<Vk_DataBufferLib::Range> slotRanges = _takeSlotRanges(slot, structuredData, ranges);
+
+			if(_updateBehaviour == Vk_BufferUpdateBehaviour::Direct_RingBuffering){
+				for(const auto& r : slotRanges){
+					std::uint64_t byteFrom = static_cast<std::uint64_t>(r.from * sizeof(TStructureType));
+					memcpy(_slotMapped.at(slot) + byteFrom, structuredData.data + r.from, (r.to - r.from) * sizeof(TStructureType));
+				}
+				_bufferIndex = static_cast<int32_t>(slot);
+				return Vk_GpuFuture();
+			}
+
+			Vk_GpuFuture copied = Vk_DataBufferLib::copyRangesToBufferWithStagingAsync(_physicalDevice, _type, _buffer.at(slot), _maxBufferByteSize(), structuredData, slotRanges, _objName, _associatedObject);
+			_pendingFlip = static_cast<int32_t>(slot);
+			return copied;
+		}
+
+		/**
+		* Staged_DoubleBuffering: write ranges and the back buffer's stale ranges into the back buffer once no frame
+		* draws from it anymore, flip to it once the copy is done (_pendingFlip).
+		*/
+		Vk_GpuFuture _copyRangesToBackBufferAsync(const Vk_DataBufferLib::StructuredData<TStructureType>& structuredData, const std::vector<Vk_DataBufferLib::Range>& ranges) {
+			size_t backIndex = static_cast<size_t>((_bufferIndex+1)%2);
+			_waitForSlot(backIndex);
+			std::vector<Vk_DataBufferLib::Range> backRanges = _takeSlotRanges(backIndex, structuredData, ranges);
+			Vk_GpuFuture copied = Vk_DataBufferLib::copyRangesToBufferWithStagingAsync(_physicalDevice, _type, _buffer.at(backIndex), _maxBufferByteSize(), structuredData, backRanges, _objName, _associatedObject);
+			_pendingFlip = static_cast<int32_t>(backIndex);
+			return copied;
+		}
+
+		/**
+		* Ranges to write into slot: its stale ranges plus ranges, clamped and coalesced. The stale ranges of the slot
+		* are consumed, ranges become stale for every other slot.
+		*/
+		std::vector<Vk_DataBufferLib::Range> _takeSlotRanges(size_t slot, const Vk_DataBufferLib::StructuredData<TStructureType>& structuredData, const std::vector<Vk_DataBufferLib::Range>& ranges) {
+			std::vector<Vk_DataBufferLib::Range> slotRanges = std::move(_slotStaleRanges.at(slot));
+			_slotStaleRanges.at(slot).clear();
+			slotRanges.insert(slotRanges.end(), ranges.begin(), ranges.end());
+			for(auto& r : slotRanges) r.to = std::min(r.to, structuredData.count);
+			size_t mergeGapCount = static_cast<size_t>(GLOBAL_DIRTY_RANGE_MERGE_GAP / sizeof(TStructureType));
+			slotRanges = Vk_DataBufferLib::coalesceRanges(std::move(slotRanges), mergeGapCount);
+			for(size_t i=0; i<_slotStaleRanges.size(); ++i){
+				if(i != slot) _slotStaleRanges.at(i).insert(_slotStaleRanges.at(i).end(), ranges.begin(), ranges.end());
+			}
+			return slotRanges;
+		}
 	};
 }
\ No newline at end of file
@@ -6,6 +6,13 @@
 #include "Vk_Structures.hpp"
 
 namespace VK5 {
+	// background copies larger than this are split into chunks of this size (see Vk_DataBufferLib::copyGpuToGpu)
+	constexpr std::uint64_t GLOBAL_COPY_CHUNK_SIZE = 16ull*1024ull*1024ull;
+	// dirty ranges closer than this are merged into one copy region (see Vk_DataBufferLib::coalesceRanges)
+	constexpr std::uint64_t GLOBAL_DIRTY_RANGE_MERGE_GAP = 256;
+	// default amount of buffers for the *_RingBuffering update behaviours
+	constexpr size_t GLOBAL_BUFFER_RING_SLOTS = 3;
+
 	enum class Vk_ObjUpdate {
 		/*
 		* Update registers a render commands rebuild and causes window to emit a PANT event
@@ -34,6 +41,8 @@ namespace VK5 {
 		/* TODO: add pinned staging for the three versions above where the staging buffer is preallocated */
 		Direct_GlobalLock,	   				/* use CPU accessible memory on GPU with global lock at data transfer */
 		// Direct_DoubleBuffering 			/* use CPU accessible memory on GPU with double buffering */
+		Staged_RingBuffering,				/* N buffers on GPU, updates go into a slot no frame in flight uses */
+		Direct_RingBuffering				/* N persistently mapped CPU accessible buffers, same slot rules as Staged_RingBuffering */
 	};
 
 	static std::string Vk_BufferUpdateBehaviourToString(Vk_BufferUpdateBehaviour behaviour) {
@@ -43,6 +52,8 @@ namespace VK5 {
 			// case Vk_BufferUpdateBehaviour::Staged_LazyDoubleBuffering: return "Staged_LazyDoubleBuffering";
 			case Vk_BufferUpdateBehaviour::Direct_GlobalLock: return "Direct_GlobalLock";
 			// case Vk_BufferUpdateBehaviour::Direct_DoubleBuffering: return "Direct_DoubleBuffering";
+			case Vk_BufferUpdateBehaviour::Staged_RingBuffering: return "Staged_RingBuffering";
+			case Vk_BufferUpdateBehaviour::Direct_RingBuffering: return "Direct_RingBuffering";
 			default: return "Unknown";
 		}
 	}
@@ -84,6 +95,8 @@ namespace VK5 {
             PC,
             PCN,
             PCNT,
+            // any other vertex with a generated Vk_VertexLayout (compact vertices, ...)
+            Layout,
             Index,
             Error
         };
@@ -98,6 +111,7 @@ namespace VK5 {
             case BufferType::Index: return "Index";
             case BufferType::PCN: return "PCN";
             case BufferType::PCNT: return "PCNT";
+            case BufferType::Layout: return "Layout";
             case BufferType::Error: return "Error";
             default: return "Unknown";
             }
@@ -109,6 +123,12 @@ namespace VK5 {
 			const TStructureType* data;
 		};
 
+		// [from, to) in elements
+		struct Range {
+			size_t from;
+			size_t to;
+		};
+
         template<class TStructureType>
         static BufferType getInitBufferType() {
 			std::string name = std::string(typeid(TStructureType).name());
@@ -121,6 +141,7 @@ namespace VK5 {
 			else if (name.compare(std::string(typeid(Vk_Vertex_PCN).name())) == 0) return BufferType::PCN;
 			else if (name.compare(std::string(typeid(Vk_Vertex_PCNT).name())) == 0) return BufferType::PCNT;
 			else if (name.compare(std::string(typeid(VK5::index_type).name())) == 0) return BufferType::Index;
+			if constexpr (requires { typename TStructureType::TLayout; }) return BufferType::Layout;
 
 			UT::Ut_Logger::RuntimeError(typeid(NoneObj), "Unable to set buffer type to [{0}]. Type is not supported!", name);
 			return BufferType::Error;
@@ -285,24 +306,58 @@ namespace VK5 {
 			vkUnmapMemory(lDev, gpuMemoryPtr);
 		}
 
-		static Vk_GpuTaskRunner* copyGpuToGpu(
+		/**
+		 * Copy on the GPU. The copy is recorded once per buffer pair, size and offsets and the recording is reused
+		 * on every following call with the same arguments (cached recording, see Vk_GpuTaskModifier::c).
+		 * Background copies larger than GLOBAL_COPY_CHUNK_SIZE are split into chunks, one task each. Vk_Queue only keeps
+		 * a few background tasks on the GPU at a time, so more urgent tasks can get in between two chunks.
+		 */
+		static Vk_GpuFuture copyGpuToGpu(
             Vk_PhysicalDevice* physicalDevice,
             const std::string& objName,
             VkBuffer srcBuffer, std::uint64_t srcBufferSize, 
             VkBuffer dstBuffer, std::uint64_t dstBufferSize,
             std::uint64_t copyByteSize, 
-            std::uint64_t srcByteOffset=0, std::uint64_t dstByteOffset=0
+            std::uint64_t srcByteOffset=0, std::uint64_t dstByteOffset=0,
+			Vk_GpuTaskPriority priority=Vk_GpuTaskPriority::Interactive
         ) {
 			// make sure that we access inside the source buffer
 			assert(srcBufferSize >= srcByteOffset + copyByteSize);
 			// make sure that we access inside the dst buffer
 			assert(dstBufferSize >= dstByteOffset + copyByteSize);
 
-			return physicalDevice->enqueue(std::move(Vk_GpuTaskLib::Vk_CopyGpuToGpu(
-				srcBuffer, static_cast<VkDeviceSize>(srcByteOffset),
-				dstBuffer, static_cast<VkDeviceSize>(dstByteOffset),
-				static_cast<VkDeviceSize>(copyByteSize), Vk_GpuTargetOp::Auto
-			)), {});
+			if(priority != Vk_GpuTaskPriority::Background || copyByteSize <= GLOBAL_COPY_CHUNK_SIZE)
+				return _copyGpuToGpuTask(physicalDevice, srcBuffer, dstBuffer, copyByteSize, srcByteOffset, dstByteOffset, priority, true);
+
+			// NOTE: the chunks are one-off copies, caching their recordings would only push useful ones out of the cache
+			std::vector<Vk_GpuFuture> chunks;
+			for(std::uint64_t chunkOffset = 0; chunkOffset < copyByteSize; chunkOffset += GLOBAL_COPY_CHUNK_SIZE){
+				std::uint64_t chunkSize = std::min(GLOBAL_COPY_CHUNK_SIZE, copyByteSize - chunkOffset);
+				chunks.push_back(_copyGpuToGpuTask(physicalDevice, srcBuffer, dstBuffer, chunkSize, srcByteOffset + chunkOffset, dstByteOffset + chunkOffset, priority, false));
+			}
+			return Vk_GpuFuture::when_all(chunks);
+		}
+
+		static Vk_GpuFuture _copyGpuToGpuTask(
+			Vk_PhysicalDevice* physicalDevice,
+			VkBuffer srcBuffer, VkBuffer dstBuffer,
+			std::uint64_t copyByteSize, std::uint64_t srcByteOffset, std::uint64_t dstByteOffset,
+			Vk_GpuTaskPriority priority, bool cached,
+			TGpuTaskRecord recordFunction = Vk_GpuTaskLib::Vk_CopyGpuToGpu::record
+		) {
+			Vk_GpuTaskPool& pool = physicalDevice->gpuTaskPool();
+			auto task = pool.getOrCreateTask(Vk_GpuOp::Transfer);
+			task->mod()
+				->params(Vk_GpuTaskLib::Vk_CopyGpuToGpu(
+					srcBuffer, static_cast<VkDeviceSize>(srcByteOffset),
+					dstBuffer, static_cast<VkDeviceSize>(dstByteOffset),
+					static_cast<VkDeviceSize>(copyByteSize), Vk_GpuTargetOp::Auto))
+				->r(recordFunction)
+				->s(nullptr)
+				->c(cached)
+				->p(priority);
+
+			return pool.returnWhenFinished(physicalDevice->enqueue(std::move(task)));
 		}
 
         template<class TStructureType>
@@ -333,9 +388,23 @@ namespace VK5 {
             Usage usage, Vk_GpuTargetOp gpuTargetOp
         ) {
 			VkBufferUsageFlags usageFlags = getUsageFlags(type, usage);
+			// NOTE: device local if the device has host visible VRAM (resizable BAR, unified memory), system memory otherwise
 			physicalDevice->createAndAllocBuffer(
-				usageFlags, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-				buffer, memory, size, gpuTargetOp);
+				usageFlags, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				buffer, memory, size, gpuTargetOp, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		}
+
+		/**
+		 * Buffer in host visible memory that the GPU reads over the bus, for data that had to leave device local
+		 * memory (see Vk_MemoryBudget). Nothing is preferred, so plain system memory ranks before host visible VRAM.
+		 */
+		static void createHostBuffer(
+            Vk_PhysicalDevice* physicalDevice, BufferType type,
+            VkBuffer& buffer, VkDeviceMemory& memory, VkDeviceSize size,
+            Usage usage, Vk_GpuTargetOp gpuTargetOp
+        ) {
+			VkBufferUsageFlags usageFlags = getUsageFlags(type, usage);
+			physicalDevice->createAndAllocBuffer(usageFlags, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, buffer, memory, size, gpuTargetOp);
 		}
 
         static void createStagingBuffer(
@@ -352,6 +421,24 @@ namespace VK5 {
 				buffer, memory, size, gpuTargetOp);
 		}
 
+		/**
+		 * Persistently mapped buffer for readbacks from the GPU. Host cached memory is preferred, reading uncached
+		 * memory from the CPU is very slow. Returns true if the memory is also coherent, otherwise the mapped
+		 * range must be invalidated before reading (vkInvalidateMappedMemoryRanges).
+		 */
+		static bool createReadbackBuffer(
+			Vk_PhysicalDevice* physicalDevice, BufferType type,
+			VkBuffer& buffer, VkDeviceMemory& memory, std::uint64_t size, Vk_GpuTargetOp gpuTargetOp
+		) {
+			VkBufferUsageFlags usageFlags = getUsageFlags(type, Usage::Destination, true);
+			const Vk_PhysicalDeviceMemory& deviceMemory = physicalDevice->physicalDeviceMemory();
+			// cached first, then coherent
+			VkMemoryPropertyFlags required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+			if(deviceMemory.supportsMemoryPropertyFlags(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT)) required |= VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+			VkMemoryPropertyFlags flags = physicalDevice->createAndAllocBuffer(usageFlags, required, buffer, memory, size, gpuTargetOp, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+			return (flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+		}
+
         template<class TStructureType>
         static void copyDataToBufferWithStaging(
             Vk_PhysicalDevice* physicalDevice,
@@ -363,33 +450,150 @@ namespace VK5 {
             size_t to,
             const std::string& objName = "",
             const std::string& associatedObject = ""
+        ){
+			copyDataToBufferWithStagingAsync(physicalDevice, type, buffer, bufferByteSize, structuredData, from, to, objName, associatedObject).wait();
+		}
+
+		/**
+		 * Same as copyDataToBufferWithStaging but returns as soon as the copy is enqueued. The data in [from, to)
+		 * is already in staging memory when this returns, so structuredData may be changed or freed right away.
+		 * The returned future completes once the data is in buffer.
+		 */
+        template<class TStructureType>
+        static Vk_GpuFuture copyDataToBufferWithStagingAsync(
+            Vk_PhysicalDevice* physicalDevice,
+            BufferType type,
+            VkBuffer buffer, 
+			uint64_t bufferByteSize,
+            const Vk_DataBufferLib::StructuredData<TStructureType>& structuredData,
+            size_t from, 
+            size_t to,
+            const std::string& objName = "",
+            const std::string& associatedObject = ""
         ){
             if(from > to){
                 UT::Ut_Logger::RuntimeError(typeid(NoneObj), "Data [from, to] must be an interval of positive length but is {0} items long!", to-from);
             }
 
-			// create host buffer to copy all necessary data into cpu accessible memory, lets call it stagingBuffer
-			VkBuffer stagingBuffer = VK_NULL_HANDLE;
-			VkDeviceMemory stagingBufferMemory = VK_NULL_HANDLE;
-			uint64_t dataSize = static_cast<uint64_t>(structuredData.count * sizeof(TStructureType));
 			uint64_t byteFrom = static_cast<uint64_t>(from * sizeof(TStructureType));
 			uint64_t byteTo = static_cast<uint64_t>(to * sizeof(TStructureType));
+			uint64_t copyByteSize = byteTo - byteFrom;
+			if(copyByteSize == 0) return Vk_GpuFuture();
+			// make sure that we access inside the dst buffer
+			assert(bufferByteSize >= byteTo);
+
+			// sub-allocate from the persistently mapped staging ring of the device: no buffer creation, allocation or mapping per update
+			Vk_StagingRing& ring = physicalDevice->stagingRing();
+			Vk_StagingAllocation staging = ring.allocate(static_cast<VkDeviceSize>(copyByteSize));
+			if(staging.valid()){
+				memcpy(staging.data, reinterpret_cast<const char*>(structuredData.data) + byteFrom, copyByteSize);
+				// NOTE: not cached, the ring offset is different for every update
+				Vk_GpuFuture copied = _copyGpuToGpuTask(
+					physicalDevice, staging.buffer, buffer, copyByteSize, 
+					static_cast<std::uint64_t>(staging.offset), byteFrom, Vk_GpuTaskPriority::Interactive, false);
+				ring.retire(staging, copied);
+				return copied;
+			}
 
-			// if the buffer is initially empty, no need to copy random stuff, just create the vertex buffer
-			// auto t1 = std::chrono::high_resolution_clock::now();
-			createStagingBuffer(physicalDevice, type, stagingBuffer, stagingBufferMemory, byteTo - byteFrom, Usage::Source, Gk_GpuTargetOp::Auto);
-			// auto t2 = std::chrono::high_resolution_clock::now();
-			// std::cout << "############################333" << std::endl << std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count() << std::endl << "############################333" << std::endl;
+			// larger than the whole ring: fall back to a dedicated staging buffer
+			VkBuffer stagingBuffer = VK_NULL_HANDLE;
+			VkDeviceMemory stagingBufferMemory = VK_NULL_HANDLE;
+			createStagingBuffer(physicalDevice, type, stagingBuffer, stagingBufferMemory, copyByteSize, Usage::Source, Vk_GpuTargetOp::Auto);
 
-            std::string nn = "#Create#" + objName + associatedObject;
-			// map memory into variable to actually use it
-			uint64_t copyByteSize = byteTo - byteFrom;
 			// srcByteOffset = byteFrom, dstByteOffset = 0 because that is the staging buffer offset that only houses the new data
 			copyCpuToGpu(physicalDevice, structuredData, stagingBufferMemory, copyByteSize, byteFrom, 0);
 			// srcByteOffset = 0 because that is the staging buffer offset that only houses the new data, 
 			// dstByteOffset = byteFrom because we need to place the data in the right spot
-			copyGpuToGpu(physicalDevice, nn, stagingBuffer, byteTo - byteFrom, buffer, bufferByteSize, copyByteSize, 0, byteFrom);
-			physicalDevice->logicalDevice().destroyBuffer(stagingBuffer, stagingBufferMemory);
+			Vk_GpuFuture copied = _copyGpuToGpuTask(physicalDevice, stagingBuffer, buffer, copyByteSize, 0, byteFrom, Vk_GpuTaskPriority::Interactive, false);
+			return copied.then([physicalDevice, stagingBuffer, stagingBufferMemory](){
+				VkBuffer b = stagingBuffer;
+				VkDeviceMemory m = stagingBufferMemory;
+				physicalDevice->destroyBuffer(b, m);
+			});
+		}
+
+		/**
+		 * Sort ranges and merge the ones that overlap or are at most mergeGapCount elements apart. Copying the few
+		 * elements in between is cheaper than one more copy region. Empty ranges are dropped.
+		 */
+		static std::vector<Range> coalesceRanges(std::vector<Range> ranges, size_t mergeGapCount) {
+			std::erase_if(ranges, [](const Range& r){ return r.to <= r.from; });
+			std::sort(ranges.begin(), ranges.end(), [](const Range& a, const Range& b){ return a.from < b.from; });
+			std::vector<Range> merged;
+			for(const Range& r : ranges){
+				if(!merged.empty() && r.from <= merged.back().to + mergeGapCount) merged.back().to = std::max(merged.back().to, r.to);
+				else merged.push_back(r);
+			}
+			return merged;
+		}
+
+		/**
+		 * Copy several [from, to) ranges of structuredData to the same offsets in buffer. The ranges are packed into
+		 * the staging ring and copied with one vkCmdCopyBuffer with one VkBufferCopy per range. If they don't fit into the
+		 * ring at once, they are split into several such copies. Ranges have to be coalesced already (see coalesceRanges).
+		 * Returns as soon as everything is staged and enqueued, the future completes once all data is in buffer.
+		 */
+        template<class TStructureType>
+        static Vk_GpuFuture copyRangesToBufferWithStagingAsync(
+            Vk_PhysicalDevice* physicalDevice,
+            BufferType type,
+            VkBuffer buffer, 
+			uint64_t bufferByteSize,
+            const Vk_DataBufferLib::StructuredData<TStructureType>& structuredData,
+            const std::vector<Range>& ranges,
+            const std::string& objName = "",
+            const std::string& associatedObject = ""
+        ){
+			Vk_StagingRing& ring = physicalDevice->stagingRing();
+			std::vector<Vk_GpuFuture> copies;
+
+			size_t next = 0;
+			while(next < ranges.size()){
+				// collect as many ranges as fit into one ring allocation
+				uint64_t batchByteSize = 0;
+				size_t batchEnd = next;
+				while(batchEnd < ranges.size()){
+					uint64_t rangeByteSize = static_cast<uint64_t>((ranges[batchEnd].to - ranges[batchEnd].from) * sizeof(TStructureType));
+					if(batchEnd > next && batchByteSize + rangeByteSize > ring.capacity()) break;
+					batchByteSize += rangeByteSize;
+					++batchEnd;
+				}
+
+				Vk_StagingAllocation staging = ring.allocate(static_cast<VkDeviceSize>(batchByteSize));
+				if(!staging.valid()){
+					// a single range larger than the whole ring
+					copies.push_back(copyDataToBufferWithStagingAsync(physicalDevice, type, buffer, bufferByteSize, structuredData, ranges[next].from, ranges[next].to, objName, associatedObject));
+					next = batchEnd;
+					continue;
+				}
+
+				std::vector<VkBufferCopy> regions;
+				VkDeviceSize stagingOffset = 0;
+				for(size_t i=next; i<batchEnd; ++i){
+					uint64_t byteFrom = static_cast<uint64_t>(ranges[i].from * sizeof(TStructureType));
+					uint64_t byteSize = static_cast<uint64_t>((ranges[i].to - ranges[i].from) * sizeof(TStructureType));
+					// make sure that we access inside the dst buffer
+					assert(bufferByteSize >= byteFrom + byteSize);
+					memcpy(static_cast<char*>(staging.data) + stagingOffset, reinterpret_cast<const char*>(structuredData.data) + byteFrom, byteSize);
+					regions.push_back(VkBufferCopy { .srcOffset = staging.offset + stagingOffset, .dstOffset = byteFrom, .size = byteSize });
+					stagingOffset += byteSize;
+				}
+
+				Vk_GpuTaskPool& pool = physicalDevice->gpuTaskPool();
+				auto task = pool.getOrCreateTask(Vk_GpuOp::Transfer);
+				task->mod()
+					->params(Vk_GpuTaskLib::Vk_CopyRegionsGpuToGpu(staging.buffer, buffer, std::move(regions), Vk_GpuTargetOp::Auto))
+					->r(Vk_GpuTaskLib::Vk_CopyRegionsGpuToGpu::record)
+					->s(nullptr)
+					->c(false)
+					->p(Vk_GpuTaskPriority::Interactive);
+
+				Vk_GpuFuture copied = pool.returnWhenFinished(physicalDevice->enqueue(std::move(task)));
+				ring.retire(staging, copied);
+				copies.push_back(copied);
+				next = batchEnd;
+			}
+			return Vk_GpuFuture::when_all(copies);
 		}
 
 		template<class TStructureType>
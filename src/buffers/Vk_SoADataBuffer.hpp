@@ -0,0 +1,169 @@
+#pragma once
+
+#include <tuple>
+#include <memory>
+#include <vector>
+#include <utility>
+#include <typeinfo>
+#include <algorithm>
+
+#include "../Defines.h"
+#include "Vk_Structures.hpp"
+#include "Vk_DataBuffer.hpp"
+
+namespace VK5 {
+	template<class TLayout>
+	class Vk_SoADataBuffer;
+
+	/**
+	 * Vertex data as structure of arrays: one Vk_DataBuffer per stream of the layout (for example
+	 * Vk_SoA_PCN = position, color and normal buffers) instead of one buffer of interleaved Vk_Vertex_PCN.
+	 * A stream can be updated on its own, updating only the positions moves a third of the bytes of Vk_Vertex_PCN
+	 * and the CPU side data of one stream is tightly packed (vec3 after vec3).
+	 * Binding:
+	 *    auto buffers = soa.vk_buffers();
+	 *    std::vector<VkDeviceSize> offsets(buffers.size(), 0);
+	 *    vkCmdBindVertexBuffers(cmd, firstBinding, buffers.size(), buffers.data(), offsets.data());
+	 * with the pipeline set up by Vk_SoALayout::getBindingDescriptions(firstBinding) and getAttributeDescriptions.
+	 * NOTE: all streams always have the same element count. stream<I>() gives direct access, but updates through it
+	 * must keep the count of all streams equal.
+	 * NOTE: the ring and double buffering behaviours upload stale ranges from the complete data of the last update,
+	 * this class keeps a copy of every stream for that. Update through updateAsync and updateStreamAsync, not stream<I>().
+	 */
+	template<class ...TStreams>
+	class Vk_SoADataBuffer<Vk_SoALayout<TStreams...>> {
+	public:
+		typedef Vk_SoALayout<TStreams...> TLayout;
+
+	private:
+		// complete data of every stream as of the last update, updates hand it to the streams as a whole
+		// NOTE: declared before _streams, the interleaved constructor creates the streams from it
+		std::tuple<std::vector<TStreams>...> _scratch;
+		std::tuple<std::unique_ptr<Vk_DataBuffer<TStreams>>...> _streams;
+
+	public:
+		Vk_SoADataBuffer(
+			Vk_PhysicalDevice* physicalDevice,
+			const std::string& associatedObject,
+			const TStreams*... pStreamData,
+			size_t count,
+			Vk_BufferUpdateBehaviour updateBehaviour,
+			Vk_BufferSizeBehaviour sizeBehaviour,
+			std::string objName = ""
+		)
+			:
+			_scratch(_copy(pStreamData, count)...),
+			_streams(std::make_unique<Vk_DataBuffer<TStreams>>(physicalDevice, associatedObject, pStreamData, count, updateBehaviour, sizeBehaviour, objName)...)
+		{}
+
+		/**
+		 * Split interleaved vertices (Vk_Vertex_PC/PCN/PCNT, anything that has the members of the streams)
+		 * into the streams
+		 */
+		template<class TVertex>
+		Vk_SoADataBuffer(
+			Vk_PhysicalDevice* physicalDevice,
+			const std::string& associatedObject,
+			const TVertex* pVertices,
+			size_t count,
+			Vk_BufferUpdateBehaviour updateBehaviour,
+			Vk_BufferSizeBehaviour sizeBehaviour,
+			std::string objName = ""
+		)
+			:
+			_scratch(_split<TStreams>(pVertices, count)...),
+			_streams(_createStreams(physicalDevice, associatedObject, pVertices != nullptr, count, updateBehaviour, sizeBehaviour, objName, std::index_sequence_for<TStreams...>{}))
+		{}
+
+		Vk_SoADataBuffer(const Vk_SoADataBuffer& other) = delete;
+		Vk_SoADataBuffer(Vk_SoADataBuffer&& other) = delete;
+		Vk_SoADataBuffer& operator=(const Vk_SoADataBuffer& other) = delete;
+		Vk_SoADataBuffer& operator=(Vk_SoADataBuffer&& other) = delete;
+
+		static constexpr size_t streamCount() { return TLayout::StreamCount; }
+
+		// stream I in layout order (0 = position for all predefined layouts)
+		template<size_t I>
+		auto& stream() { return *std::get<I>(_streams); }
+
+		// one buffer per stream, in binding order
+		std::vector<VkBuffer> vk_buffers() {
+			return std::apply([](auto&... s){ return std::vector<VkBuffer>{ s->vk_buffer()... }; }, _streams);
+		}
+
+		size_t bufferCount() { return std::get<0>(_streams)->bufferCount(); }
+
+		void resize(size_t newCount) {
+			std::apply([&](auto&... s){ (s->resize(newCount), ...); }, _streams);
+		}
+
+		/**
+		 * Update only stream I. structuredData is the whole stream (newCount elements), [newFrom, newTo) is copied.
+		 * newCount has to match the other streams.
+		 */
+		template<size_t I>
+		Vk_GpuFuture updateStreamAsync(const std::tuple_element_t<I, std::tuple<TStreams...>>* structuredData, size_t newCount, size_t newFrom, size_t newTo=0) {
+			if(newCount != bufferCount()){
+				UT::Ut_Logger::RuntimeError(typeid(this), "Update of stream {0} failed: {1} elements instead of {2}, update all streams to change the count", I, newCount, bufferCount());
+			}
+			if(newTo == 0) newTo = newCount;
+			auto& scratch = std::get<I>(_scratch);
+			scratch.resize(newCount);
+			std::copy(structuredData + newFrom, structuredData + newTo, scratch.begin() + newFrom);
+			return std::get<I>(_streams)->updateAsync(scratch.data(), newCount, newFrom, newTo);
+		}
+
+		/**
+		 * Update all streams from interleaved vertices. Only [newFrom, newTo) is split, vertices outside of it
+		 * are never read, the streams keep their data from the earlier updates there.
+		 */
+		template<class TVertex>
+		Vk_GpuFuture updateAsync(const TVertex* vertices, size_t newCount, size_t newFrom, size_t newTo=0) {
+			if(newTo == 0) newTo = newCount;
+			return _updateAsync(vertices, newCount, newFrom, newTo, std::index_sequence_for<TStreams...>{});
+		}
+
+		template<class TVertex>
+		void update(const TVertex* vertices, size_t newCount, size_t newFrom, size_t newTo=0) {
+			updateAsync(vertices, newCount, newFrom, newTo).wait();
+		}
+
+	private:
+		// streams with the data of _scratch
+		template<size_t ...I>
+		std::tuple<std::unique_ptr<Vk_DataBuffer<TStreams>>...> _createStreams(
+			Vk_PhysicalDevice* physicalDevice, const std::string& associatedObject, bool hasData, size_t count,
+			Vk_BufferUpdateBehaviour updateBehaviour, Vk_BufferSizeBehaviour sizeBehaviour, const std::string& objName, std::index_sequence<I...>
+		) {
+			return std::make_tuple(std::make_unique<Vk_DataBuffer<TStreams>>(physicalDevice, associatedObject, hasData ? std::get<I>(_scratch).data() : nullptr, count, updateBehaviour, sizeBehaviour, objName)...);
+		}
+
+		template<class TStream, class TVertex>
+		static std::vector<TStream> _split(const TVertex* vertices, size_t count) {
+			std::vector<TStream> stream(count);
+			if(vertices == nullptr) return stream;
+			for(size_t i=0; i<count; ++i) stream[i] = TStream::fromVertex(vertices[i]);
+			return stream;
+		}
+
+		template<class TStream>
+		static std::vector<TStream> _copy(const TStream* streamData, size_t count) {
+			if(streamData == nullptr) return std::vector<TStream>(count);
+			return std::vector<TStream>(streamData, streamData + count);
+		}
+
+		template<class TVertex, size_t ...I>
+		Vk_GpuFuture _updateAsync(const TVertex* vertices, size_t newCount, size_t newFrom, size_t newTo, std::index_sequence<I...>) {
+			(_splitRange(std::get<I>(_scratch), vertices, newCount, newFrom, newTo), ...);
+			return Vk_GpuFuture::when_all(std::vector<Vk_GpuFuture>{
+				std::get<I>(_streams)->updateAsync(std::get<I>(_scratch).data(), newCount, newFrom, newTo)...
+			});
+		}
+
+		template<class TStream, class TVertex>
+		static void _splitRange(std::vector<TStream>& stream, const TVertex* vertices, size_t newCount, size_t newFrom, size_t newTo) {
+			stream.resize(newCount);
+			for(size_t i=newFrom; i<newTo; ++i) stream[i] = TStream::fromVertex(vertices[i]);
+		}
+	};
+}
@@ -1,8 +1,11 @@
 #pragma once
 
 #include <array>
+#include <vector>
+#include <utility>
 
 #include "../Defines.h"
+#include "Vk_VertexLayout.hpp"
 // #include "../Vk_Logger.hpp"
 
 namespace VK5 {
@@ -10,46 +13,18 @@ namespace VK5 {
 		glm::tvec3<VK5::point_type> pos;
 		glm::tvec3<VK5::point_type> color;
 
-		static int innerDimensionLen(){ return 6; }
+		typedef Vk_VertexLayout<Vk_Vertex_PC, Vk_Field<&Vk_Vertex_PC::pos>, Vk_Field<&Vk_Vertex_PC::color>> TLayout;
 
-		static bool compare(const Vk_Vertex_PC& s1, const Vk_Vertex_PC& s2) {
-			glm::bvec3 res1 = glm::equal(s1.pos, s2.pos);
-			glm::bvec3 res2 = glm::equal(s1.color, s2.color);
-			return res1.x && res1.y && res1.z && res2.x && res2.y && res2.z;
-		}
-
-		static VkVertexInputBindingDescription getBindingDescription(
-			uint32_t bindingDescriptionIndex
-		) {
-			VkVertexInputBindingDescription bindingDescription{};
-			// layout(location = [bindingDescriptionIndex]) in vec3 inVertex;
-			bindingDescription.binding = bindingDescriptionIndex;
-			bindingDescription.stride = sizeof(Vk_Vertex_PC);
-			bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-
-			return bindingDescription;
-		}
+		static int innerDimensionLen(){ return TLayout::innerDimensionLen(); }
+		static bool compare(const Vk_Vertex_PC& s1, const Vk_Vertex_PC& s2) { return TLayout::compare(s1, s2); }
+		static VkVertexInputBindingDescription getBindingDescription(uint32_t bindingDescriptionIndex) { return TLayout::getBindingDescription(bindingDescriptionIndex); }
 
 		static std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions(
 			uint32_t bindingDescriptionIndex,
 			uint32_t positionLocation,
 			uint32_t colorLocation
 		) {
-			std::vector<VkVertexInputAttributeDescription> attributeDescriptions(2);
-
-			// layout(location = [bindingDescriptionIndex]) in vec3 inVertex;
-			attributeDescriptions[0].binding = bindingDescriptionIndex;
-			attributeDescriptions[0].location = positionLocation;
-			attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-			attributeDescriptions[0].offset = offsetof(Vk_Vertex_PC, pos);
-
-			// layout(location = [bindingDescriptionIndex]) in vec3 inVertex;
-			attributeDescriptions[1].binding = bindingDescriptionIndex;
-			attributeDescriptions[1].location = colorLocation;
-			attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-			attributeDescriptions[1].offset = offsetof(Vk_Vertex_PC, color);
-
-			return attributeDescriptions;
+			return TLayout::getAttributeDescriptions(bindingDescriptionIndex, {positionLocation, colorLocation});
 		}
 	};
 
@@ -58,29 +33,17 @@ namespace VK5 {
 		glm::tvec3<VK5::point_type> color;
 		glm::tvec3<VK5::point_type> normal;
 
-		static int innerDimensionLen(){ return 9; }
+		typedef Vk_VertexLayout<Vk_Vertex_PCN, Vk_Field<&Vk_Vertex_PCN::pos>, Vk_Field<&Vk_Vertex_PCN::color>, Vk_Field<&Vk_Vertex_PCN::normal>> TLayout;
 
-		static bool compare(const Vk_Vertex_PCN& s1, const Vk_Vertex_PCN& s2) {
-			glm::bvec3 res1 = glm::equal(s1.pos, s2.pos);
-			glm::bvec3 res2 = glm::equal(s1.color, s2.color);
-			glm::bvec3 res3 = glm::equal(s1.normal, s2.normal);
-			return
-				res1.x && res1.y && res1.z &&
-				res2.x && res2.y && res2.z &&
-				res3.x && res3.y && res3.z;
-		}
+		static int innerDimensionLen(){ return TLayout::innerDimensionLen(); }
+		static bool compare(const Vk_Vertex_PCN& s1, const Vk_Vertex_PCN& s2) { return TLayout::compare(s1, s2); }
 
 		static std::uint32_t bindingDescriptionIndex() {
 			return 0;
 		}
 
-		static VkVertexInputBindingDescription getBindingDescription() {
-			VkVertexInputBindingDescription bindingDescription{};
-			bindingDescription.binding = bindingDescriptionIndex();
-			bindingDescription.stride = sizeof(Vk_Vertex_PCN);
-			bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-
-			return bindingDescription;
+		static VkVertexInputBindingDescription getBindingDescription(uint32_t bindingDescriptionIndex = Vk_Vertex_PCN::bindingDescriptionIndex()) {
+			return TLayout::getBindingDescription(bindingDescriptionIndex);
 		}
 
 		static std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions(
@@ -89,27 +52,7 @@ namespace VK5 {
 			uint32_t colorLocation,
 			uint32_t normalLocation
 		) {
-			std::vector<VkVertexInputAttributeDescription> attributeDescriptions(3);
-
-			// layout(location = [bindingDescriptionIndex]) in vec3 inVertex;
-			attributeDescriptions[0].binding = bindingDescriptionIndex;
-			attributeDescriptions[0].location = positionLocation;
-			attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-			attributeDescriptions[0].offset = offsetof(Vk_Vertex_PCN, pos);
-
-			// layout(location = [bindingDescriptionIndex]) in vec3 inVertex;
-			attributeDescriptions[1].binding = bindingDescriptionIndex;
-			attributeDescriptions[1].location = colorLocation;
-			attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-			attributeDescriptions[1].offset = offsetof(Vk_Vertex_PCN, color);
-
-			// layout(location = [bindingDescriptionIndex]) in vec3 inVertex;
-			attributeDescriptions[2].binding = bindingDescriptionIndex;
-			attributeDescriptions[2].location = normalLocation;
-			attributeDescriptions[2].format = VK_FORMAT_R32G32B32_SFLOAT;
-			attributeDescriptions[2].offset = offsetof(Vk_Vertex_PCN, normal);
-
-			return attributeDescriptions;
+			return TLayout::getAttributeDescriptions(bindingDescriptionIndex, {positionLocation, colorLocation, normalLocation});
 		}
 	};
 
@@ -119,30 +62,11 @@ namespace VK5 {
 		glm::tvec3<VK5::point_type> normal;
 		glm::tvec2<VK5::point_type> uv;
 
-		static int innerDimensionLen(){ return 11; }
-
-		static bool compare(const Vk_Vertex_PCNT& s1, const Vk_Vertex_PCNT& s2) {
-			glm::bvec3 res1 = glm::equal(s1.pos, s2.pos);
-			glm::bvec3 res2 = glm::equal(s1.color, s2.color);
-			glm::bvec3 res3 = glm::equal(s1.normal, s2.normal);
-			glm::bvec2 res4 = glm::equal(s1.uv, s2.uv);
-			return
-				res1.x && res1.y && res1.z &&
-				res2.x && res2.y && res2.z &&
-				res3.x && res3.y && res3.z &&
-				res4.x && res4.y;
-		}
-
-		static VkVertexInputBindingDescription getBindingDescription(
-			uint32_t bindingDescriptionIndex
-		) {
-			VkVertexInputBindingDescription bindingDescription{};
-			bindingDescription.binding = bindingDescriptionIndex;
-			bindingDescription.stride = sizeof(Vk_Vertex_PCNT);
-			bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+		typedef Vk_VertexLayout<Vk_Vertex_PCNT, Vk_Field<&Vk_Vertex_PCNT::pos>, Vk_Field<&Vk_Vertex_PCNT::color>, Vk_Field<&Vk_Vertex_PCNT::normal>, Vk_Field<&Vk_Vertex_PCNT::uv>> TLayout;
 
-			return bindingDescription;
-		}
+		static int innerDimensionLen(){ return TLayout::innerDimensionLen(); }
+		static bool compare(const Vk_Vertex_PCNT& s1, const Vk_Vertex_PCNT& s2) { return TLayout::compare(s1, s2); }
+		static VkVertexInputBindingDescription getBindingDescription(uint32_t bindingDescriptionIndex) { return TLayout::getBindingDescription(bindingDescriptionIndex); }
 
 		static std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions(
 			uint32_t bindingDescriptionIndex,
@@ -151,232 +75,155 @@ namespace VK5 {
 			uint32_t normalLocation,
 			uint32_t uvLocation
 		) {
-			std::vector<VkVertexInputAttributeDescription> attributeDescriptions(4);
-
-			// layout(location = [bindingDescriptionIndex]) in vec3 inVertex;
-			attributeDescriptions[0].binding = bindingDescriptionIndex;
-			attributeDescriptions[0].location = positionLocation;
-			attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-			attributeDescriptions[0].offset = offsetof(Vk_Vertex_PCNT, pos);
-
-			// layout(location = [bindingDescriptionIndex]) in vec3 inVertex;
-			attributeDescriptions[1].binding = bindingDescriptionIndex;
-			attributeDescriptions[1].location = colorLocation;
-			attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-			attributeDescriptions[1].offset = offsetof(Vk_Vertex_PCNT, color);
-
-			// layout(location = [bindingDescriptionIndex]) in vec3 inVertex;
-			attributeDescriptions[2].binding = bindingDescriptionIndex;
-			attributeDescriptions[2].location = normalLocation;
-			attributeDescriptions[2].format = VK_FORMAT_R32G32B32_SFLOAT;
-			attributeDescriptions[2].offset = offsetof(Vk_Vertex_PCNT, normal);
-
-			// layout(location = [bindingDescriptionIndex]) in vec3 inVertex;
-			attributeDescriptions[3].binding = bindingDescriptionIndex;
-			attributeDescriptions[3].location = uvLocation;
-			attributeDescriptions[3].format = VK_FORMAT_R32G32_SFLOAT;
-			attributeDescriptions[3].offset = offsetof(Vk_Vertex_PCNT, uv);
-
-			return attributeDescriptions;
+			return TLayout::getAttributeDescriptions(bindingDescriptionIndex, {positionLocation, colorLocation, normalLocation, uvLocation});
 		}
 	};
-	
-	struct Vk_Vertex_P {
 
-		glm::tvec3<VK5::point_type> pos;
+	/**
+	 * Compact version of Vk_Vertex_PCN: half float position, 8 bit color and 16 bit normal, 20 instead of 36 bytes.
+	 * The shader inputs stay vec3 (the fourth component is dropped). Create them with fromVertex.
+	 */
+	struct Vk_Vertex_PCN_Compact {
+		Vk_Packed<Vk_Half, 4> pos;
+		Vk_Packed<Vk_Unorm8, 4> color;
+		Vk_Packed<Vk_Snorm16, 4> normal;
 
-		static int innerDimensionLen(){ return 3; }
+		typedef Vk_VertexLayout<Vk_Vertex_PCN_Compact, Vk_Field<&Vk_Vertex_PCN_Compact::pos>, Vk_Field<&Vk_Vertex_PCN_Compact::color>, Vk_Field<&Vk_Vertex_PCN_Compact::normal>> TLayout;
 
-		static bool compare(const Vk_Vertex_P& vertex1, const Vk_Vertex_P& vertex2) {
-			glm::bvec3 res1 = glm::equal(vertex1.pos, vertex2.pos);
-			return res1.x && res1.y && res1.z;
-		}
+		static int innerDimensionLen(){ return TLayout::innerDimensionLen(); }
+		static bool compare(const Vk_Vertex_PCN_Compact& s1, const Vk_Vertex_PCN_Compact& s2) { return TLayout::compare(s1, s2); }
+		static VkVertexInputBindingDescription getBindingDescription(uint32_t bindingDescriptionIndex) { return TLayout::getBindingDescription(bindingDescriptionIndex); }
 
-		static VkVertexInputBindingDescription getBindingDescription(
-			uint32_t bindingDescriptionIndex
+		static std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions(
+			uint32_t bindingDescriptionIndex,
+			uint32_t positionLocation,
+			uint32_t colorLocation,
+			uint32_t normalLocation
 		) {
-			// describes rate to load data from memory for vertices and
-			// number of bytes between data entries and so on
-			VkVertexInputBindingDescription bindingDescription{};
-			// index of binding in array of bindings
-			bindingDescription.binding = bindingDescriptionIndex;
-			// number of bytes between beginning of two vertices
-			bindingDescription.stride = sizeof(Vk_Vertex_P);
-			// vertex or instance
-			bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-
-			return bindingDescription;
+			return TLayout::getAttributeDescriptions(bindingDescriptionIndex, {positionLocation, colorLocation, normalLocation});
 		}
 
-		static VkVertexInputAttributeDescription getAttributeDescriptions(
-			uint32_t bindingDescriptionIndex,
-			uint32_t positionLocation
-		) {
+		template<class TVertex>
+		static Vk_Vertex_PCN_Compact fromVertex(const TVertex& vertex) {
+			return {
+				.pos = Vk_Pack<Vk_Half, 4>(vertex.pos, 3),
+				.color = Vk_Pack<Vk_Unorm8, 4>(vertex.color, 3),
+				.normal = Vk_Pack<Vk_Snorm16, 4>(vertex.normal, 3)
+			};
+		}
+	};
 
-			// the size of the array must match the amount of vector entries in the vertex
-			VkVertexInputAttributeDescription attributeDescription{};
+	struct Vk_Vertex_P {
+		glm::tvec3<VK5::point_type> pos;
 
-			//! characteristics for pos
-			// binding index
-			// layout(location = [bindingDescriptionIndex]) in vec3 inVertex;
-			attributeDescription.binding = bindingDescriptionIndex;
-			// shader location indicator
-			attributeDescription.location = positionLocation;
-			// format of the vertex data (confusingly with R,G and B), this one directly relates to vec2 or vec3 or vec4 in shaders
-			attributeDescription.format = VK_FORMAT_R32G32B32_SFLOAT;
-			attributeDescription.offset = offsetof(Vk_Vertex_P, pos);
+		typedef Vk_VertexLayout<Vk_Vertex_P, Vk_Field<&Vk_Vertex_P::pos>> TLayout;
 
-			return attributeDescription;
-		}
-	};
+		static int innerDimensionLen(){ return TLayout::innerDimensionLen(); }
+		static bool compare(const Vk_Vertex_P& vertex1, const Vk_Vertex_P& vertex2) { return TLayout::compare(vertex1, vertex2); }
+		static VkVertexInputBindingDescription getBindingDescription(uint32_t bindingDescriptionIndex) { return TLayout::getBindingDescription(bindingDescriptionIndex); }
+		static VkVertexInputAttributeDescription getAttributeDescriptions(uint32_t bindingDescriptionIndex, uint32_t positionLocation) { return TLayout::getAttributeDescription(bindingDescriptionIndex, positionLocation); }
 
-	struct Vk_Vertex_C {
+		// position stream of an interleaved vertex (see Vk_SoALayout)
+		template<class TVertex>
+		static Vk_Vertex_P fromVertex(const TVertex& vertex) { return { .pos = vertex.pos }; }
+	};
 
-		glm::tvec3<VK5::point_type> color;
+	// half float position stream, 8 instead of 12 bytes per vertex (see Vk_Vertex_PCN_Compact)
+	struct Vk_Vertex_P_Compact {
+		Vk_Packed<Vk_Half, 4> pos;
 
-		static int innerDimensionLen(){ return 3; }
+		typedef Vk_VertexLayout<Vk_Vertex_P_Compact, Vk_Field<&Vk_Vertex_P_Compact::pos>> TLayout;
 
-		static bool compare(const Vk_Vertex_C& color1, const Vk_Vertex_C& color2) {
-			glm::bvec3 res1 = glm::equal(color1.color, color2.color);
-			return res1.r && res1.g && res1.b;
-		}
+		static int innerDimensionLen(){ return TLayout::innerDimensionLen(); }
+		static bool compare(const Vk_Vertex_P_Compact& vertex1, const Vk_Vertex_P_Compact& vertex2) { return TLayout::compare(vertex1, vertex2); }
+		static VkVertexInputBindingDescription getBindingDescription(uint32_t bindingDescriptionIndex) { return TLayout::getBindingDescription(bindingDescriptionIndex); }
+		static VkVertexInputAttributeDescription getAttributeDescriptions(uint32_t bindingDescriptionIndex, uint32_t positionLocation) { return TLayout::getAttributeDescription(bindingDescriptionIndex, positionLocation); }
 
-		static VkVertexInputBindingDescription getBindingDescription(
-			uint32_t bindingDescriptionIndex
-		) {
-			// describes rate to load data from memory for vertices and
-			// number of bytes between data entries and so on
-			VkVertexInputBindingDescription bindingDescription{};
-			// index of binding in array of bindings
-			// layout(location = [bindingDescriptionIndex]) in vec3 inVertex;
-			bindingDescription.binding = bindingDescriptionIndex;
-			// number of bytes between beginning of two vertices
-			bindingDescription.stride = sizeof(Vk_Vertex_C);
-			// vertex or instance
-			bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-
-			return bindingDescription;
-		}
+		template<class TVertex>
+		static Vk_Vertex_P_Compact fromVertex(const TVertex& vertex) { return { .pos = Vk_Pack<Vk_Half, 4>(vertex.pos, 3) }; }
+	};
 
-		static VkVertexInputAttributeDescription getAttributeDescriptions(
-			uint32_t bindingDescriptionIndex,
-			uint32_t colorLocation
-		) {
+	struct Vk_Vertex_C {
+		glm::tvec3<VK5::point_type> color;
 
-			// the size of the array must match the amount of vector entries in the vertex
-			VkVertexInputAttributeDescription attributeDescription{};
+		typedef Vk_VertexLayout<Vk_Vertex_C, Vk_Field<&Vk_Vertex_C::color>> TLayout;
 
-			//! characteristics for color
-			// binding index
-			// layout(location = [bindingDescriptionIndex]) in vec3 inVertex;
-			attributeDescription.binding = bindingDescriptionIndex;
-			// shader location indicator
-			attributeDescription.location = colorLocation;
-			// format of the color data
-			attributeDescription.format = VK_FORMAT_R32G32B32_SFLOAT;
-			attributeDescription.offset = offsetof(Vk_Vertex_C, color);
+		static int innerDimensionLen(){ return TLayout::innerDimensionLen(); }
+		static bool compare(const Vk_Vertex_C& color1, const Vk_Vertex_C& color2) { return TLayout::compare(color1, color2); }
+		static VkVertexInputBindingDescription getBindingDescription(uint32_t bindingDescriptionIndex) { return TLayout::getBindingDescription(bindingDescriptionIndex); }
+		static VkVertexInputAttributeDescription getAttributeDescriptions(uint32_t bindingDescriptionIndex, uint32_t colorLocation) { return TLayout::getAttributeDescription(bindingDescriptionIndex, colorLocation); }
 
-			return attributeDescription;
-		}
+		template<class TVertex>
+		static Vk_Vertex_C fromVertex(const TVertex& vertex) { return { .color = vertex.color }; }
 	};
 
 	struct Vk_Vertex_N {
-
 		glm::tvec3<VK5::point_type> normal;
 
-		static int innerDimensionLen(){ return 3; }
+		typedef Vk_VertexLayout<Vk_Vertex_N, Vk_Field<&Vk_Vertex_N::normal>> TLayout;
 
-		static bool compare(const Vk_Vertex_N& normal1, const Vk_Vertex_N& normal2) {
-			glm::bvec3 res1 = glm::equal(normal1.normal, normal2.normal);
-			return res1.x && res1.y && res1.z;
-		}
+		static int innerDimensionLen(){ return TLayout::innerDimensionLen(); }
+		static bool compare(const Vk_Vertex_N& normal1, const Vk_Vertex_N& normal2) { return TLayout::compare(normal1, normal2); }
+		static VkVertexInputBindingDescription getBindingDescription(uint32_t bindingDescriptionIndex) { return TLayout::getBindingDescription(bindingDescriptionIndex); }
+		static VkVertexInputAttributeDescription getAttributeDescriptions(uint32_t bindingDescriptionIndex, uint32_t normalLocation) { return TLayout::getAttributeDescription(bindingDescriptionIndex, normalLocation); }
 
-		static VkVertexInputBindingDescription getBindingDescription(
-			uint32_t bindingDescriptionIndex
-		) {
-			// describes rate to load data from memory for vertices and
-			// number of bytes between data entries and so on
-			VkVertexInputBindingDescription bindingDescription{};
-			// index of binding in array of bindings
-			// layout(location = [bindingDescriptionIndex]) in vec3 inVertex;
-			bindingDescription.binding = bindingDescriptionIndex;
-			// number of bytes between beginning of two vertices
-			bindingDescription.stride = sizeof(Vk_Vertex_N);
-			// vertex or instance
-			bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-
-			return bindingDescription;
-		}
+		template<class TVertex>
+		static Vk_Vertex_N fromVertex(const TVertex& vertex) { return { .normal = vertex.normal }; }
+	};
 
-		static VkVertexInputAttributeDescription getAttributeDescriptions(
-			uint32_t bindingDescriptionIndex,
-			uint32_t normalLocation
-		) {
+	struct Vk_Vertex_T {
+		glm::tvec2<VK5::point_type> uv;
 
-			// the size of the array must match the amount of vector entries in the vertex
-			VkVertexInputAttributeDescription attributeDescription{};
+		typedef Vk_VertexLayout<Vk_Vertex_T, Vk_Field<&Vk_Vertex_T::uv>> TLayout;
 
-			//! characteristics for normal
-			// binding index
-			// layout(location = [bindingDescriptionIndex]) in vec3 inVertex;
-			attributeDescription.binding = bindingDescriptionIndex;
-			// shader location indicator
-			attributeDescription.location = normalLocation;
-			// format of the color data
-			attributeDescription.format = VK_FORMAT_R32G32B32_SFLOAT;
-			attributeDescription.offset = offsetof(Vk_Vertex_N, normal);
+		static int innerDimensionLen(){ return TLayout::innerDimensionLen(); }
+		static bool compare(const Vk_Vertex_T& uv1, const Vk_Vertex_T& uv2) { return TLayout::compare(uv1, uv2); }
+		static VkVertexInputBindingDescription getBindingDescription(uint32_t bindingDescriptionIndex) { return TLayout::getBindingDescription(bindingDescriptionIndex); }
+		static VkVertexInputAttributeDescription getAttributeDescriptions(uint32_t bindingDescriptionIndex, uint32_t uvLocation) { return TLayout::getAttributeDescription(bindingDescriptionIndex, uvLocation); }
 
-			return attributeDescription;
-		}
+		template<class TVertex>
+		static Vk_Vertex_T fromVertex(const TVertex& vertex) { return { .uv = vertex.uv }; }
 	};
 
-	struct Vk_Vertex_T {
-
-		glm::tvec2<VK5::point_type> uv;
+	/**
+	 * Structure of arrays layout: one vertex stream (= one buffer and one vertex binding) per attribute instead of
+	 * one interleaved Vk_Vertex_PC/PCN/PCNT. Every stream is one of the single attribute structures above.
+	 * Stream i is bound to binding firstBinding + i, so one vkCmdBindVertexBuffers(cmd, firstBinding, StreamCount, ...)
+	 * binds all of them (see Vk_SoADataBuffer::vk_buffers).
+	 */
+	template<class ...TStreams>
+	struct Vk_SoALayout {
+		static constexpr size_t StreamCount = sizeof...(TStreams);
 
-		static int innerDimensionLen(){ return 2; }
+		static int innerDimensionLen(){ return (TStreams::innerDimensionLen() + ...); }
 
-		static bool compare(const Vk_Vertex_T& uv1, const Vk_Vertex_T& uv2) {
-			glm::bvec2 res1 = glm::equal(uv1.uv, uv2.uv);
-			return res1.x && res1.y;
+		static std::vector<VkVertexInputBindingDescription> getBindingDescriptions(uint32_t firstBinding) {
+			return _getBindingDescriptions(firstBinding, std::index_sequence_for<TStreams...>{});
 		}
 
-		static VkVertexInputBindingDescription getBindingDescription(
-			uint32_t bindingDescriptionIndex
+		// locations in stream order, for example position, color, normal for Vk_SoA_PCN
+		static std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions(
+			uint32_t firstBinding,
+			const std::array<uint32_t, StreamCount>& locations
 		) {
-			// describes rate to load data from memory for vertices and
-			// number of bytes between data entries and so on
-			VkVertexInputBindingDescription bindingDescription{};
-			// index of binding in array of bindings
-			// layout(location = [bindingDescriptionIndex]) in vec3 inVertex;
-			bindingDescription.binding = bindingDescriptionIndex;
-			// number of bytes between beginning of two vertices
-			bindingDescription.stride = sizeof(Vk_Vertex_T);
-			// vertex or instance
-			bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-
-			return bindingDescription;
+			return _getAttributeDescriptions(firstBinding, locations, std::index_sequence_for<TStreams...>{});
 		}
 
-		static VkVertexInputAttributeDescription getAttributeDescriptions(
-			uint32_t bindingDescriptionIndex,
-			uint32_t normalLocation
-		) {
-
-			// the size of the array must match the amount of vector entries in the vertex
-			VkVertexInputAttributeDescription attributeDescription{};
-
-			//! characteristics for normal
-			// binding index
-			// layout(location = [bindingDescriptionIndex]) in vec3 inVertex;
-			attributeDescription.binding = bindingDescriptionIndex;
-			// shader location indicator
-			attributeDescription.location = normalLocation;
-			// format of the color data
-			attributeDescription.format = VK_FORMAT_R32G32_SFLOAT;
-			attributeDescription.offset = offsetof(Vk_Vertex_T, uv);
+	private:
+		template<size_t ...I>
+		static std::vector<VkVertexInputBindingDescription> _getBindingDescriptions(uint32_t firstBinding, std::index_sequence<I...>) {
+			return { TStreams::getBindingDescription(firstBinding + static_cast<uint32_t>(I))... };
+		}
 
-			return attributeDescription;
+		template<size_t ...I>
+		static std::vector<VkVertexInputAttributeDescription> _getAttributeDescriptions(
+			uint32_t firstBinding, const std::array<uint32_t, StreamCount>& locations, std::index_sequence<I...>
+		) {
+			return { TStreams::getAttributeDescriptions(firstBinding + static_cast<uint32_t>(I), locations[I])... };
 		}
 	};
-}
\ No newline at end of file
+
+	typedef Vk_SoALayout<Vk_Vertex_P, Vk_Vertex_C> Vk_SoA_PC;
+	typedef Vk_SoALayout<Vk_Vertex_P, Vk_Vertex_C, Vk_Vertex_N> Vk_SoA_PCN;
+	typedef Vk_SoALayout<Vk_Vertex_P, Vk_Vertex_C, Vk_Vertex_N, Vk_Vertex_T> Vk_SoA_PCNT;
+}
@@ -0,0 +1,251 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <tuple>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+#include "../Defines.h"
+#include "../utils/Ut_BlockDiff.hpp"
+
+namespace VK5 {
+	/**
+	 * Compact vertex components. Each one is stored as is in a vertex buffer and expanded by the vertex input stage,
+	 * the shader still sees vec2/vec3/vec4 of float. Use them in Vk_Packed arrays, for example Vk_Packed<Vk_Half, 4>
+	 * for a position of 8 instead of 12 bytes.
+	 * NOTE: three component 8 and 16 bit formats are optional for vertex input (and rarely supported), so the
+	 * predefined compact vertices use four components and leave the last one unused.
+	 */
+	// IEEE 754 half float => VK_FORMAT_R16..._SFLOAT
+	struct Vk_Half {
+		std::uint16_t bits;
+
+		static Vk_Half fromFloat(float value) {
+			std::uint32_t f;
+			std::memcpy(&f, &value, 4);
+			std::uint32_t sign = (f >> 16) & 0x8000;
+			std::uint32_t exponent = (f >> 23) & 0xFF;
+			std::uint32_t mantissa = f & 0x7FFFFF;
+
+			// NaN and Inf
+			if(exponent == 0xFF) return { static_cast<std::uint16_t>(sign | 0x7C00 | (mantissa ? 0x200 : 0)) };
+			int e = static_cast<int>(exponent) - 127 + 15;
+			// overflow => Inf
+			if(e >= 31) return { static_cast<std::uint16_t>(sign | 0x7C00) };
+			if(e <= 0){
+				// subnormal or zero
+				if(e < -10) return { static_cast<std::uint16_t>(sign) };
+				mantissa |= 0x800000;
+				std::uint32_t shift = static_cast<std::uint32_t>(14 - e);
+				std::uint32_t half = mantissa >> shift;
+				std::uint32_t rest = mantissa & ((1u << shift) - 1);
+				std::uint32_t halfway = 1u << (shift - 1);
+				if(rest > halfway || (rest == halfway && (half & 1))) ++half;
+				return { static_cast<std::uint16_t>(sign | half) };
+			}
+			// round to nearest even, a carry into the exponent is correct (up to Inf)
+			std::uint32_t half = sign | (static_cast<std::uint32_t>(e) << 10) | (mantissa >> 13);
+			std::uint32_t rest = mantissa & 0x1FFF;
+			if(rest > 0x1000 || (rest == 0x1000 && (half & 1))) ++half;
+			return { static_cast<std::uint16_t>(half) };
+		}
+
+		float toFloat() const {
+			std::uint32_t sign = static_cast<std::uint32_t>(bits & 0x8000) << 16;
+			std::uint32_t exponent = (bits >> 10) & 0x1F;
+			std::uint32_t mantissa = bits & 0x3FF;
+			std::uint32_t f;
+			if(exponent == 0x1F) f = sign | 0x7F800000 | (mantissa << 13);
+			else if(exponent != 0) f = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+			else if(mantissa == 0) f = sign;
+			else {
+				// subnormal half => normal float
+				int e = -1;
+				do { mantissa <<= 1; ++e; } while((mantissa & 0x400) == 0);
+				f = sign | (static_cast<std::uint32_t>(127 - 15 - e) << 23) | ((mantissa & 0x3FF) << 13);
+			}
+			float value;
+			std::memcpy(&value, &f, 4);
+			return value;
+		}
+
+		bool operator==(const Vk_Half& other) const = default;
+	};
+
+	// [-1, 1] => VK_FORMAT_R16..._SNORM
+	struct Vk_Snorm16 {
+		std::int16_t value;
+
+		static Vk_Snorm16 fromFloat(float f) { return { static_cast<std::int16_t>(std::lround(std::clamp(f, -1.0f, 1.0f) * 32767.0f)) }; }
+		float toFloat() const { return std::max(static_cast<float>(value) / 32767.0f, -1.0f); }
+		bool operator==(const Vk_Snorm16& other) const = default;
+	};
+
+	// [0, 1] => VK_FORMAT_R16..._UNORM
+	struct Vk_Unorm16 {
+		std::uint16_t value;
+
+		static Vk_Unorm16 fromFloat(float f) { return { static_cast<std::uint16_t>(std::lround(std::clamp(f, 0.0f, 1.0f) * 65535.0f)) }; }
+		float toFloat() const { return static_cast<float>(value) / 65535.0f; }
+		bool operator==(const Vk_Unorm16& other) const = default;
+	};
+
+	// [0, 1] => VK_FORMAT_R8..._UNORM
+	struct Vk_Unorm8 {
+		std::uint8_t value;
+
+		static Vk_Unorm8 fromFloat(float f) { return { static_cast<std::uint8_t>(std::lround(std::clamp(f, 0.0f, 1.0f) * 255.0f)) }; }
+		float toFloat() const { return static_cast<float>(value) / 255.0f; }
+		bool operator==(const Vk_Unorm8& other) const = default;
+	};
+
+	template<class TComponent, size_t N>
+	using Vk_Packed = std::array<TComponent, N>;
+
+	// x, y, z, ... of a glm vector into a Vk_Packed, missing components are 0
+	template<class TComponent, size_t N, class TVec>
+	static Vk_Packed<TComponent, N> Vk_Pack(const TVec& vec, int len) {
+		Vk_Packed<TComponent, N> packed;
+		for(int i=0; i<static_cast<int>(N); ++i) packed[i] = TComponent::fromFloat(i < len ? static_cast<float>(vec[i]) : 0.0f);
+		return packed;
+	}
+
+	/**
+	 * Vertex input format of one field type: format, amount of components and equality.
+	 * Specialized for the glm vectors of float and for Vk_Packed arrays of the compact components.
+	 */
+	template<class TField>
+	struct Vk_FieldFormat;
+
+	template<class TComponent>
+	struct Vk_ComponentFormats;
+
+	template<> struct Vk_ComponentFormats<Vk_Half> {
+		static constexpr VkFormat formats[4] = { VK_FORMAT_R16_SFLOAT, VK_FORMAT_R16G16_SFLOAT, VK_FORMAT_R16G16B16_SFLOAT, VK_FORMAT_R16G16B16A16_SFLOAT };
+	};
+	template<> struct Vk_ComponentFormats<Vk_Snorm16> {
+		static constexpr VkFormat formats[4] = { VK_FORMAT_R16_SNORM, VK_FORMAT_R16G16_SNORM, VK_FORMAT_R16G16B16_SNORM, VK_FORMAT_R16G16B16A16_SNORM };
+	};
+	template<> struct Vk_ComponentFormats<Vk_Unorm16> {
+		static constexpr VkFormat formats[4] = { VK_FORMAT_R16_UNORM, VK_FORMAT_R16G16_UNORM, VK_FORMAT_R16G16B16_UNORM, VK_FORMAT_R16G16B16A16_UNORM };
+	};
+	template<> struct Vk_ComponentFormats<Vk_Unorm8> {
+		static constexpr VkFormat formats[4] = { VK_FORMAT_R8_UNORM, VK_FORMAT_R8G8_UNORM, VK_FORMAT_R8G8B8_UNORM, VK_FORMAT_R8G8B8A8_UNORM };
+	};
+
+	template<class TComponent, size_t N>
+	struct Vk_FieldFormat<Vk_Packed<TComponent, N>> {
+		static_assert(N >= 1 && N <= 4, "Vk_Packed vertex fields have 1 to 4 components");
+		static constexpr VkFormat format = Vk_ComponentFormats<TComponent>::formats[N-1];
+		static constexpr int dimension = static_cast<int>(N);
+		static bool equal(const Vk_Packed<TComponent, N>& a, const Vk_Packed<TComponent, N>& b) { return a == b; }
+	};
+
+	template<> struct Vk_FieldFormat<glm::tvec2<float>> {
+		static constexpr VkFormat format = VK_FORMAT_R32G32_SFLOAT;
+		static constexpr int dimension = 2;
+		static bool equal(const glm::tvec2<float>& a, const glm::tvec2<float>& b) { glm::bvec2 res = glm::equal(a, b); return res.x && res.y; }
+	};
+	template<> struct Vk_FieldFormat<glm::tvec3<float>> {
+		static constexpr VkFormat format = VK_FORMAT_R32G32B32_SFLOAT;
+		static constexpr int dimension = 3;
+		static bool equal(const glm::tvec3<float>& a, const glm::tvec3<float>& b) { glm::bvec3 res = glm::equal(a, b); return res.x && res.y && res.z; }
+	};
+	template<> struct Vk_FieldFormat<glm::tvec4<float>> {
+		static constexpr VkFormat format = VK_FORMAT_R32G32B32A32_SFLOAT;
+		static constexpr int dimension = 4;
+		static bool equal(const glm::tvec4<float>& a, const glm::tvec4<float>& b) { glm::bvec4 res = glm::equal(a, b); return res.x && res.y && res.z && res.w; }
+	};
+
+	// one field of a vertex, Member is a pointer to data member (&Vk_Vertex_PC::pos)
+	template<auto Member>
+	struct Vk_Field;
+
+	template<class TVertex, class TType, TType TVertex::* Member>
+	struct Vk_Field<Member> {
+		typedef TType TFieldType;
+		static constexpr VkFormat format = Vk_FieldFormat<TType>::format;
+		static constexpr int dimension = Vk_FieldFormat<TType>::dimension;
+
+		static uint32_t offset() {
+			// NOTE: offsetof can't take a member pointer, measure it on a probe instead (the vertices are aggregates)
+			static const TVertex probe{};
+			return static_cast<uint32_t>(reinterpret_cast<const char*>(&(probe.*Member)) - reinterpret_cast<const char*>(&probe));
+		}
+
+		static bool equal(const TVertex& a, const TVertex& b) { return Vk_FieldFormat<TType>::equal(a.*Member, b.*Member); }
+	};
+
+	/**
+	 * Everything the vertex input stage and Vk_DataBuffer need from a vertex, generated from its field list:
+	 *    struct Vk_Vertex_PC {
+	 *        glm::tvec3<VK5::point_type> pos;
+	 *        glm::tvec3<VK5::point_type> color;
+	 *        typedef Vk_VertexLayout<Vk_Vertex_PC, Vk_Field<&Vk_Vertex_PC::pos>, Vk_Field<&Vk_Vertex_PC::color>> TLayout;
+	 *    };
+	 * Formats come from Vk_FieldFormat, offsets from the fields and the stride is sizeof(TVertex). All fields of one
+	 * vertex go into one binding, locations are given in field order.
+	 */
+	template<class TVertex, class ...TFields>
+	struct Vk_VertexLayout {
+		static constexpr size_t FieldCount = sizeof...(TFields);
+		// true if the fields cover the whole vertex (no padding), so vertices can be compared byte wise
+		static constexpr bool Dense = (sizeof(typename TFields::TFieldType) + ...) == sizeof(TVertex);
+
+		static int innerDimensionLen(){ return (TFields::dimension + ...); }
+
+		static bool compare(const TVertex& v1, const TVertex& v2) { return (TFields::equal(v1, v2) && ...); }
+
+		/**
+		 * Compare count vertices at once. Dense vertices are compared 16 bytes at a time (see UT::Ut_BlockDiff).
+		 * NOTE: byte wise, so unlike compare, 0.0f and -0.0f differ and equal NaNs don't.
+		 */
+		static bool compareAll(const TVertex* v1, const TVertex* v2, size_t count) {
+			if constexpr (Dense) return !UT::Ut_BlockDiff::differs(reinterpret_cast<const uint8_t*>(v1), reinterpret_cast<const uint8_t*>(v2), count * sizeof(TVertex));
+			for(size_t i=0; i<count; ++i) if(!compare(v1[i], v2[i])) return false;
+			return true;
+		}
+
+		static VkVertexInputBindingDescription getBindingDescription(uint32_t bindingDescriptionIndex) {
+			VkVertexInputBindingDescription bindingDescription{};
+			bindingDescription.binding = bindingDescriptionIndex;
+			bindingDescription.stride = sizeof(TVertex);
+			bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+			return bindingDescription;
+		}
+
+		static std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions(
+			uint32_t bindingDescriptionIndex,
+			const std::array<uint32_t, FieldCount>& locations
+		) {
+			return _getAttributeDescriptions(bindingDescriptionIndex, locations, std::make_index_sequence<FieldCount>{});
+		}
+
+		// single field layouts (Vk_Vertex_P, ...)
+		static VkVertexInputAttributeDescription getAttributeDescription(uint32_t bindingDescriptionIndex, uint32_t location) {
+			static_assert(FieldCount == 1, "Vk_VertexLayout::getAttributeDescription is only available for single field layouts");
+			return getAttributeDescriptions(bindingDescriptionIndex, {location}).at(0);
+		}
+
+	private:
+		template<class TField>
+		static VkVertexInputAttributeDescription _getAttributeDescription(uint32_t bindingDescriptionIndex, uint32_t location) {
+			VkVertexInputAttributeDescription attributeDescription{};
+			attributeDescription.binding = bindingDescriptionIndex;
+			attributeDescription.location = location;
+			attributeDescription.format = TField::format;
+			attributeDescription.offset = TField::offset();
+			return attributeDescription;
+		}
+
+		template<size_t ...I>
+		static std::vector<VkVertexInputAttributeDescription> _getAttributeDescriptions(
+			uint32_t bindingDescriptionIndex, const std::array<uint32_t, FieldCount>& locations, std::index_sequence<I...>
+		) {
+			return { _getAttributeDescription<TFields>(bindingDescriptionIndex, locations[I])... };
+		}
+	};
+}
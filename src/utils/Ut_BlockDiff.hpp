@@ -0,0 +1,77 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define UT_BLOCK_DIFF_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	#include <arm_neon.h>
+	#define UT_BLOCK_DIFF_NEON
+#endif
+
+namespace UT {
+	// byte span [from, to)
+	struct Ut_ByteSpan {
+		size_t from;
+		size_t to;
+	};
+
+	/**
+	 * Block level diff of two memory areas. Instead of comparing element by element, both areas are
+	 * compared in blocks of blockSize bytes, 16 bytes at a time (SSE2 on x86, NEON on arm64, 8 bytes
+	 * otherwise). A block only tells whether anything in it changed, which is all an upload needs.
+	 */
+	class Ut_BlockDiff {
+	public:
+		// true if [a, a+size) and [b, b+size) differ anywhere
+		static bool differs(const uint8_t* a, const uint8_t* b, size_t size) {
+			size_t i = 0;
+#if defined(UT_BLOCK_DIFF_SSE2)
+			__m128i acc = _mm_setzero_si128();
+			for(; i + 16 <= size; i += 16){
+				__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+				__m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+				acc = _mm_or_si128(acc, _mm_xor_si128(x, y));
+			}
+			if(_mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128())) != 0xFFFF) return true;
+#elif defined(UT_BLOCK_DIFF_NEON)
+			uint8x16_t acc = vdupq_n_u8(0);
+			for(; i + 16 <= size; i += 16){
+				acc = vorrq_u8(acc, veorq_u8(vld1q_u8(a + i), vld1q_u8(b + i)));
+			}
+			if(vmaxvq_u8(acc) != 0) return true;
+#endif
+			uint64_t acc64 = 0;
+			for(; i + 8 <= size; i += 8){
+				uint64_t x, y;
+				std::memcpy(&x, a + i, 8);
+				std::memcpy(&y, b + i, 8);
+				acc64 |= x ^ y;
+			}
+			for(; i < size; ++i) acc64 |= static_cast<uint64_t>(a[i] ^ b[i]);
+			return acc64 != 0;
+		}
+
+		/**
+		 * Spans of blocks that differ between a and b (byteSize bytes each). Neighbouring changed blocks end up in the
+		 * same span. The spans are block aligned, except for the end of the last block.
+		 */
+		static std::vector<Ut_ByteSpan> diff(const void* a, const void* b, size_t byteSize, size_t blockSize) {
+			const uint8_t* pa = static_cast<const uint8_t*>(a);
+			const uint8_t* pb = static_cast<const uint8_t*>(b);
+			std::vector<Ut_ByteSpan> spans;
+			for(size_t from = 0; from < byteSize; from += blockSize){
+				size_t to = std::min(from + blockSize, byteSize);
+				if(!differs(pa + from, pb + from, to - from)) continue;
+				if(!spans.empty() && spans.back().to == from) spans.back().to = to;
+				else spans.push_back({.from=from, .to=to});
+			}
+			return spans;
+		}
+	};
+}
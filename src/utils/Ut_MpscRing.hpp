@@ -0,0 +1,242 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <thread>
+#include <cstdint>
+#include <cassert>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include <algorithm>
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+	#include <immintrin.h>
+#endif
+
+namespace UT {
+	// upper bound of the spin budget of Ut_Parker (iterations with a cpu pause each, roughly 10-40us)
+	constexpr int GLOBAL_PARKER_MAX_SPIN = 1024;
+	// lower bound of the spin budget, so that it can grow again
+	constexpr int GLOBAL_PARKER_MIN_SPIN = 16;
+
+	/**
+	 * Futex style parking spot for one consumer thread (event count). Several consumers may share one: notify wakes all of them.
+	 * The consumer calls prepareWait, re-checks its condition and then either calls wait or cancelWait.
+	 * Producers call notify after they published something. notify is a single load if nobody is parked.
+	 * NOTE: the seq_cst fences are what makes this work: either the producer sees the waiter
+	 * or the consumer sees the published element on its re-check. Never neither of them.
+	 */
+	class Ut_Parker {
+		std::atomic<uint32_t> _epoch;
+		std::atomic<uint32_t> _waiters;
+		// std::atomic::wait has no timeout => timed waits (waitUntil) sleep on a condition variable instead
+		std::atomic<uint32_t> _timedWaiters;
+		std::mutex _timedMutex;
+		std::condition_variable _timedCondition;
+		/**
+		 * Adaptive spin before the futex: doubles when spinning caught the element, halves when the thread had to park
+		 * anyway. The first half of the iterations only pause the cpu, the second half yields to the producers.
+		 * Machines with a single hardware thread only yield: the producer can't run while the consumer spins.
+		 */
+		std::atomic<int> _spinBudget;
+		const bool _yieldOnly;
+
+	public:
+		Ut_Parker() : _epoch(0), _waiters(0), _timedWaiters(0), _spinBudget(GLOBAL_PARKER_MAX_SPIN / 4), _yieldOnly(std::thread::hardware_concurrency() <= 1) {}
+
+		Ut_Parker(const Ut_Parker& other) = delete;
+		Ut_Parker(Ut_Parker&& other) = delete;
+		Ut_Parker& operator=(const Ut_Parker& other) = delete;
+		Ut_Parker& operator=(Ut_Parker&& other) = delete;
+
+		uint32_t prepareWait() {
+			_waiters.fetch_add(1, std::memory_order_seq_cst);
+			uint32_t key = _epoch.load(std::memory_order_seq_cst);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			return key;
+		}
+
+		void cancelWait() {
+			_waiters.fetch_sub(1, std::memory_order_relaxed);
+		}
+
+		void wait(uint32_t key) {
+			// std::atomic::wait blocks on a futex (linux) or WaitOnAddress (windows)
+			_epoch.wait(key, std::memory_order_seq_cst);
+			_waiters.fetch_sub(1, std::memory_order_relaxed);
+		}
+
+		// like wait, but returns at deadline at the latest
+		void waitUntil(uint32_t key, std::chrono::steady_clock::time_point deadline) {
+			_timedWaiters.fetch_add(1, std::memory_order_seq_cst);
+			{
+				std::unique_lock<std::mutex> lock(_timedMutex);
+				_timedCondition.wait_until(lock, deadline, [this, key](){ return _epoch.load(std::memory_order_seq_cst) != key; });
+			}
+			_timedWaiters.fetch_sub(1, std::memory_order_relaxed);
+			_waiters.fetch_sub(1, std::memory_order_relaxed);
+		}
+
+		/**
+		 * Block the calling (consumer) thread until ready() returns true. Spins first (see _spinBudget):
+		 * with a steady stream of elements the next one shows up within a few microseconds and the futex round trip
+		 * (a syscall on both sides) costs more than that. maxSpin caps the spin budget.
+		 */
+		template<class TReady>
+		void park(TReady ready, int maxSpin = GLOBAL_PARKER_MAX_SPIN) {
+			if(_spin(ready, maxSpin)) return;
+			while(!ready()){
+				uint32_t key = prepareWait();
+				if(ready()){
+					cancelWait();
+					return;
+				}
+				wait(key);
+			}
+		}
+
+		/**
+		 * Like park, but gives up at deadline. Returns ready(). For consumers that have to look at something
+		 * nobody notifies them about (deadlines, fences that are polled).
+		 */
+		template<class TReady>
+		bool parkUntil(TReady ready, std::chrono::steady_clock::time_point deadline, int maxSpin = GLOBAL_PARKER_MAX_SPIN) {
+			if(_spin(ready, maxSpin)) return true;
+			while(!ready()){
+				if(std::chrono::steady_clock::now() >= deadline) return false;
+				uint32_t key = prepareWait();
+				if(ready()){
+					cancelWait();
+					return true;
+				}
+				waitUntil(key, deadline);
+			}
+			return true;
+		}
+
+		void notify() {
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if(_waiters.load(std::memory_order_seq_cst) == 0) return;
+			_epoch.fetch_add(1, std::memory_order_seq_cst);
+			_epoch.notify_all();
+			if(_timedWaiters.load(std::memory_order_seq_cst) == 0) return;
+			{
+				// NOTE: lock once: the timed waiter either didn't check _epoch yet or already sleeps
+				std::unique_lock<std::mutex> lock(_timedMutex);
+			}
+			_timedCondition.notify_all();
+		}
+
+	private:
+		template<class TReady>
+		bool _spin(TReady& ready, int maxSpin) {
+			int budget = std::min(_spinBudget.load(std::memory_order_relaxed), maxSpin);
+			for(int i=0; i<budget; ++i){
+				if(ready()){
+					_spinBudget.store(std::min(std::max(budget * 2, GLOBAL_PARKER_MIN_SPIN), GLOBAL_PARKER_MAX_SPIN), std::memory_order_relaxed);
+					return true;
+				}
+				if(_yieldOnly || i > budget / 2) std::this_thread::yield();
+				else _cpuRelax();
+			}
+			if(ready()) return true;
+			_spinBudget.store(std::max(budget / 2, GLOBAL_PARKER_MIN_SPIN), std::memory_order_relaxed);
+			return false;
+		}
+
+		// tells the core that this is a spin loop (frees resources for the sibling hyper thread)
+		static void _cpuRelax() {
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+			_mm_pause();
+#elif defined(__aarch64__)
+			asm volatile("yield");
+#endif
+		}
+	};
+
+	/**
+	 * Bounded lock free multi producer/single consumer ring (Vyukov style sequence numbers per cell).
+	 * Producers claim a cell with one CAS on the tail, the consumer never writes anything a producer reads
+	 * except for the cell sequence. The capacity is rounded up to the next power of two.
+	 * T must be default constructible and movable (std::unique_ptr, Vulkan handles...).
+	 */
+	template<class T>
+	class Ut_MpscRing {
+		struct alignas(64) Cell {
+			std::atomic<size_t> sequence;
+			T data;
+		};
+
+		const size_t _mask;
+		std::vector<Cell> _cells;
+		alignas(64) std::atomic<size_t> _tail;
+		alignas(64) size_t _head;
+
+	public:
+		Ut_MpscRing(size_t capacity)
+		:
+		_mask(_roundUp(capacity) - 1),
+		_cells(_mask + 1),
+		_tail(0),
+		_head(0)
+		{
+			for(size_t i=0; i<_cells.size(); ++i) _cells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+
+		Ut_MpscRing(const Ut_MpscRing& other) = delete;
+		Ut_MpscRing(Ut_MpscRing&& other) = delete;
+		Ut_MpscRing& operator=(const Ut_MpscRing& other) = delete;
+		Ut_MpscRing& operator=(Ut_MpscRing&& other) = delete;
+
+		size_t capacity() const { return _mask + 1; }
+
+		// any thread. Returns false if the ring is full, value is left untouched in that case
+		bool tryPush(T& value) {
+			size_t pos = _tail.load(std::memory_order_relaxed);
+			while(true){
+				Cell& cell = _cells[pos & _mask];
+				size_t seq = cell.sequence.load(std::memory_order_acquire);
+				intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+				if(diff == 0){
+					if(_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+						cell.data = std::move(value);
+						cell.sequence.store(pos + 1, std::memory_order_release);
+						return true;
+					}
+				}
+				else if(diff < 0) return false;
+				else pos = _tail.load(std::memory_order_relaxed);
+			}
+		}
+
+		// any thread. Spins (yields) as long as the ring is full => backpressure on the producers
+		void push(T value) {
+			while(!tryPush(value)) std::this_thread::yield();
+		}
+
+		// consumer thread only
+		bool tryPop(T& value) {
+			Cell& cell = _cells[_head & _mask];
+			size_t seq = cell.sequence.load(std::memory_order_acquire);
+			if(static_cast<intptr_t>(seq) - static_cast<intptr_t>(_head + 1) < 0) return false;
+			value = std::move(cell.data);
+			cell.sequence.store(_head + _mask + 1, std::memory_order_release);
+			_head++;
+			return true;
+		}
+
+		// consumer thread only
+		bool empty() const {
+			const Cell& cell = _cells[_head & _mask];
+			return static_cast<intptr_t>(cell.sequence.load(std::memory_order_acquire)) - static_cast<intptr_t>(_head + 1) < 0;
+		}
+
+	private:
+		static size_t _roundUp(size_t capacity) {
+			assert(capacity > 0);
+			size_t res = 1;
+			while(res < capacity) res <<= 1;
+			return res;
+		}
+	};
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <map>
+#include <cstdint>
+#include <algorithm>
+
+namespace UT {
+	/**
+	 * Offset allocator over [0, size), for sub-allocating one big memory block.
+	 * Free ranges are kept twice: ordered by offset (neighbours are merged on free) and ordered by size
+	 * (allocate takes the smallest free range the request fits into, best fit). free is O(log n). allocate
+	 * starts at the smallest range that is large enough in O(log n), but has to skip ranges that are too
+	 * small once the alignment padding is added: O(n) in the worst case.
+	 * The allocator only hands out offsets, it never touches the memory itself.
+	 * NOTE: not thread safe
+	 */
+	class Ut_RangeAllocator {
+		std::uint64_t _size;
+		std::uint64_t _used;
+		// offset => size
+		std::map<std::uint64_t, std::uint64_t> _freeByOffset;
+		// size => offset
+		std::multimap<std::uint64_t, std::uint64_t> _freeBySize;
+
+	public:
+		static constexpr std::uint64_t InvalidOffset = ~std::uint64_t(0);
+
+		explicit Ut_RangeAllocator(std::uint64_t size)
+		: _size(size), _used(0)
+		{
+			if(size > 0) _insertFree(0, size);
+		}
+
+		std::uint64_t size() const { return _size; }
+		std::uint64_t used() const { return _used; }
+		bool empty() const { return _used == 0; }
+		// amount of free ranges, 1 means not fragmented at all
+		size_t freeRangeCount() const { return _freeByOffset.size(); }
+		std::uint64_t largestFree() const { return _freeBySize.empty() ? 0 : _freeBySize.rbegin()->first; }
+
+		/**
+		 * Offset of size bytes aligned to alignment (power of two) or InvalidOffset if nothing fits.
+		 * The padding in front of an aligned range stays free.
+		 */
+		std::uint64_t allocate(std::uint64_t size, std::uint64_t alignment) {
+			if(size == 0) return InvalidOffset;
+			alignment = std::max<std::uint64_t>(alignment, 1);
+			for(auto iter = _freeBySize.lower_bound(size); iter != _freeBySize.end(); ++iter){
+				std::uint64_t freeOffset = iter->second;
+				std::uint64_t freeSize = iter->first;
+				std::uint64_t offset = (freeOffset + alignment - 1) & ~(alignment - 1);
+				if(offset + size > freeOffset + freeSize) continue;
+
+				_freeBySize.erase(iter);
+				_freeByOffset.erase(freeOffset);
+				if(offset > freeOffset) _insertFree(freeOffset, offset - freeOffset);
+				if(offset + size < freeOffset + freeSize) _insertFree(offset + size, freeOffset + freeSize - offset - size);
+				_used += size;
+				return offset;
+			}
+			return InvalidOffset;
+		}
+
+		// offset and size exactly as allocated
+		void free(std::uint64_t offset, std::uint64_t size) {
+			_used -= size;
+			auto next = _freeByOffset.lower_bound(offset);
+			if(next != _freeByOffset.end() && next->first == offset + size){
+				size += next->second;
+				_eraseFree(next);
+			}
+			auto prev = _freeByOffset.lower_bound(offset);
+			if(prev != _freeByOffset.begin()){
+				--prev;
+				if(prev->first + prev->second == offset){
+					offset = prev->first;
+					size += prev->second;
+					_eraseFree(prev);
+				}
+			}
+			_insertFree(offset, size);
+		}
+
+	private:
+		void _insertFree(std::uint64_t offset, std::uint64_t size) {
+			_freeByOffset.insert({offset, size});
+			_freeBySize.insert({size, offset});
+		}
+
+		void _eraseFree(std::map<std::uint64_t, std::uint64_t>::iterator iter) {
+			auto range = _freeBySize.equal_range(iter->second);
+			for(auto s = range.first; s != range.second; ++s){
+				if(s->second == iter->first){ _freeBySize.erase(s); break; }
+			}
+			_freeByOffset.erase(iter);
+		}
+	};
+}
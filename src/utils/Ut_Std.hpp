@@ -44,6 +44,12 @@ namespace UT {
 			return ss.str();
 		}
 
+		// same as boost::hash_combine
+		template<class T>
+		static void hash_combine(size_t& seed, const T& value){
+			seed ^= std::hash<T>{}(value) + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2);
+		}
+
 		template<class TKey, class TValue>
 		static std::vector<TKey> umap_keys_to_vec(const std::unordered_map<TKey, TValue>& map){
 			std::vector<TKey> keys;
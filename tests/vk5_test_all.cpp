@@ -45,4 +45,9 @@
 // #include "vk5_test_terminal_colors.cpp"
 #include "vk5_test_viewer.cpp"
 // #include "vk5_test_device.cpp"
-// #include "vk5_test_data_buffers.cpp"
\ No newline at end of file
+// #include "vk5_test_data_buffers.cpp"
+// #include "vk5_test_mpsc_ring.cpp"
+// #include "vk5_test_block_diff.cpp"
+// #include "vk5_test_vertex_layout.cpp"
+// #include "vk5_test_range_allocator.cpp"
+// #include "vk5_test_memory_budget.cpp"
\ No newline at end of file
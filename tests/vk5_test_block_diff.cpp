@@ -0,0 +1,49 @@
+#ifndef BOOST_TEST_INCLUDED
+    #include "boost/test/included/unit_test.hpp"
+#endif
+
+#include <vector>
+#include <cstdint>
+#include <numeric>
+
+#include "../src/utils/Ut_BlockDiff.hpp"
+
+BOOST_AUTO_TEST_SUITE(TestBlockDiff)
+
+auto new_test = boost::unit_test::enabled();
+auto all_tests = boost::unit_test::disabled();
+
+BOOST_AUTO_TEST_CASE(TestBlockDiffSpans, *new_test) {
+    // odd size: the last block and the tail of differs() are shorter than 16 bytes
+    std::vector<uint8_t> a(1000);
+    std::iota(a.begin(), a.end(), 0);
+    std::vector<uint8_t> b = a;
+
+    BOOST_CHECK(UT::Ut_BlockDiff::diff(a.data(), b.data(), a.size(), 64).empty());
+
+    b[3] ^= 1;      // block 0
+    b[70] ^= 1;     // block 1 => merged with block 0
+    b[500] ^= 1;    // block 7
+    b[999] ^= 1;    // block 15, only 40 bytes long
+    auto spans = UT::Ut_BlockDiff::diff(a.data(), b.data(), a.size(), 64);
+    BOOST_REQUIRE_EQUAL(spans.size(), 3);
+    BOOST_CHECK_EQUAL(spans[0].from, 0);
+    BOOST_CHECK_EQUAL(spans[0].to, 128);
+    BOOST_CHECK_EQUAL(spans[1].from, 448);
+    BOOST_CHECK_EQUAL(spans[1].to, 512);
+    BOOST_CHECK_EQUAL(spans[2].from, 960);
+    BOOST_CHECK_EQUAL(spans[2].to, 1000);
+}
+
+BOOST_AUTO_TEST_CASE(TestBlockDiffEveryByte, *new_test) {
+    // a change in any position of a block must be found, no matter which code path of differs() covers it
+    std::vector<uint8_t> a(37, 7);
+    for(size_t i=0; i<a.size(); ++i){
+        std::vector<uint8_t> b = a;
+        b[i] = 8;
+        BOOST_CHECK(UT::Ut_BlockDiff::differs(a.data(), b.data(), a.size()));
+    }
+    BOOST_CHECK(!UT::Ut_BlockDiff::differs(a.data(), a.data(), a.size()));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
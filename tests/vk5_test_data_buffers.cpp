@@ -13,7 +13,9 @@
 
 #include "test_utilities.hpp"
 #include "test_data.hpp"
+#include "../src/application/Vk_Device.h"
 #include "../src/buffers/Vk_DataBuffer.hpp"
+#include "../src/buffers/Vk_ChunkedDataBuffer.hpp"
 
 BOOST_AUTO_TEST_SUITE(RunTestVk5DataBuffers)
 
@@ -388,4 +390,64 @@ BOOST_AUTO_TEST_CASE(Test_Buffers, *all_tests) {
 	outStream.close();
 }
 */
+
+BOOST_AUTO_TEST_CASE(Test_CoalesceRanges, *all_tests) {
+	using Range = VK5::Vk_DataBufferLib::Range;
+	// unsorted, overlapping, adjacent, close and empty ranges
+	std::vector<Range> ranges = { {.from=50, .to=60}, {.from=0, .to=10}, {.from=5, .to=12}, {.from=12, .to=20}, {.from=23, .to=30}, {.from=40, .to=40} };
+
+	auto merged = VK5::Vk_DataBufferLib::coalesceRanges(ranges, 0);
+	BOOST_CHECK_EQUAL(merged.size(), 3);
+	BOOST_CHECK_EQUAL(merged.at(0).from, 0);
+	BOOST_CHECK_EQUAL(merged.at(0).to, 20);
+	BOOST_CHECK_EQUAL(merged.at(1).from, 23);
+	BOOST_CHECK_EQUAL(merged.at(2).to, 60);
+
+	// a gap of 3 elements between 20 and 23 is merged
+	merged = VK5::Vk_DataBufferLib::coalesceRanges(ranges, 3);
+	BOOST_CHECK_EQUAL(merged.size(), 2);
+	BOOST_CHECK_EQUAL(merged.at(0).to, 30);
+	BOOST_CHECK_EQUAL(merged.at(1).from, 50);
+}
+
+BOOST_AUTO_TEST_CASE(Test_ChunkedDataBuffer, *all_tests) {
+	std::vector<VK5::Vk_GpuOp> priorities = {VK5::Vk_GpuOp::Compute, VK5::Vk_GpuOp::Graphics, VK5::Vk_GpuOp::Transfer};
+	VK5::Vk_Device device("test", VK5::Vk_DevicePreference::USE_ANY_GPU, priorities);
+
+	for(auto& d : device.PhysicalDevices){
+		typedef VK5::Vk_Vertex_PC Type;
+		auto data = UT::VK5TestData::Cube1_PC();
+		const size_t blockCount = 3;
+		const size_t usedBlocks = (data.size() + blockCount - 1) / blockCount;
+
+		VK5::Vk_ChunkedDataBuffer<Type> buffer(&d.second, "TestObj", data.data(), data.size(), "TestChunked", blockCount * sizeof(Type));
+		BOOST_CHECK_EQUAL(buffer.blockCount(), blockCount);
+		BOOST_CHECK_EQUAL(buffer.bufferCount(), data.size());
+		BOOST_CHECK_EQUAL(buffer.maxBufferCount(), usedBlocks * blockCount);
+
+		auto ranges = buffer.bindRanges();
+		BOOST_CHECK_EQUAL(ranges.size(), usedBlocks);
+		size_t total = 0;
+		for(size_t i=0; i<ranges.size(); ++i){
+			BOOST_CHECK_EQUAL(ranges.at(i).firstElement, i * blockCount);
+			total += ranges.at(i).count;
+		}
+		BOOST_CHECK_EQUAL(total, data.size());
+
+		// append a few blocks and shrink right away: shrinkToFit waits for the copies into the blocks it frees
+		std::vector<Type> more = data;
+		more.insert(more.end(), data.begin(), data.end());
+		VK5::Vk_GpuFuture appended = buffer.update(more.data(), more.size(), data.size());
+		BOOST_CHECK_EQUAL(buffer.bufferCount(), more.size());
+		BOOST_CHECK(buffer.maxBufferCount() >= more.size());
+		buffer.update(data.data(), data.size(), 0, 1);
+		BOOST_CHECK(appended.ready());
+		buffer.shrinkToFit();
+		BOOST_CHECK_EQUAL(buffer.maxBufferCount(), usedBlocks * blockCount);
+		BOOST_CHECK_EQUAL(buffer.bindRanges().size(), usedBlocks);
+
+		// the destructor waits for this one
+		buffer.update(more.data(), more.size(), 0);
+	}
+}
 BOOST_AUTO_TEST_SUITE_END()
\ No newline at end of file
@@ -108,6 +108,10 @@ BOOST_AUTO_TEST_CASE(TestDeviceInit1, *all_tests)
     ff.close();
 }
 
+std::unique_ptr<VK5::Vk_GpuTask> createTask(VK5::Vk_PhysicalDevice& dev, VK5::Vk_GpuOp op){
+    return std::make_unique<VK5::Vk_GpuTask>(dev.vk_logicalDevice(), op, dev.physicalDevicePR().extensionSupport.timelineSemaphore);
+}
+
 BOOST_AUTO_TEST_CASE(TestDeviceQueuePrio, *new_test)
 {
     {
@@ -121,18 +125,15 @@ BOOST_AUTO_TEST_CASE(TestDeviceQueuePrio, *new_test)
         });
         if(iter != device.PhysicalDevices.end()){
             auto& dev = iter->second;
-            // get queue
-            std::list<std::unique_ptr<VK5::Vk_Queue>> buffer;
-            std::unique_ptr<VK5::Vk_Queue> queue = nullptr;
+            auto task = createTask(dev, VK5::Vk_GpuOp::Graphics);
 
-            auto task = std::make_unique<VK5::Vk_GpuTask>(dev.vk_logicalDevice(), VK5::Vk_GpuOp::Graphics);
-            while(true) {
-                queue = dev.getQueue(VK5::Vk_GpuOp::Graphics);
-                if(queue){
+            // all queues that can do Graphics, in priority order. The queues stay in the device
+            const auto& queueFamilies = dev.logicalDeviceQueue().queueFamilies();
+            for(auto familyIndex : dev.logicalDeviceQueue().queuesOpMap().at(VK5::Vk_GpuOp::Graphics)){
+                for(const auto& queue : queueFamilies.at(familyIndex)){
                     std::cout << "===========================================================" << std::endl;
                     std::cout << "Queue for " << VK5::Vk_GpuOp2String(VK5::Vk_GpuOp::Graphics) << ": " << queue->toString() << std::endl;
                     std::cout << "===========================================================" << std::endl;
-                    // device.logicalDevicesQueuesToStream(std::cout);
                     std::string bla = queue->toString();
                     task->mod()->params(VK5::Vk_GpuTaskParams(VK5::Vk_GpuOp::Graphics))
                                ->r(nullptr)
@@ -141,25 +142,8 @@ BOOST_AUTO_TEST_CASE(TestDeviceQueuePrio, *new_test)
 
                     task = queue->enqueue(std::move(task))->waitResponsively();
                     std::cout << "running " << bla << std::endl;
-
-                    buffer.emplace_back(std::move(queue));
-                }
-                else{
-                    break;
                 }
             }
-
-            std::cout << "===========================================================" << std::endl;
-            std::cout << "Empty... => put all back..." << std::endl;
-            std::cout << "===========================================================" << std::endl;
-
-            while(!buffer.empty()){
-                task = buffer.front()->enqueue(std::move(task))->waitResponsively();
-                dev.addQueue(VK5::Vk_GpuOp::Graphics, std::move(buffer.front()));
-                buffer.pop_front();
-                // std::cout << "===========================================================" << std::endl;
-                // device.logicalDevicesQueuesToStream(std::cout);
-            }
         }
     }
 }
@@ -189,7 +173,7 @@ BOOST_AUTO_TEST_CASE(TestDeviceTaskRunner, *all_tests)
 
             std::list<std::unique_ptr<VK5::Vk_GpuTask>> taskList;
             for(int i=0; i<100; ++i)
-                taskList.emplace_back(std::make_unique<VK5::Vk_GpuTask>(dev.vk_logicalDevice(), VK5::Vk_GpuOp::Graphics));
+                taskList.emplace_back(createTask(dev, VK5::Vk_GpuOp::Graphics));
 
             std::list<VK5::TGpuTaskRunner> running;
 
@@ -209,6 +193,114 @@ BOOST_AUTO_TEST_CASE(TestDeviceTaskRunner, *all_tests)
     }
 }
 
+BOOST_AUTO_TEST_CASE(TestDeviceTaskChain, *all_tests)
+{
+    {
+        std::vector<VK5::Vk_GpuOp> priorities = {VK5::Vk_GpuOp::Compute, VK5::Vk_GpuOp::Graphics, VK5::Vk_GpuOp::Transfer};
+        VK5::Vk_Device device("test", VK5::Vk_DevicePreference::USE_ANY_GPU, priorities);
+
+        auto iter = std::find_if(device.PhysicalDevices.begin(), device.PhysicalDevices.end(), [](const auto& device){
+            return device.second.physicalDevicePR().properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU;
+        });
+
+        if(iter != device.PhysicalDevices.end()){
+            auto& dev = iter->second;
+            // transfer -> compute -> graphics, every task waits for the previous one on the GPU only
+            std::vector<VK5::Vk_GpuOp> chain = {VK5::Vk_GpuOp::Transfer, VK5::Vk_GpuOp::Compute, VK5::Vk_GpuOp::Graphics};
+            std::vector<int> order;
+            // NOTE: the continuations run on the reactors of different queues => their order says nothing about the GPU.
+            // Every task checks on completion that the timeline of the one before was already signaled
+            std::vector<int> finishedBefore(chain.size(), -1);
+            std::mutex orderMutex;
+            VkDevice vkDevice = dev.vk_logicalDevice();
+
+            std::vector<VK5::TGpuTaskRunner> running;
+            for(size_t i=0; i<chain.size(); ++i){
+                auto task = createTask(dev, chain.at(i));
+                VK5::Vk_GpuTaskSignal previous = running.empty() ? VK5::Vk_GpuTaskSignal { .semaphore = nullptr, .value = 0 } : running.back()->signal();
+                task->mod()->t([&order, &finishedBefore, &orderMutex, i, previous, vkDevice](){
+                    uint64_t value = 0;
+                    if(previous.semaphore != nullptr) vkGetSemaphoreCounterValue(vkDevice, previous.semaphore, &value);
+                    std::lock_guard<std::mutex> lock(orderMutex);
+                    order.push_back(static_cast<int>(i));
+                    finishedBefore.at(i) = previous.semaphore == nullptr || value >= previous.value ? 1 : 0;
+                });
+                if(!running.empty()) task->mod()->w(running.back());
+                running.push_back(dev.enqueue(std::move(task)));
+            }
+
+            std::vector<std::unique_ptr<VK5::Vk_GpuTask>> finished;
+            for(auto r : running) finished.emplace_back(r->waitResponsively());
+
+            BOOST_REQUIRE_EQUAL(order.size(), chain.size());
+            std::sort(order.begin(), order.end());
+            BOOST_CHECK(order == std::vector<int>({0, 1, 2}));
+            // transfer before compute before graphics on the GPU
+            for(size_t i=0; i<chain.size(); ++i) BOOST_CHECK_EQUAL(finishedBefore.at(i), 1);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestDeviceFuture, *all_tests)
+{
+    {
+        std::vector<VK5::Vk_GpuOp> priorities = {VK5::Vk_GpuOp::Compute, VK5::Vk_GpuOp::Graphics, VK5::Vk_GpuOp::Transfer};
+        VK5::Vk_Device device("test", VK5::Vk_DevicePreference::USE_ANY_GPU, priorities);
+
+        auto iter = std::find_if(device.PhysicalDevices.begin(), device.PhysicalDevices.end(), [](const auto& device){
+            return device.second.physicalDevicePR().properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU;
+        });
+
+        if(iter != device.PhysicalDevices.end()){
+            auto& dev = iter->second;
+            VK5::Vk_GpuTaskPool& pool = dev.gpuTaskPool();
+            std::vector<VK5::Vk_GpuFuture> uploads;
+            for(int i=0; i<10; ++i)
+                uploads.push_back(dev.enqueue(pool.getOrCreateTask(VK5::Vk_GpuOp::Transfer)));
+
+            // all uploads => one draw that waits for them on the GPU => continuation, no blocking wait in between
+            // NOTE: enqueue from this thread, not from a continuation: dispatch may block on backpressure
+            std::unique_ptr<VK5::Vk_GpuTask> draw = pool.getOrCreateTask(VK5::Vk_GpuOp::Graphics);
+            for(const auto& u : uploads) draw->mod()->w(u.runner());
+            VK5::Vk_GpuFuture drawn = dev.enqueue(std::move(draw));
+            std::atomic<bool> done = false;
+            VK5::Vk_GpuFuture finished = drawn.then([&](){ done = true; });
+
+            while(!finished.ready()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            BOOST_CHECK(done == true);
+            for(auto& u : uploads) BOOST_CHECK(u.ready());
+
+            // everything is finished => waitResponsively returns right away
+            for(auto& u : uploads) pool.returnTask(u.runner()->waitResponsively());
+            pool.returnTask(drawn.runner()->waitResponsively());
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestDeviceTrace, *all_tests)
+{
+    {
+        std::vector<VK5::Vk_GpuOp> priorities = {VK5::Vk_GpuOp::Compute, VK5::Vk_GpuOp::Graphics, VK5::Vk_GpuOp::Transfer};
+        VK5::Vk_Device device("test", VK5::Vk_DevicePreference::USE_ANY_GPU, priorities);
+
+        for(auto& d : device.PhysicalDevices){
+            auto& dev = d.second;
+            dev.gpuTaskTracer().enable(true);
+            std::vector<VK5::Vk_GpuFuture> tasks;
+            for(int i=0; i<10; ++i)
+                tasks.push_back(dev.enqueue(createTask(dev, VK5::Vk_GpuOp::Transfer)));
+            VK5::Vk_GpuFuture::when_all(tasks).wait();
+            dev.gpuTaskTracer().enable(false);
+
+            std::stringstream json;
+            dev.gpuTaskTracer().toChromeJson(json);
+            BOOST_CHECK(json.str().starts_with("{\"displayTimeUnit\":\"ns\",\"traceEvents\":["));
+            BOOST_CHECK(json.str().find("\"submit wait\"") != std::string::npos);
+            BOOST_CHECK(dev.gpuTaskTracer().dropped() == 0);
+        }
+    }
+}
+
 BOOST_AUTO_TEST_CASE(TestDeviceMemory, *all_tests)
 {
     {
@@ -0,0 +1,117 @@
+#ifndef BOOST_TEST_INCLUDED
+    #include "boost/test/included/unit_test.hpp"
+#endif
+
+#include <vector>
+#include <cstdint>
+
+#include "../src/application/Vk_MemoryBudget.hpp"
+
+BOOST_AUTO_TEST_SUITE(TestMemoryBudget)
+
+auto new_test = boost::unit_test::enabled();
+auto all_tests = boost::unit_test::disabled();
+
+namespace {
+    // frees its bytes on heap 0 when demoted
+    struct TestClient : public VK5::Vk_MemoryBudgetClient {
+        VK5::Vk_MemoryBudget* budget;
+        std::uint64_t use;
+        std::uint64_t bytes;
+        std::vector<std::uint64_t>* demoted;
+
+        TestClient(VK5::Vk_MemoryBudget* budget, std::uint64_t use, std::uint64_t bytes, std::vector<std::uint64_t>* demoted)
+        : budget(budget), use(use), bytes(bytes), demoted(demoted)
+        {}
+
+        std::uint64_t lastUse() const override { return use; }
+        std::uint64_t demote() override {
+            if(bytes == 0) return 0;
+            budget->release(0, bytes);
+            demoted->push_back(use);
+            std::uint64_t freed = bytes;
+            bytes = 0;
+            return freed;
+        }
+    };
+
+    VK5::TGpuMemoryHeapsState heaps(std::uint64_t size, std::uint64_t budget, std::uint64_t usage) {
+        return { VK5::Vk_GpuMemoryHeapState {
+            .size = VK5::Vk_HeapSize::get(size), .budget = VK5::Vk_HeapSize::get(budget),
+            .usage = VK5::Vk_HeapSize::get(usage), .heapIndex = 0, .heapFlags = {} } };
+    }
+}
+
+BOOST_AUTO_TEST_CASE(TestMemoryBudgetUpdate, *new_test) {
+    VK5::Vk_MemoryBudget budget(0.5);
+    budget.init(heaps(1000, 0, 0));
+    BOOST_CHECK_EQUAL(budget.available(0), 500);
+    BOOST_CHECK(budget.reserve(0, 300, true));
+    BOOST_CHECK(!budget.reserve(0, 300, true));
+
+    // usage 400 contains our 300, the budget shrank to 900
+    budget.update(heaps(1000, 900, 400));
+    BOOST_CHECK_EQUAL(budget.available(0), 50);
+    budget.release(0, 300);
+    BOOST_CHECK_EQUAL(budget.available(0), 350);
+    BOOST_CHECK_EQUAL(budget.allocated(0), 0);
+    // unknown heaps are not limited
+    BOOST_CHECK(budget.reserve(7, 1ull << 40, true));
+}
+
+BOOST_AUTO_TEST_CASE(TestMemoryBudgetPressure, *new_test) {
+    VK5::Vk_MemoryBudget budget(1.0);
+    budget.init(heaps(1000, 0, 0));
+    std::vector<std::uint64_t> demoted;
+    TestClient recent(&budget, 20, 400, &demoted);
+    TestClient old(&budget, 10, 400, &demoted);
+    BOOST_REQUIRE(budget.reserve(0, 800, true));
+    budget.addClient(&recent);
+    budget.addClient(&old);
+
+    std::vector<std::uint64_t> missing;
+    auto id = budget.addPressureCallback([&](VK5::THeapIndex, std::uint64_t m){ missing.push_back(m); });
+
+    // host memory is never relieved by demotes
+    BOOST_CHECK(!budget.reserve(0, 300, false));
+    BOOST_CHECK(demoted.empty());
+
+    // the least recently used client goes first and that is enough
+    BOOST_CHECK(budget.reserve(0, 300, true));
+    BOOST_CHECK_EQUAL(demoted.size(), 1);
+    BOOST_CHECK_EQUAL(demoted.at(0), 10);
+    BOOST_CHECK_EQUAL(missing.size(), 2);
+    BOOST_CHECK_EQUAL(missing.at(1), 100);
+
+    budget.removePressureCallback(id);
+    budget.removeClient(&recent);
+    BOOST_CHECK(!budget.reserve(0, 900, true));
+    BOOST_CHECK_EQUAL(missing.size(), 2);
+    budget.removeClient(&old);
+}
+
+BOOST_AUTO_TEST_CASE(TestMemoryBudgetAllocatingScope, *new_test) {
+    VK5::Vk_MemoryBudget budget(1.0);
+    budget.init(heaps(1000, 0, 0));
+    std::vector<std::uint64_t> demoted;
+    TestClient allocating(&budget, 10, 400, &demoted);
+    TestClient other(&budget, 20, 400, &demoted);
+    BOOST_REQUIRE(budget.reserve(0, 800, true));
+    budget.addClient(&allocating);
+    budget.addClient(&other);
+
+    {
+        // the least recently used client allocates itself, the next one is demoted instead
+        VK5::Vk_MemoryBudgetAllocatingScope scope(&allocating);
+        BOOST_CHECK(VK5::Vk_MemoryBudgetAllocatingScope::contains(&allocating));
+        BOOST_CHECK(budget.reserve(0, 300, true));
+        BOOST_CHECK_EQUAL(demoted.size(), 1);
+        BOOST_CHECK_EQUAL(demoted.at(0), 20);
+    }
+    BOOST_CHECK(!VK5::Vk_MemoryBudgetAllocatingScope::contains(&allocating));
+
+    budget.removeClient(&other);
+    budget.removeClient(&allocating);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,142 @@
+#ifndef BOOST_TEST_INCLUDED
+    #include "boost/test/included/unit_test.hpp"
+#endif
+
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <queue>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <memory>
+
+#include "../src/utils/Ut_MpscRing.hpp"
+
+BOOST_AUTO_TEST_SUITE(TestMpscRing)
+
+auto new_test = boost::unit_test::enabled();
+auto all_tests = boost::unit_test::disabled();
+
+typedef std::chrono::steady_clock::time_point TStamp;
+
+/**
+ * Stand-in for the stage handover Vk_Queue used before the rings: std::queue + mutex + condition_variable
+ */
+class MutexQueue {
+    std::queue<std::unique_ptr<TStamp>> _q;
+    std::mutex _m;
+    std::condition_variable _c;
+public:
+    void push(std::unique_ptr<TStamp> v) {
+        {
+            std::unique_lock<std::mutex> lock(_m);
+            _q.push(std::move(v));
+        }
+        _c.notify_one();
+    }
+    std::unique_ptr<TStamp> pop() {
+        std::unique_lock<std::mutex> lock(_m);
+        _c.wait(lock, [this](){ return !_q.empty(); });
+        auto v = std::move(_q.front());
+        _q.pop();
+        return v;
+    }
+};
+
+class RingQueue {
+    UT::Ut_MpscRing<std::unique_ptr<TStamp>> _r;
+    UT::Ut_Parker _p;
+public:
+    RingQueue() : _r(1024) {}
+    void push(std::unique_ptr<TStamp> v) {
+        _r.push(std::move(v));
+        _p.notify();
+    }
+    std::unique_ptr<TStamp> pop() {
+        std::unique_ptr<TStamp> v;
+        while(!_r.tryPop(v)) _p.park([this](){ return !_r.empty(); });
+        return v;
+    }
+};
+
+/**
+ * Enqueue-to-dequeue latency with several producers and one consumer. Producers pause between the pushes
+ * now and then, so that the consumer has to park and be woken up again, same as the Vk_Queue stage threads.
+ */
+template<class TQueue>
+std::vector<double> measureLatency(int producers, int perProducer) {
+    TQueue queue;
+    std::vector<double> latencies;
+    latencies.reserve(producers*perProducer);
+
+    std::vector<std::thread> threads;
+    for(int p=0; p<producers; ++p){
+        threads.push_back(std::thread([&queue, perProducer](){
+            for(int i=0; i<perProducer; ++i){
+                queue.push(std::make_unique<TStamp>(std::chrono::steady_clock::now()));
+                if(i % 64 == 0) std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+        }));
+    }
+
+    for(int i=0; i<producers*perProducer; ++i){
+        auto stamp = queue.pop();
+        latencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - *stamp).count());
+    }
+    for(auto& t : threads) t.join();
+
+    std::sort(latencies.begin(), latencies.end());
+    return latencies;
+}
+
+void latencyToStream(const std::string& name, const std::vector<double>& latencies, std::ostream& stream) {
+    double sum = 0;
+    for(double l : latencies) sum += l;
+    stream << name
+           << " mean: " << sum / static_cast<double>(latencies.size()) << "us"
+           << " p50: " << latencies.at(latencies.size() / 2) << "us"
+           << " p99: " << latencies.at(latencies.size() * 99 / 100) << "us"
+           << std::endl;
+}
+
+BOOST_AUTO_TEST_CASE(TestMpscRingOrderAndCount, *new_test)
+{
+    // single producer => FIFO, multiple producers => nothing lost, nothing duplicated
+    UT::Ut_MpscRing<int> ring(3);
+    BOOST_CHECK(ring.capacity() == 4);
+    for(int i=0; i<4; ++i){ int v = i; BOOST_CHECK(ring.tryPush(v)); }
+    { int v = 4; BOOST_CHECK(!ring.tryPush(v)); }
+    for(int i=0; i<4; ++i){ int v = -1; BOOST_CHECK(ring.tryPop(v)); BOOST_CHECK(v == i); }
+    BOOST_CHECK(ring.empty());
+
+    const int producers = 4;
+    const int perProducer = 100000;
+    UT::Ut_MpscRing<int> mpsc(64);
+    std::vector<std::thread> threads;
+    for(int p=0; p<producers; ++p){
+        threads.push_back(std::thread([&mpsc, p](){
+            for(int i=0; i<perProducer; ++i) mpsc.push(p*perProducer + i);
+        }));
+    }
+    std::vector<int> seen(producers*perProducer, 0);
+    int count = 0;
+    int v = 0;
+    while(count < producers*perProducer){
+        if(mpsc.tryPop(v)) { seen.at(v)++; count++; }
+    }
+    for(auto& t : threads) t.join();
+    BOOST_CHECK(std::all_of(seen.begin(), seen.end(), [](int s){ return s == 1; }));
+}
+
+BOOST_AUTO_TEST_CASE(TestMpscRingLatency, *new_test)
+{
+    for(int producers : {1, 2, 4}){
+        std::cout << "producers: " << producers << std::endl;
+        latencyToStream("    mutex + condition_variable:", measureLatency<MutexQueue>(producers, 20000), std::cout);
+        latencyToStream("    mpsc ring + parker:        ", measureLatency<RingQueue>(producers, 20000), std::cout);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,61 @@
+#ifndef BOOST_TEST_INCLUDED
+    #include "boost/test/included/unit_test.hpp"
+#endif
+
+#include <vector>
+#include <random>
+#include <cstdint>
+
+#include "../src/utils/Ut_RangeAllocator.hpp"
+
+BOOST_AUTO_TEST_SUITE(TestRangeAllocator)
+
+auto new_test = boost::unit_test::enabled();
+auto all_tests = boost::unit_test::disabled();
+
+BOOST_AUTO_TEST_CASE(TestRangeAllocatorAlignAndMerge, *new_test) {
+    UT::Ut_RangeAllocator ranges(1024);
+    uint64_t a = ranges.allocate(100, 1);
+    uint64_t b = ranges.allocate(100, 256);
+    BOOST_CHECK_EQUAL(a, 0);
+    BOOST_CHECK_EQUAL(b, 256);
+    // [100, 256) is still free and gets used by small requests
+    BOOST_CHECK_EQUAL(ranges.allocate(150, 2), 100);
+    BOOST_CHECK_EQUAL(ranges.allocate(2000, 1), UT::Ut_RangeAllocator::InvalidOffset);
+
+    ranges.free(b, 100);
+    ranges.free(a, 100);
+    ranges.free(100, 150);
+    BOOST_CHECK(ranges.empty());
+    BOOST_CHECK_EQUAL(ranges.freeRangeCount(), 1);
+    BOOST_CHECK_EQUAL(ranges.largestFree(), 1024);
+}
+
+BOOST_AUTO_TEST_CASE(TestRangeAllocatorRandom, *new_test) {
+    struct Alloc { uint64_t offset; uint64_t size; };
+    UT::Ut_RangeAllocator ranges(1 << 20);
+    std::vector<Alloc> live;
+    std::mt19937 rng(42);
+    for(int i=0; i<20000; ++i){
+        if(live.empty() || rng() % 3 != 0){
+            uint64_t size = 1 + rng() % 4096;
+            uint64_t alignment = uint64_t(1) << (rng() % 9);
+            uint64_t offset = ranges.allocate(size, alignment);
+            if(offset == UT::Ut_RangeAllocator::InvalidOffset) continue;
+            BOOST_REQUIRE_EQUAL(offset % alignment, 0);
+            BOOST_REQUIRE_LE(offset + size, ranges.size());
+            for(const auto& l : live) BOOST_REQUIRE(offset + size <= l.offset || l.offset + l.size <= offset);
+            live.push_back({offset, size});
+        }
+        else {
+            size_t index = rng() % live.size();
+            ranges.free(live[index].offset, live[index].size);
+            live.erase(live.begin() + index);
+        }
+    }
+    for(const auto& l : live) ranges.free(l.offset, l.size);
+    BOOST_CHECK(ranges.empty());
+    BOOST_CHECK_EQUAL(ranges.freeRangeCount(), 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
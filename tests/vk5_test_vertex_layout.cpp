@@ -0,0 +1,57 @@
+#ifndef BOOST_TEST_INCLUDED
+    #include "boost/test/included/unit_test.hpp"
+#endif
+
+#include <cmath>
+#include <cstddef>
+
+#include "../src/buffers/Vk_Structures.hpp"
+
+BOOST_AUTO_TEST_SUITE(TestVertexLayout)
+
+auto new_test = boost::unit_test::enabled();
+auto all_tests = boost::unit_test::disabled();
+
+BOOST_AUTO_TEST_CASE(TestVertexLayoutHalf, *new_test) {
+    // every half (except NaN) survives half => float => half
+    for(uint32_t h = 0; h < 65536; ++h){
+        VK5::Vk_Half half { static_cast<std::uint16_t>(h) };
+        float f = half.toFloat();
+        if(std::isnan(f)) continue;
+        BOOST_REQUIRE_EQUAL(VK5::Vk_Half::fromFloat(f).bits, h);
+    }
+    BOOST_CHECK_EQUAL(VK5::Vk_Half::fromFloat(1.0f).bits, 0x3C00);
+    BOOST_CHECK_EQUAL(VK5::Vk_Half::fromFloat(65504.0f).bits, 0x7BFF);
+    // rounds to Inf
+    BOOST_CHECK_EQUAL(VK5::Vk_Half::fromFloat(65520.0f).bits, 0x7C00);
+    BOOST_CHECK_EQUAL(VK5::Vk_Snorm16::fromFloat(-2.0f).value, -32767);
+    BOOST_CHECK_EQUAL(VK5::Vk_Unorm8::fromFloat(1.0f).value, 255);
+}
+
+BOOST_AUTO_TEST_CASE(TestVertexLayoutDescriptions, *new_test) {
+    auto attributes = VK5::Vk_Vertex_PCNT::getAttributeDescriptions(1, 0, 1, 2, 3);
+    BOOST_REQUIRE_EQUAL(attributes.size(), 4);
+    BOOST_CHECK_EQUAL(attributes[0].offset, offsetof(VK5::Vk_Vertex_PCNT, pos));
+    BOOST_CHECK_EQUAL(attributes[2].offset, offsetof(VK5::Vk_Vertex_PCNT, normal));
+    BOOST_CHECK_EQUAL(attributes[3].offset, offsetof(VK5::Vk_Vertex_PCNT, uv));
+    BOOST_CHECK_EQUAL(attributes[3].format, VK_FORMAT_R32G32_SFLOAT);
+    BOOST_CHECK_EQUAL(attributes[3].binding, 1);
+    BOOST_CHECK_EQUAL(VK5::Vk_Vertex_PCNT::innerDimensionLen(), 11);
+    BOOST_CHECK_EQUAL(VK5::Vk_Vertex_PCNT::getBindingDescription(1).stride, sizeof(VK5::Vk_Vertex_PCNT));
+
+    auto compact = VK5::Vk_Vertex_PCN_Compact::getAttributeDescriptions(0, 0, 1, 2);
+    BOOST_CHECK_EQUAL(sizeof(VK5::Vk_Vertex_PCN_Compact), 20);
+    BOOST_CHECK_EQUAL(compact[0].format, VK_FORMAT_R16G16B16A16_SFLOAT);
+    BOOST_CHECK_EQUAL(compact[1].format, VK_FORMAT_R8G8B8A8_UNORM);
+    BOOST_CHECK_EQUAL(compact[1].offset, 8);
+    BOOST_CHECK_EQUAL(compact[2].format, VK_FORMAT_R16G16B16A16_SNORM);
+    BOOST_CHECK_EQUAL(compact[2].offset, 12);
+
+    VK5::Vk_Vertex_PCN vertex { {1, 2, 3}, {1, 0, 0.5}, {0, 0, -1} };
+    auto packed = VK5::Vk_Vertex_PCN_Compact::fromVertex(vertex);
+    BOOST_CHECK_EQUAL(packed.pos[2].toFloat(), 3.0f);
+    BOOST_CHECK_EQUAL(packed.normal[2].value, -32767);
+    BOOST_CHECK(VK5::Vk_Vertex_PCN_Compact::TLayout::compareAll(&packed, &packed, 1));
+}
+
+BOOST_AUTO_TEST_SUITE_END()